@@ -1,4 +1,6 @@
 #include "matrice.h"
+#include "reader.h"
+#include "writer.h"
 
 /*********************************/
 /* create a new matrix with zero */
@@ -134,7 +136,7 @@ struct matrix_t *read_matrix(char *filename)
 struct vector_t *import_vector(struct vector_t *b, char *filename)
 {
     long int n, j;
-    FILE *fd;
+    struct reader_t *fd;
     int nb_read;
     long int rayid;
     double val;
@@ -145,11 +147,8 @@ struct vector_t *import_vector(struct vector_t *b, char *filename)
     }
     fprintf(stdout, "importing vector b from '%s' into (%p) ... ",
             filename, b);
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld", &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &n);
     if (nb_read != 1) {
         fprintf(stderr, "Error reading 'n' in '%s'\n", filename);
         exit(1);
@@ -162,8 +161,9 @@ struct vector_t *import_vector(struct vector_t *b, char *filename)
     }
     /* load vector data from file */
     j = 0;
-    while (!feof(fd)) {
-        nb_read = fscanf(fd, "%ld %lf\n", &rayid, &val);
+    while (!reader_eof(fd)) {
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_double(fd, &val);
 
         if (nb_read != 2) {
             fprintf(stderr, "Error reading mat[%ld] in '%s'\n",
@@ -178,7 +178,7 @@ struct vector_t *import_vector(struct vector_t *b, char *filename)
         b->mat[rayid] = val;
         j++;
     }
-    fclose(fd);
+    reader_close(fd);
     fprintf(stdout, "%ld lines\n", j);
     fflush(stdout);
     return (b);
@@ -198,16 +198,13 @@ struct vector_t *read_simple_vector(char *filename)
 {
     struct vector_t *b;
     long int n, j;
-    FILE *fd;
+    struct reader_t *fd;
     int nb_read;
     double val;
 
     fprintf(stdout, "reading 'simple' vector b from '%s' ... ", filename);
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld", &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &n);
     if (nb_read != 1) {
         fprintf(stderr, "Error reading 'n' in '%s'\n", filename);
         exit(1);
@@ -218,8 +215,8 @@ struct vector_t *read_simple_vector(char *filename)
 
     /* load vector data from file */
     j = 0;
-    while (!feof(fd)) {
-        nb_read = fscanf(fd, "%lf\n", &val);
+    while (!reader_eof(fd)) {
+        nb_read = reader_double(fd, &val);
         if (nb_read != 1) {
             fprintf(stderr, "Error reading mat[%ld] in '%s'\n",
                     j, filename);
@@ -235,7 +232,7 @@ struct vector_t *read_simple_vector(char *filename)
                 j, n);
         exit(1);
     }
-    fclose(fd);
+    reader_close(fd);
     fprintf(stdout, "%ld lines\n", j);
     fflush(stdout);
     return (b);
@@ -254,17 +251,14 @@ struct vector_t *read_vector(char *filename)
 {
     struct vector_t *b;
     long int n, j;
-    FILE *fd;
+    struct reader_t *fd;
     int nb_read;
     long int rayid;
     double val;
 
     fprintf(stdout, "reading vector b from '%s' ... ", filename);
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld", &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &n);
     if (nb_read != 1) {
         fprintf(stderr, "Error reading 'n' in '%s'\n", filename);
         exit(1);
@@ -276,8 +270,9 @@ struct vector_t *read_vector(char *filename)
 
     /* load vector data from file */
     j = 0;
-    while (!feof(fd)) {
-        nb_read = fscanf(fd, "%ld %lf\n", &rayid, &val);
+    while (!reader_eof(fd)) {
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_double(fd, &val);
 
         if (nb_read != 2) {
             fprintf(stderr, "Error reading mat[%ld] in '%s'\n",
@@ -292,7 +287,7 @@ struct vector_t *read_vector(char *filename)
         b->mat[rayid] = val;
         j++;
     }
-    fclose(fd);
+    reader_close(fd);
     fprintf(stdout, "%ld lines\n", j);
     fflush(stdout);
     return (b);
@@ -301,19 +296,20 @@ struct vector_t *read_vector(char *filename)
 void write_vector(struct vector_t *b, char *filename)
 {
     long int i;
-    FILE *fd;
+    struct writer_t *w;
 
     fprintf(stdout, "writing vector b to '%s' ... ", filename);
-    if (!(fd = fopen(filename, "w"))) {
-        perror(filename);
-        exit(1);
-    }
-    fprintf(fd, "%ld\n", b->length);
+    w = writer_open(filename);
+    writer_long(w, b->length);
+    writer_char(w, '\n');
     for (i = 0; i < b->length; i++) {
-        fprintf(fd, "%ld %f\n", i, b->mat[i]);
+        writer_long(w, i);
+        writer_char(w, ' ');
+        writer_double(w, b->mat[i]);
+        writer_char(w, '\n');
     }
 
-    fclose(fd);
+    writer_close(w);
     fprintf(stdout, "%ld items\n", b->length);
 }
 
@@ -326,17 +322,14 @@ struct vector_t *read_subvector(char *filename, long int *first,
 {
     struct vector_t *b;
     long int n, j;
-    FILE *fd;
+    struct reader_t *fd;
     int nb_read;
     long int rayid, min_rayid, max_rayid;
     double val;
 
     fprintf(stdout, "reading sub-vector b from '%s' ... ", filename);
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld", &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &n);
     if (nb_read != 1) {
         fprintf(stderr, "Error reading 'n' in '%s'\n", filename);
         exit(1);
@@ -347,12 +340,9 @@ struct vector_t *read_subvector(char *filename, long int *first,
 
     /* load vector data from file */
     j = 0;
-    while (1) {
-        nb_read = fscanf(fd, "%ld %lf", &rayid, &val);
-
-        if (feof(fd)) {
-            break;
-        }
+    while (!reader_eof(fd)) {
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_double(fd, &val);
         if (nb_read != 2) {
             fprintf(stderr, "Error reading mat[%ld] in '%s'\n",
                     j, filename);
@@ -367,7 +357,7 @@ struct vector_t *read_subvector(char *filename, long int *first,
         b->mat[rayid] = val;
         j++;
     }
-    fclose(fd);
+    reader_close(fd);
 
     *first = min_rayid;
     *last = max_rayid;
@@ -0,0 +1,755 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define READER_GZIP 1
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define READER_ZSTD 1
+#include <zstd.h>
+#endif
+
+#include "reader.h"
+
+#define READER_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* decompressed blocks the codec thread may have ahead of the parser */
+#define READER_CODEC_BLOCK (4 * 1024 * 1024)
+#define READER_CODEC_NB_BLOCK 4
+
+/* compressed bytes read at once */
+#define READER_CODEC_INPUT (1024 * 1024)
+
+enum reader_codec_type_t {
+    READER_CODEC_NONE = 0,
+    READER_CODEC_GZIP,
+    READER_CODEC_ZSTD
+};
+
+struct reader_codec_t {
+    int type;
+    int fd;
+    char *filename;
+
+    /* compressed input */
+    unsigned char *in;
+    size_t in_pos;
+    size_t in_len;
+    int in_eof;
+    int finished;
+#ifdef READER_GZIP
+    z_stream z;
+#endif
+#ifdef READER_ZSTD
+    ZSTD_DStream *zd;
+    int frame_end;
+#endif
+
+    /* ring of decompressed blocks, filled by the codec thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *block[READER_CODEC_NB_BLOCK];
+    size_t len[READER_CODEC_NB_BLOCK];
+    long int nb_full;
+    long int nb_used;
+    size_t used_pos;
+    int done;
+    int stop;
+};
+
+/* a number can't be longer than that */
+#define READER_MAX_TOKEN 1024
+
+/* exact powers of ten in a double */
+static const double reader_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+#define READER_IS_SPACE(c) \
+    ((c) == ' ' || (c) == '\n' || (c) == '\t' || (c) == '\r' || \
+     (c) == '\v' || (c) == '\f')
+
+#define READER_IS_DIGIT(c) ((unsigned int) ((c) - '0') < 10)
+
+/* refill the compressed input, return 0 at the end of the file */
+static int reader_codec_input(struct reader_codec_t *c)
+{
+    ssize_t n;
+
+    c->in_pos = 0;
+    c->in_len = 0;
+    while (!c->in_eof) {
+        n = read(c->fd, c->in, READER_CODEC_INPUT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(c->filename);
+            exit(1);
+        }
+        if (n == 0) {
+            c->in_eof = 1;
+            break;
+        }
+        c->in_len = n;
+        return (1);
+    }
+    return (0);
+}
+
+#ifdef READER_GZIP
+/* inflate up to n bytes into out, concatenated gzip members (as written
+   by pigz or cat) being one stream */
+static size_t reader_gzip(struct reader_codec_t *c, char *out, size_t n)
+{
+    int ret;
+
+    c->z.next_out = (unsigned char *) out;
+    c->z.avail_out = n;
+    while (c->z.avail_out > 0) {
+        if (c->z.avail_in == 0) {
+            if (!reader_codec_input(c)) {
+                fprintf(stderr, "%s: truncated gzip file\n", c->filename);
+                exit(1);
+            }
+            c->z.next_in = c->in;
+            c->z.avail_in = c->in_len;
+        }
+        ret = inflate(&c->z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            if (c->z.avail_in == 0) {
+                if (!reader_codec_input(c)) {
+                    c->finished = 1;
+                    break;
+                }
+                c->z.next_in = c->in;
+                c->z.avail_in = c->in_len;
+            }
+            inflateReset(&c->z);
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "%s: gzip error (%s)\n", c->filename,
+                    c->z.msg ? c->z.msg : "inflate");
+            exit(1);
+        }
+    }
+    return (n - c->z.avail_out);
+}
+#endif
+
+#ifdef READER_ZSTD
+/* decompress up to n bytes into out, all the frames of the file */
+static size_t reader_zstd(struct reader_codec_t *c, char *out, size_t n)
+{
+    ZSTD_outBuffer o = { out, n, 0 };
+
+    ZSTD_inBuffer i;
+
+    size_t ret;
+
+    while (o.pos < o.size) {
+        if (c->in_pos == c->in_len) {
+            if (!reader_codec_input(c)) {
+                if (!c->frame_end) {
+                    fprintf(stderr, "%s: truncated zstd file\n",
+                            c->filename);
+                    exit(1);
+                }
+                c->finished = 1;
+                break;
+            }
+        }
+        i.src = c->in;
+        i.size = c->in_len;
+        i.pos = c->in_pos;
+        ret = ZSTD_decompressStream(c->zd, &o, &i);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "%s: zstd error (%s)\n", c->filename,
+                    ZSTD_getErrorName(ret));
+            exit(1);
+        }
+        c->in_pos = i.pos;
+        c->frame_end = (ret == 0);
+    }
+    return (o.pos);
+}
+#endif
+
+/* codec thread : fill the free blocks of the ring until the end of the
+   file */
+static void *reader_codec_run(void *arg)
+{
+    struct reader_codec_t *c = (struct reader_codec_t *) arg;
+
+    size_t len = 0;
+
+    int b, stop;
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        while (!c->stop
+               && c->nb_full - c->nb_used == READER_CODEC_NB_BLOCK) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        stop = c->stop;
+        pthread_mutex_unlock(&c->lock);
+        if (stop) {
+            break;
+        }
+
+        b = c->nb_full % READER_CODEC_NB_BLOCK;
+#ifdef READER_GZIP
+        if (c->type == READER_CODEC_GZIP) {
+            len = reader_gzip(c, c->block[b], READER_CODEC_BLOCK);
+        }
+#endif
+#ifdef READER_ZSTD
+        if (c->type == READER_CODEC_ZSTD) {
+            len = reader_zstd(c, c->block[b], READER_CODEC_BLOCK);
+        }
+#endif
+
+        pthread_mutex_lock(&c->lock);
+        c->len[b] = len;
+        if (len) {
+            c->nb_full++;
+        }
+        c->done = c->finished;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+        if (c->finished) {
+            break;
+        }
+    }
+    return (NULL);
+}
+
+/* compression of the file from its first bytes */
+static int reader_codec_type(int fd)
+{
+    unsigned char magic[4];
+
+    if (pread(fd, magic, 4, 0) != 4) {
+        return (READER_CODEC_NONE);
+    }
+    if (magic[0] == 0x1f && magic[1] == 0x8b) {
+        return (READER_CODEC_GZIP);
+    }
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f
+        && magic[3] == 0xfd) {
+        return (READER_CODEC_ZSTD);
+    }
+    return (READER_CODEC_NONE);
+}
+
+static struct reader_codec_t *reader_codec_open(int type, int fd,
+                                                char *filename)
+{
+    struct reader_codec_t *c;
+
+    int b;
+
+#ifndef READER_GZIP
+    if (type == READER_CODEC_GZIP) {
+        fprintf(stderr, "%s: gzip compressed, not supported by this build\n",
+                filename);
+        exit(1);
+    }
+#endif
+#ifndef READER_ZSTD
+    if (type == READER_CODEC_ZSTD) {
+        fprintf(stderr, "%s: zstd compressed, not supported by this build\n",
+                filename);
+        exit(1);
+    }
+#endif
+
+    c = (struct reader_codec_t *) calloc(1, sizeof(struct reader_codec_t));
+    assert(c);
+    c->type = type;
+    c->fd = fd;
+    c->filename = filename;
+    c->in = (unsigned char *) malloc(READER_CODEC_INPUT);
+    assert(c->in);
+    for (b = 0; b < READER_CODEC_NB_BLOCK; b++) {
+        c->block[b] = (char *) malloc(READER_CODEC_BLOCK);
+        assert(c->block[b]);
+    }
+#ifdef READER_GZIP
+    if (type == READER_CODEC_GZIP) {
+        /* gzip header only */
+        if (inflateInit2(&c->z, 16 + MAX_WBITS) != Z_OK) {
+            fprintf(stderr, "%s: inflateInit2 failed\n", filename);
+            exit(1);
+        }
+    }
+#endif
+#ifdef READER_ZSTD
+    if (type == READER_CODEC_ZSTD) {
+        c->zd = ZSTD_createDStream();
+        assert(c->zd);
+        ZSTD_initDStream(c->zd);
+    }
+#endif
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    if (pthread_create(&c->thread, NULL, reader_codec_run, c)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    return (c);
+}
+
+static void reader_codec_close(struct reader_codec_t *c)
+{
+    int b;
+
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+#ifdef READER_GZIP
+    if (c->type == READER_CODEC_GZIP) {
+        inflateEnd(&c->z);
+    }
+#endif
+#ifdef READER_ZSTD
+    if (c->type == READER_CODEC_ZSTD) {
+        ZSTD_freeDStream(c->zd);
+    }
+#endif
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    for (b = 0; b < READER_CODEC_NB_BLOCK; b++) {
+        free(c->block[b]);
+    }
+    free(c->in);
+    free(c);
+}
+
+/* copy at most n decompressed bytes, 0 at the end of the file */
+static size_t reader_codec_read(struct reader_codec_t *c, char *dst,
+                                size_t n)
+{
+    size_t left;
+
+    int b;
+
+    pthread_mutex_lock(&c->lock);
+    while (c->nb_full == c->nb_used && !c->done) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (c->nb_full == c->nb_used) {
+        pthread_mutex_unlock(&c->lock);
+        return (0);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    b = c->nb_used % READER_CODEC_NB_BLOCK;
+    left = c->len[b] - c->used_pos;
+    if (n > left) {
+        n = left;
+    }
+    memcpy(dst, c->block[b] + c->used_pos, n);
+    c->used_pos += n;
+    if (c->used_pos == c->len[b]) {
+        /* give the block back to the codec thread */
+        pthread_mutex_lock(&c->lock);
+        c->nb_used++;
+        c->used_pos = 0;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+    }
+    return (n);
+}
+
+/** \brief open filename for reading, exit on failure as the other
+ readers do **/
+struct reader_t *reader_open(char *filename)
+{
+    return (reader_open_at(filename, 0));
+}
+
+/** \brief open filename for reading from byte offset **/
+struct reader_t *reader_open_at(char *filename, off_t offset)
+{
+    struct reader_t *r;
+
+    int type;
+
+    r = (struct reader_t *) malloc(sizeof(struct reader_t));
+    assert(r);
+
+    if ((r->fd = open(filename, O_RDONLY)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    r->codec = NULL;
+    type = reader_codec_type(r->fd);
+    if (type != READER_CODEC_NONE) {
+        if (offset) {
+            fprintf(stderr,
+                    "reader_open_at: '%s' is compressed, can't start at %ld\n",
+                    filename, (long int) offset);
+            exit(1);
+        }
+        r->codec = reader_codec_open(type, r->fd, filename);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(r->fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (offset && lseek(r->fd, offset, SEEK_SET) != offset) {
+        perror(filename);
+        exit(1);
+    }
+    r->offset = offset;
+    r->filename = filename;
+    r->size = READER_BUFFER_SIZE;
+    r->buf = (char *) malloc(r->size + 1);
+    assert(r->buf);
+    r->pos = r->buf;
+    r->end = r->buf;
+    *r->end = '\0';
+    r->eof = 0;
+
+    return (r);
+}
+
+void reader_close(struct reader_t *r)
+{
+    if (r->codec) {
+        reader_codec_close(r->codec);
+    }
+    close(r->fd);
+    free(r->buf);
+    free(r);
+}
+
+/* keep the unread bytes and fill the rest of the buffer */
+static void reader_fill(struct reader_t *r)
+{
+    size_t left = r->end - r->pos;
+
+    ssize_t n;
+
+    r->offset += r->pos - r->buf;
+    memmove(r->buf, r->pos, left);
+    r->pos = r->buf;
+    r->end = r->buf + left;
+
+    while (!r->eof && r->end < r->buf + r->size) {
+        if (r->codec) {
+            n = reader_codec_read(r->codec, r->end,
+                                  r->buf + r->size - r->end);
+        } else {
+            n = read(r->fd, r->end, r->buf + r->size - r->end);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(r->filename);
+            exit(1);
+        }
+        if (n == 0) {
+            r->eof = 1;
+            break;
+        }
+        r->end += n;
+    }
+    *r->end = '\0';
+}
+
+/*
+ * skip blanks, return 0 at the end of file. On return, a whole token is
+ * in the buffer.
+ */
+static int reader_skip(struct reader_t *r)
+{
+    for (;;) {
+        while (r->pos < r->end && READER_IS_SPACE(*r->pos)) {
+            r->pos++;
+        }
+        if (r->pos < r->end) {
+            break;
+        }
+        if (r->eof) {
+            return (0);
+        }
+        reader_fill(r);
+    }
+    if (!r->eof && r->end - r->pos < READER_MAX_TOKEN) {
+        reader_fill(r);
+    }
+    return (1);
+}
+
+/** \brief return 1 if only blanks are left **/
+int reader_eof(struct reader_t *r)
+{
+    return (!reader_skip(r));
+}
+
+/* copy the current token as a C string */
+static char *reader_token(struct reader_t *r, char *token)
+{
+    long int k = 0;
+
+    while (k < READER_MAX_TOKEN - 1 && r->pos + k < r->end
+           && !READER_IS_SPACE(r->pos[k])) {
+        token[k] = r->pos[k];
+        k++;
+    }
+    token[k] = '\0';
+    return (token);
+}
+
+/** \brief next non blank character (not consumed), EOF at the end of
+ file **/
+int reader_peek(struct reader_t *r)
+{
+    if (!reader_skip(r)) {
+        return (EOF);
+    }
+    return ((unsigned char) *r->pos);
+}
+
+/** \brief read a word (up to the next blank) into word, truncated to
+ size - 1 characters, return 0 at the end of file **/
+int reader_word(struct reader_t *r, char *word, size_t size)
+{
+    size_t k = 0;
+
+    if (!reader_skip(r)) {
+        return (0);
+    }
+    while (r->pos < r->end && !READER_IS_SPACE(*r->pos)) {
+        if (k + 1 < size) {
+            word[k++] = *r->pos;
+        }
+        r->pos++;
+    }
+    word[k] = '\0';
+    return (1);
+}
+
+/** \brief read an integer, return 1 on success, 0 otherwise **/
+int reader_long(struct reader_t *r, long int *v)
+{
+    char token[READER_MAX_TOKEN], *last;
+
+    const char *p;
+
+    unsigned long int n = 0;
+
+    int neg = 0, nb_digit = 0;
+
+    if (!reader_skip(r)) {
+        return (0);
+    }
+    p = r->pos;
+    if (*p == '-' || *p == '+') {
+        neg = (*p == '-');
+        p++;
+    }
+    while (READER_IS_DIGIT(*p)) {
+        n = n * 10 + (*p - '0');
+        nb_digit++;
+        p++;
+    }
+    if (!nb_digit) {
+        return (0);
+    }
+    if (nb_digit > 18) {
+        /* may overflow, let strtol decide */
+        *v = strtol(reader_token(r, token), &last, 10);
+        r->pos += last - token;
+        return (1);
+    }
+    *v = neg ? -(long int) n : (long int) n;
+    r->pos = (char *) p;
+    return (1);
+}
+
+/** \brief read a double, return 1 on success, 0 otherwise
+
+ Decimal numbers with at most 19 significant digits and a small enough
+ exponent are converted with a single rounding (Clinger's fast path), so
+ the result is correctly rounded. Anything else (long mantissa, large
+ exponent, inf, nan, hexadecimal, ...) goes through strtod.
+**/
+int reader_double(struct reader_t *r, double *v)
+{
+    char token[READER_MAX_TOKEN], *last;
+
+    const char *p;
+
+    unsigned long int mantissa = 0;
+
+    int neg = 0, nb_digit = 0, nb_significant = 0, exp_neg = 0;
+
+    long int exponent = 0, e = 0;
+
+    double d;
+
+    if (!reader_skip(r)) {
+        return (0);
+    }
+    p = r->pos;
+    if (*p == '-' || *p == '+') {
+        neg = (*p == '-');
+        p++;
+    }
+    while (READER_IS_DIGIT(*p)) {
+        if (mantissa || *p != '0') {
+            mantissa = mantissa * 10 + (*p - '0');
+            nb_significant++;
+        }
+        nb_digit++;
+        p++;
+        if (nb_significant > 19) {
+            goto slow_path;
+        }
+    }
+    if (*p == '.') {
+        p++;
+        while (READER_IS_DIGIT(*p)) {
+            if (mantissa || *p != '0') {
+                mantissa = mantissa * 10 + (*p - '0');
+                nb_significant++;
+            }
+            nb_digit++;
+            exponent--;
+            p++;
+            if (nb_significant > 19) {
+                goto slow_path;
+            }
+        }
+    }
+    if (!nb_digit) {
+        goto slow_path;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '-' || *p == '+') {
+            exp_neg = (*p == '-');
+            p++;
+        }
+        if (!READER_IS_DIGIT(*p)) {
+            goto slow_path;
+        }
+        while (READER_IS_DIGIT(*p)) {
+            if (e < 100000) {
+                e = e * 10 + (*p - '0');
+            }
+            p++;
+        }
+        exponent += exp_neg ? -e : e;
+    }
+    if (*p && !READER_IS_SPACE(*p)) {
+        goto slow_path;
+    }
+    if (mantissa > (1UL << 53) || exponent < -22 || exponent > 22) {
+        goto slow_path;
+    }
+
+    d = (double) mantissa;
+    if (exponent < 0) {
+        d /= reader_pow10[-exponent];
+    } else {
+        d *= reader_pow10[exponent];
+    }
+    *v = neg ? -d : d;
+    r->pos = (char *) p;
+    return (1);
+
+  slow_path:
+    *v = strtod(reader_token(r, token), &last);
+    if (last == token) {
+        return (0);
+    }
+    r->pos += last - token;
+    return (1);
+}
+
+/** \brief return 1 if the file is decompressed on the fly (it can only
+ be read sequentially) **/
+int reader_compressed(struct reader_t *r)
+{
+    return (r->codec != NULL);
+}
+
+/** \brief size of the file in bytes (compressed size for a compressed
+ file) **/
+off_t reader_size(struct reader_t *r)
+{
+    struct stat st;
+
+    if (fstat(r->fd, &st)) {
+        perror(r->filename);
+        exit(1);
+    }
+    return (st.st_size);
+}
+
+/** \brief file offset of the next byte to be parsed **/
+off_t reader_tell(struct reader_t *r)
+{
+    return (r->offset + (r->pos - r->buf));
+}
+
+/** \brief go to the beginning of the next line, return 0 at the end of
+ file **/
+int reader_skip_line(struct reader_t *r)
+{
+    char *p;
+
+    for (;;) {
+        p = memchr(r->pos, '\n', r->end - r->pos);
+        if (p) {
+            r->pos = p + 1;
+            return (1);
+        }
+        r->pos = r->end;
+        if (r->eof) {
+            return (0);
+        }
+        reader_fill(r);
+    }
+}
+
+/** \brief skip blanks up to the end of the line, return 1 if nothing else
+ is left on the line **/
+int reader_end_of_line(struct reader_t *r)
+{
+    for (;;) {
+        while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t'
+                                   || *r->pos == '\r')) {
+            r->pos++;
+        }
+        if (r->pos < r->end) {
+            return (*r->pos == '\n');
+        }
+        if (r->eof) {
+            return (1);
+        }
+        reader_fill(r);
+    }
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef __READER_H__
+#define __READER_H__
+
+/*
+ * buffered text reader : the file is read by large blocks and numbers are
+ * parsed in place, instead of going through fscanf.
+ * buf always holds a '\0' after the last valid byte (end).
+ *
+ * gzip and zstd files are recognized by their magic number and
+ * decompressed on the fly by a second thread (codec), a few blocks ahead
+ * of the parser.
+ */
+struct reader_codec_t;
+
+struct reader_t {
+    int fd;
+    char *filename;
+    char *buf;
+    size_t size;
+    off_t offset;
+    char *pos;
+    char *end;
+    int eof;
+    struct reader_codec_t *codec;
+};
+
+struct reader_t *reader_open(char *filename);
+struct reader_t *reader_open_at(char *filename, off_t offset);
+void reader_close(struct reader_t *r);
+off_t reader_size(struct reader_t *r);
+int reader_compressed(struct reader_t *r);
+off_t reader_tell(struct reader_t *r);
+int reader_skip_line(struct reader_t *r);
+int reader_end_of_line(struct reader_t *r);
+
+int reader_eof(struct reader_t *r);
+int reader_peek(struct reader_t *r);
+int reader_word(struct reader_t *r, char *word, size_t size);
+int reader_long(struct reader_t *r, long int *v);
+int reader_double(struct reader_t *r, double *v);
+
+#endif
@@ -2,7 +2,19 @@
 #include <config.h>
 #endif
 
+#include <limits.h>
+#include <strings.h>
+#include <sys/mman.h>
+
 #include "sparse.h"
+#include "reader.h"
+#include "writer.h"
+
+/* Matrix Market header of write_mm_sparse_matrix */
+#define SPARSE_MM_BANNER "%%MatrixMarket matrix coordinate real general\n"
+
+/* items formatted by a thread at a time by the text writers */
+#define SPARSE_WRITE_BLOCK_ITEM (256 * 1024)
 
 /** \brief Library information **/
 char *libsparseversion()
@@ -18,9 +30,49 @@ char *libsparseversion()
 struct sparse_matrix_t *new_sparse_matrix(long int nb_line,
                                           long int nb_col,
                                           int col_link_status)
+{
+    return (new_sparse_matrix_with_storage(nb_line, nb_col,
+                                           col_link_status,
+                                           SPARSE_STORAGE_64));
+}
+
+/* stop on a storage with several value widths, or 32 bit indices too
+   small for the matrix */
+static void sparse_check_storage(const char *func, long int nb_line,
+                                 long int nb_col, int storage)
+{
+    int value = storage & (SPARSE_VALUE_32 | SPARSE_VALUE_16);
+
+    if ((storage & ~(SPARSE_INDEX_32 | SPARSE_INDEX_DELTA | SPARSE_VALUE_32
+                     | SPARSE_VALUE_16)) || (value & (value - 1))) {
+        fprintf(stderr, "%s: bad storage %d\n", func, storage);
+        exit(1);
+    }
+    if ((storage & SPARSE_INDEX_32) &&
+        (nb_line > INT_MAX || nb_col > INT_MAX)) {
+        fprintf(stderr, "%s: (%ldx%ld) too large for 32 bit indices\n",
+                func, nb_line, nb_col);
+        exit(1);
+    }
+}
+
+/** \brief Create a sparse matrix, choosing its frozen storage :
+
+ storage = SPARSE_STORAGE_64 or SPARSE_INDEX_32 | one of SPARSE_VALUE_32,
+ SPARSE_VALUE_BF16, SPARSE_VALUE_FP16 (32 bit indices and/or float,
+ bfloat16 or half values once frozen, linked items are always 64 bit).
+ Products and reductions always accumulate in double. SPARSE_INDEX_DELTA
+ adds the delta coding of the line indices (see sparse_delta.c).
+**/
+struct sparse_matrix_t *new_sparse_matrix_with_storage(long int nb_line,
+                                                       long int nb_col,
+                                                       int col_link_status,
+                                                       int storage)
 {
     struct sparse_matrix_t *matrix;
 
+    sparse_check_storage("new_sparse_matrix", nb_line, nb_col, storage);
+
     matrix = (struct sparse_matrix_t *)
         malloc(sizeof(struct sparse_matrix_t));
     assert(matrix);
@@ -43,18 +95,152 @@ struct sparse_matrix_t *new_sparse_matrix(long int nb_line,
         matrix->last_col = NULL;
     }
 
+    matrix->storage = storage;
     matrix->nb_item = 0;
+    matrix->arena.chunk = NULL;
+    matrix->arena.nb_chunk = 0;
+    matrix->arena.nb_alloc = 0;
+    matrix->arena.bytes = 0;
+    matrix->frozen = NULL;
 
     return (matrix);
 }
 
+/** \brief Change the frozen storage of a matrix that is not frozen yet
+ (see new_sparse_matrix_with_storage()) **/
+void sparse_set_storage(struct sparse_matrix_t *m, int storage)
+{
+    if (m->frozen) {
+        fprintf(stderr, "sparse_set_storage: matrix (%p) is frozen\n", m);
+        exit(1);
+    }
+    sparse_check_storage("sparse_set_storage", m->nb_line, m->nb_col,
+                         storage);
+    m->storage = storage;
+}
+
+/* first chunk size (items), doubled up to SPARSE_ARENA_MAX_CHUNK */
+#define SPARSE_ARENA_MIN_CHUNK 1024
+#define SPARSE_ARENA_MAX_CHUNK (1024 * 1024)
+
+/* get a zeroed item from the matrix arena */
+static struct sparse_item_t *sparse_new_item(struct sparse_matrix_t *m)
+{
+    struct sparse_arena_chunk_t *chunk = m->arena.chunk;
+
+    struct sparse_item_t *item;
+
+    long int size;
+
+    if (!chunk || chunk->used == chunk->size) {
+        size = chunk ? 2 * chunk->size : SPARSE_ARENA_MIN_CHUNK;
+        if (size > SPARSE_ARENA_MAX_CHUNK) {
+            size = SPARSE_ARENA_MAX_CHUNK;
+        }
+        chunk = (struct sparse_arena_chunk_t *)
+            malloc(sizeof(struct sparse_arena_chunk_t) +
+                   size * sizeof(struct sparse_item_t));
+        assert(chunk);
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = m->arena.chunk;
+        m->arena.chunk = chunk;
+        m->arena.nb_chunk++;
+        m->arena.bytes += sizeof(struct sparse_arena_chunk_t) +
+            size * sizeof(struct sparse_item_t);
+    }
+    item = &chunk->item[chunk->used++];
+    memset(item, 0, sizeof(struct sparse_item_t));
+    m->arena.nb_alloc++;
+    return (item);
+}
+
+/** \brief get n contiguous (not zeroed) items from the matrix arena, for
+ bulk loaders which link them by themselves **/
+struct sparse_item_t *sparse_new_items(struct sparse_matrix_t *m,
+                                       long int n)
+{
+    struct sparse_arena_chunk_t *chunk;
+
+    chunk = (struct sparse_arena_chunk_t *)
+        malloc(sizeof(struct sparse_arena_chunk_t) +
+               n * sizeof(struct sparse_item_t));
+    assert(chunk);
+    chunk->size = n;
+    chunk->used = n;
+    chunk->next = m->arena.chunk;
+    m->arena.chunk = chunk;
+    m->arena.nb_chunk++;
+    m->arena.nb_alloc += n;
+    m->arena.bytes += sizeof(struct sparse_arena_chunk_t) +
+        n * sizeof(struct sparse_item_t);
+    return (chunk->item);
+}
+
+/* release all the items of the matrix */
+static void sparse_free_arena(struct sparse_matrix_t *m)
+{
+    struct sparse_arena_chunk_t *chunk, *next;
+
+    for (chunk = m->arena.chunk; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    m->arena.chunk = NULL;
+    m->arena.nb_chunk = 0;
+    m->arena.nb_alloc = 0;
+    m->arena.bytes = 0;
+}
+
 /** \brief return value at (i,j) position in the sparse matrix **/
 double sparse_get_value(struct sparse_matrix_t *m, long int i, long int j)
 {
     struct sparse_item_t *cur_item;
 
-    assert(!(i > m->nb_line));
-    assert(!(j > m->nb_col));
+    assert(!(i >= m->nb_line));
+    assert(!(j >= m->nb_col));
+
+    /* columns are sorted in a frozen line : binary search. Delta coded
+       lines are only read in sequence, search their column instead, whose
+       lines are plain and sorted */
+    if (m->frozen) {
+        struct sparse_compressed_t *z = m->frozen;
+
+        long int lo, hi, mid, c;
+
+        if (z->line_delta) {
+            lo = z->col_ptr[j];
+            hi = z->col_ptr[j + 1];
+            while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                c = SPARSE_COL_LINE(z, mid);
+                if (c == i) {
+                    return (SPARSE_COL_VAL(z, mid));
+                }
+                if (c < i) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return (0);
+        }
+        lo = z->line_ptr[i];
+        hi = z->line_ptr[i + 1];
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            c = SPARSE_LINE_COL(z, mid);
+            if (c == j) {
+                return (SPARSE_LINE_VAL(z, mid));
+            }
+            if (c < j) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return (0);
+    }
 
     cur_item = m->line[i];
 
@@ -155,6 +341,13 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
     assert(!(i >= m->nb_line));
     assert(!(j >= m->nb_col));
 
+    if (m->frozen) {
+        fprintf(stderr,
+                "sparse_set_value: matrix (%p) is frozen, can't set (%ld,%ld)\n",
+                m, i, j);
+        exit(1);
+    }
+
     if (previous) {
         assert(!(previous->line_index != i && previous->col_index > j));
         cur_item = previous;
@@ -167,9 +360,7 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
              * fprintf(stderr, "set: first item [%ld,%ld]\n",
              * i,j);
              */
-            new_item = (struct sparse_item_t *)
-                calloc(1, sizeof(struct sparse_item_t));
-            assert(new_item);
+            new_item = sparse_new_item(m);
 
             new_item->line_index = i;
             new_item->col_index = j;
@@ -194,9 +385,7 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
     /* the last one */
     if (!cur_item) {
         /* fprintf(stderr, "set: last item [%ld,%ld]\n", i,j); */
-        new_item = (struct sparse_item_t *)
-            calloc(1, sizeof(struct sparse_item_t));
-        assert(new_item);
+        new_item = sparse_new_item(m);
 
         last_item->next_in_line = new_item;
 
@@ -227,9 +416,7 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
     }
     /* new item to be inserted here */
     /* fprintf(stderr, "set: inserted item [%ld,%ld]\n", i,j); */
-    new_item = (struct sparse_item_t *)
-        calloc(1, sizeof(struct sparse_item_t));
-    assert(new_item);
+    new_item = sparse_new_item(m);
 
     if (!last_item) {
         /* become the first item */
@@ -256,38 +443,32 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
 	i j value
 	...
 
-   col_link_status=SPARSE_COL_LINK, speeds up importation of sparse matrix,
-   ONLY IF the data are ordered  in the file such as :
-	for (l=0; l<line<l++) {
- 		for (c=0; c<col; c++)
- 			get element[l][c];
-	
+   col_link_status=SPARSE_COL_LINK also builds the column links, whatever
+   the order of the items in the file.
 **/
 struct sparse_matrix_t *read_ijk_sparse_matrix(char *filename,
                                                int col_link_status)
 {
     struct sparse_matrix_t *a;
 
+    struct sparse_triplet_t *t;
+
     long int m, n, j, i;
 
     double val;
 
-    FILE *fd;
+    struct reader_t *fd;
 
     int nb_read;
 
-    long int nb_item;
-
     long int cpt = 0;
 
     fprintf(stdout, "reading sparse matrix from '%s' ... ", filename);
     fflush(stdout);
 
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld %ld", &m, &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &m);
+    nb_read += (nb_read == 1) && reader_long(fd, &n);
     if (nb_read != 2) {
         fprintf(stdout, "\n");
         fprintf(stderr,
@@ -296,15 +477,17 @@ struct sparse_matrix_t *read_ijk_sparse_matrix(char *filename,
         exit(1);
     }
     fprintf(stdout, "(%ldx%ld) ", m, n);
-    a = new_sparse_matrix(m, n, col_link_status);
+    t = new_sparse_triplet(m, n, reader_size(fd) / 16);
 
     while (1) {
 
-        nb_read = fscanf(fd, "%ld %ld %lf", &i, &j, &val);
-
-        if (feof(fd)) {
+        if (reader_eof(fd)) {
             break;
         }
+        nb_read = reader_long(fd, &i);
+        nb_read += (nb_read == 1) && reader_long(fd, &j);
+        nb_read += (nb_read == 2) && reader_double(fd, &val);
+
         if (nb_read != 3) {
             fprintf(stdout, "\n");
             fprintf(stderr,
@@ -313,24 +496,136 @@ struct sparse_matrix_t *read_ijk_sparse_matrix(char *filename,
             exit(1);
         }
         //fprintf(stderr, "%ld %ld %lf\n", i, j, val);
-        sparse_set_value(a, i, j, val, NULL);
+        sparse_triplet_add(t, i, j, val);
         cpt++;
     }
+    reader_close(fd);
 
+    a = sparse_triplet_to_matrix(t, col_link_status, SPARSE_DUPLICATE_SUM);
     fprintf(stdout, "%ld lines\n", cpt);
     fflush(stdout);
+    if (t->nb_duplicate) {
+        fprintf(stderr,
+                "read_ijk_sparse_matrix: %ld duplicates summed in '%s'\n",
+                t->nb_duplicate, filename);
+    }
+    free_sparse_triplet(t);
+
+    return (a);
+}
+
+/* stop on a Matrix Market parsing error */
+static void sparse_mm_error(char *filename, char *msg)
+{
+    fprintf(stdout, "\n");
+    fprintf(stderr, "read_mm_sparse_matrix: '%s' %s\n", filename, msg);
+    exit(1);
+}
+
+/** \brief Read a Matrix Market file (coordinate real, integer or pattern,
+ general, symmetric or skew-symmetric)
+
+ Only one triangle of a symmetric matrix is stored in the file, the other
+ one is added. Pattern items are set to 1. Items given twice are summed.
+**/
+struct sparse_matrix_t *read_mm_sparse_matrix(char *filename,
+                                              int col_link_status)
+{
+    struct sparse_matrix_t *a;
+
+    struct sparse_triplet_t *t;
+
+    struct reader_t *fd;
+
+    char word[5][64];
+
+    long int m, n, nnz, i, j, k;
+
+    double val = 1.;
+
+    int nb_read, pattern, symmetry;
+
+    fprintf(stdout, "reading mm sparse matrix from '%s' ... ", filename);
+    fflush(stdout);
+
+    /* %%MatrixMarket matrix coordinate <field> <symmetry> */
+    fd = reader_open(filename);
+    for (k = 0; k < 5; k++) {
+        if (!reader_word(fd, word[k], sizeof(word[k]))) {
+            break;
+        }
+    }
+    if (k < 5 || strcasecmp(word[0], "%%MatrixMarket")
+        || strcasecmp(word[1], "matrix")
+        || strcasecmp(word[2], "coordinate")) {
+        sparse_mm_error(filename, "is not a Matrix Market coordinate matrix");
+    }
+    pattern = !strcasecmp(word[3], "pattern");
+    if (!pattern && strcasecmp(word[3], "real")
+        && strcasecmp(word[3], "integer")) {
+        sparse_mm_error(filename, "field not supported (complex ?)");
+    }
+    if (!strcasecmp(word[4], "general")) {
+        symmetry = 0;
+    } else if (!strcasecmp(word[4], "symmetric")) {
+        symmetry = 1;
+    } else if (!strcasecmp(word[4], "skew-symmetric")) {
+        symmetry = -1;
+    } else {
+        sparse_mm_error(filename, "symmetry not supported (hermitian ?)");
+    }
+
+    /* comments, then the size line */
+    reader_skip_line(fd);
+    while (reader_peek(fd) == '%') {
+        reader_skip_line(fd);
+    }
+    nb_read = reader_long(fd, &m);
+    nb_read += (nb_read == 1) && reader_long(fd, &n);
+    nb_read += (nb_read == 2) && reader_long(fd, &nnz);
+    if (nb_read != 3 || m < 0 || n < 0 || nnz < 0) {
+        sparse_mm_error(filename, "error reading (m,n,nnz)");
+    }
+    fprintf(stdout, "(%ldx%ld) ", m, n);
+    t = new_sparse_triplet(m, n, symmetry ? 2 * nnz : nnz);
+
+    for (k = 0; k < nnz; k++) {
+        nb_read = reader_long(fd, &i);
+        nb_read += (nb_read == 1) && reader_long(fd, &j);
+        if (!pattern) {
+            nb_read += (nb_read == 2) && reader_double(fd, &val);
+        }
+        if (nb_read != 3 - pattern) {
+            sparse_mm_error(filename, "corrupted or truncated");
+        }
+        sparse_triplet_add(t, i - 1, j - 1, val);
+        if (symmetry && i != j) {
+            sparse_triplet_add(t, j - 1, i - 1, symmetry * val);
+        }
+    }
+    if (!reader_eof(fd)) {
+        sparse_mm_error(filename, "has more than nnz items");
+    }
+    reader_close(fd);
+
+    a = sparse_triplet_to_matrix(t, col_link_status, SPARSE_DUPLICATE_SUM);
+    fprintf(stdout, "%ld lines\n", nnz);
+    fflush(stdout);
+    if (t->nb_duplicate) {
+        fprintf(stderr,
+                "read_mm_sparse_matrix: %ld duplicates summed in '%s'\n",
+                t->nb_duplicate, filename);
+    }
+    free_sparse_triplet(t);
 
-    fclose(fd);
     return (a);
 }
 
 /** \brief Readme sparse matrix from file
 
- col_link_status=SPARSE_COL_LINK, speeds up importation of sparse matrix,
- ONLY IF the data are ordered  in the file such as :
- 	for (l=0; l<line<l++) {
-  		for (c=0; c<col; c++)
- 			get element[l][c];
+ col_link_status=SPARSE_COL_LINK also builds the column links, once all
+ the items are read (see sparse_build_col_link()), whatever the order of
+ the lines in the file.
 **/
 struct sparse_matrix_t *read_sparse_matrix(char *filename,
                                            int col_link_status)
@@ -341,7 +636,7 @@ struct sparse_matrix_t *read_sparse_matrix(char *filename,
 
     double val;
 
-    FILE *fd;
+    struct reader_t *fd;
 
     int nb_read;
 
@@ -356,11 +651,19 @@ struct sparse_matrix_t *read_sparse_matrix(char *filename,
     fprintf(stdout, "reading sparse matrix from '%s' ... ", filename);
     fflush(stdout);
 
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
+    if (sparse_get_nb_thread() > 1) {
+        a = read_sparse_matrix_parallel(filename, col_link_status, &cpt);
+        if (a) {
+            fprintf(stdout, "(%ldx%ld) %ld lines\n", a->nb_line, a->nb_col,
+                    cpt);
+            fflush(stdout);
+            return (a);
+        }
     }
-    nb_read = fscanf(fd, "%ld %ld", &m, &n);
+
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &m);
+    nb_read += (nb_read == 1) && reader_long(fd, &n);
     if (nb_read != 2) {
         fprintf(stdout, "\n");
         fprintf(stderr,
@@ -369,15 +672,16 @@ struct sparse_matrix_t *read_sparse_matrix(char *filename,
         exit(1);
     }
     fprintf(stdout, "(%ldx%ld) ", m, n);
-    a = new_sparse_matrix(m, n, col_link_status);
+    a = new_sparse_matrix(m, n, 0);
 
     while (1) {
 
-        nb_read = fscanf(fd, "%ld %ld", &rayid, &nb_item);
-
-        if (feof(fd)) {
+        if (reader_eof(fd)) {
             break;
         }
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_long(fd, &nb_item);
+
         if (nb_read != 2) {
             fprintf(stdout, "\n");
             fprintf(stderr,
@@ -385,34 +689,38 @@ struct sparse_matrix_t *read_sparse_matrix(char *filename,
                     filename, nb_read);
             exit(1);
         }
-        if (a->col_link_status == SPARSE_COL_LINK) {
-            last_item = NULL;
-        }
+        last_item = NULL;
         for (j = 0; j < nb_item; j++) {
 
-            nb_read = fscanf(fd, "%ld %lf", &index, &val);
+            nb_read = reader_long(fd, &index);
+            nb_read += (nb_read == 1) && reader_double(fd, &val);
 
-            if (nb_read != 2 && !feof(fd)) {
+            if (nb_read != 2) {
+                if (reader_eof(fd)) {
+                    break;
+                }
                 fprintf(stdout, "\n");
                 fprintf(stderr,
                         "read_sparse_matrix: error reading item (%ld,%ld) in '%s' nread=%d\n",
                         rayid, j, filename, nb_read);
                 exit(1);
             }
-            if (a->col_link_status == SPARSE_COL_LINK) {
-                last_item =
-                    sparse_set_value(a, rayid, index, val, last_item);
-            } else {
-                sparse_set_value(a, rayid, index, val, NULL);
+            /* start from the previous item of the line if it is before */
+            if (last_item && last_item->col_index >= index) {
+                last_item = NULL;
             }
+            last_item = sparse_set_value(a, rayid, index, val, last_item);
         }
         cpt++;
     }
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
 
     fprintf(stdout, "%ld lines\n", cpt);
     fflush(stdout);
 
-    fclose(fd);
+    reader_close(fd);
     return (a);
 }
 
@@ -427,7 +735,7 @@ struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
 
     double val;
 
-    FILE *fd;
+    struct reader_t *fd;
 
     int nb_read;
 
@@ -444,11 +752,9 @@ struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
     fprintf(stdout, "importing sparse matrix from '%s' into (%p) ... ",
             filename, a);
     fflush(stdout);
-    if (!(fd = fopen(filename, "r"))) {
-        perror(filename);
-        exit(1);
-    }
-    nb_read = fscanf(fd, "%ld %ld\n", &m, &n);
+    fd = reader_open(filename);
+    nb_read = reader_long(fd, &m);
+    nb_read += (nb_read == 1) && reader_long(fd, &n);
     if (nb_read != 2) {
         fprintf(stdout, "\n");
         fprintf(stderr, "Error reading (m,n) in '%s'\n", filename);
@@ -462,11 +768,12 @@ struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
         exit(1);
     }
     while (1) {
-        nb_read = fscanf(fd, "%ld %ld\n", &rayid, &nb_item);
-
-        if (feof(fd)) {
+        if (reader_eof(fd)) {
             break;
         }
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_long(fd, &nb_item);
+
         if (nb_read != 2) {
             fprintf(stdout, "\n");
             fprintf(stderr, "import_sparse_matrix: file '%s' corrupted\n",
@@ -475,8 +782,12 @@ struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
         }
         last_item = NULL;
         for (j = 0; j < nb_item; j++) {
-            nb_read = fscanf(fd, "%ld %lf", &index, &val);
-            if (nb_read != 2 && !feof(fd)) {
+            nb_read = reader_long(fd, &index);
+            nb_read += (nb_read == 1) && reader_double(fd, &val);
+            if (nb_read != 2) {
+                if (reader_eof(fd)) {
+                    break;
+                }
                 fprintf(stdout, "\n");
                 fprintf(stderr,
                         "import_sparse_matrix: error reading item (%ld,%ld) in '%s'\n",
@@ -492,98 +803,200 @@ struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
         }
         cpt++;
     }
-    fclose(fd);
+    reader_close(fd);
     fprintf(stdout, "%ld lines\n", cpt);
     fflush(stdout);
     return (a);
 }
 
-/** \brief Write sparse matrix A to file **/
-void write_sparse_matrix(struct sparse_matrix_t *A, char *filename)
+/** \brief digits after the decimal point of the written values (text
+ matrices and vectors) : -1 (default) for the shortest string read back as
+ the same double, n >= 0 as printf("%.nf"), 6 being the former "%lf" **/
+void sparse_set_write_precision(int precision)
 {
-    long int i, nb_item;
+    writer_set_precision(precision);
+}
 
-    FILE *fd;
+int sparse_get_write_precision(void)
+{
+    return (writer_get_precision());
+}
 
-    struct sparse_item_t *cur_item;
+/* text layouts of the writers */
+enum sparse_text_format_t {
+    SPARSE_TEXT_LINE = 0,       /* read_sparse_matrix */
+    SPARSE_TEXT_IJK,            /* read_ijk_sparse_matrix */
+    SPARSE_TEXT_MM              /* Matrix Market coordinate (1-based) */
+};
+
+/* lines [first, last) of A as text into w, in the given format (line
+   numbers shifted by offset in SPARSE_TEXT_LINE) */
+static void sparse_format_lines(struct sparse_matrix_t *A, long int first,
+                                long int last, long int offset, int format,
+                                struct writer_t *w)
+{
+    long int base = (format == SPARSE_TEXT_MM);
 
-    if (!(fd = fopen(filename, "w"))) {
-        perror(filename);
-        exit(1);
-    }
-    fprintf(stdout, "writing sparse matrix (%p) to '%s' %ld items\n",
-            A, filename, A->nb_item);
+    struct sparse_compressed_t *z = A->frozen;
 
-    fprintf(fd, "%ld %ld\n", A->nb_line, A->nb_col);
+    struct sparse_item_t *cur_item = NULL;
 
-    for (i = 0; i < A->nb_line; i++) {
+    long int i, k, nb_item, col;
+
+    double val;
 
+    for (i = first; i < last; i++) {
         /* how many item in the current line */
-        cur_item = A->line[i];
-        nb_item = 0;
-        while (cur_item) {
-            nb_item++;
-            cur_item = cur_item->next_in_line;
+        if (z) {
+            nb_item = z->line_ptr[i + 1] - z->line_ptr[i];
+        } else {
+            nb_item = 0;
+            for (cur_item = A->line[i]; cur_item;
+                 cur_item = cur_item->next_in_line) {
+                nb_item++;
+            }
+            cur_item = A->line[i];
         }
-
         if (!nb_item) {
             continue;
         }
+        if (format == SPARSE_TEXT_LINE) {
+            writer_long(w, i + offset);
+            writer_char(w, ' ');
+            writer_long(w, nb_item);
+            writer_char(w, '\n');
+        }
         /* write items value */
-        cur_item = A->line[i];
-        fprintf(fd, "%ld %ld\n", cur_item->line_index, nb_item);
-        while (cur_item) {
-            fprintf(fd, "%ld %lf ", cur_item->col_index, cur_item->val);
-            cur_item = cur_item->next_in_line;
+        for (k = 0; k < nb_item; k++) {
+            if (z) {
+                col = SPARSE_LINE_COL(z, z->line_ptr[i] + k);
+                val = SPARSE_LINE_VAL(z, z->line_ptr[i] + k);
+            } else {
+                col = cur_item->col_index;
+                val = cur_item->val;
+                cur_item = cur_item->next_in_line;
+            }
+            if (format != SPARSE_TEXT_LINE) {
+                writer_long(w, i + base);
+                writer_char(w, ' ');
+                writer_long(w, col + base);
+                writer_char(w, ' ');
+                writer_double(w, val);
+                writer_char(w, '\n');
+            } else {
+                writer_long(w, col);
+                writer_char(w, ' ');
+                writer_double(w, val);
+                writer_char(w, ' ');
+            }
+        }
+        if (format == SPARSE_TEXT_LINE) {
+            writer_char(w, '\n');
         }
-        fprintf(fd, "\n");
     }
-    fclose(fd);
 }
 
-void
-write_sparse_matrix_with_line_offset(struct sparse_matrix_t *A,
-                                     long int offset, char *filename)
+/*
+ * write A as text : blocks of lines are formatted by the threads into
+ * their own buffer, and written in order as soon as they are ready
+ */
+static void sparse_write_text(struct sparse_matrix_t *A, char *filename,
+                              long int offset, int format)
 {
-    long int i, nb_item;
+    struct writer_t *w, **block_w;
 
-    FILE *fd;
+    long int b, nb_block;
 
-    struct sparse_item_t *cur_item;
+    int nt, t;
 
-    if (!(fd = fopen(filename, "w"))) {
-        perror(filename);
-        exit(1);
+    w = writer_open(filename);
+    if (format == SPARSE_TEXT_MM) {
+        writer_append(w, SPARSE_MM_BANNER, strlen(SPARSE_MM_BANNER));
     }
-    fprintf(stdout,
-            "writing sparse matrix (%p) offset=%ld to '%s' %ld items\n", A,
-            offset, filename, A->nb_item);
+    writer_long(w, A->nb_line + offset);
+    writer_char(w, ' ');
+    writer_long(w, A->nb_col);
+    if (format == SPARSE_TEXT_MM) {
+        writer_char(w, ' ');
+        writer_long(w, A->nb_item);
+    }
+    writer_char(w, '\n');
 
-    fprintf(fd, "%ld %ld\n", A->nb_line + offset, A->nb_col);
+    nt = sparse_work_nb_thread(A->nb_item);
+    if (nt == 1) {
+        sparse_format_lines(A, 0, A->nb_line, offset, format, w);
+        writer_close(w);
+        return;
+    }
 
-    for (i = 0; i < A->nb_line; i++) {
+    nb_block = A->nb_item / SPARSE_WRITE_BLOCK_ITEM + nt;
+    block_w = (struct writer_t **) malloc(nt * sizeof(struct writer_t *));
+    assert(block_w);
+    for (t = 0; t < nt; t++) {
+        block_w[t] = writer_new_buffer();
+    }
 
-        /* how many item in the current line */
-        cur_item = A->line[i];
-        nb_item = 0;
-        while (cur_item) {
-            nb_item++;
-            cur_item = cur_item->next_in_line;
-        }
+#pragma omp parallel for ordered schedule(dynamic, 1) num_threads(nt)
+    for (b = 0; b < nb_block; b++) {
+        struct writer_t *bw = block_w[sparse_thread_id()];
 
-        if (!nb_item) {
-            continue;
-        }
-        /* write items value */
-        cur_item = A->line[i];
-        fprintf(fd, "%ld %ld\n", cur_item->line_index + offset, nb_item);
-        while (cur_item) {
-            fprintf(fd, "%ld %lf ", cur_item->col_index, cur_item->val);
-            cur_item = cur_item->next_in_line;
+        long int first, last;
+
+        if (A->frozen) {
+            first = sparse_balanced_split(A->frozen->line_ptr, A->nb_line,
+                                          b, nb_block);
+            last = sparse_balanced_split(A->frozen->line_ptr, A->nb_line,
+                                         b + 1, nb_block);
+        } else {
+            first = A->nb_line * b / nb_block;
+            last = A->nb_line * (b + 1) / nb_block;
         }
-        fprintf(fd, "\n");
+        writer_reset(bw);
+        sparse_format_lines(A, first, last, offset, format, bw);
+#pragma omp ordered
+        writer_append(w, bw->buf, bw->pos);
     }
-    fclose(fd);
+
+    for (t = 0; t < nt; t++) {
+        writer_close(block_w[t]);
+    }
+    free(block_w);
+    writer_close(w);
+}
+
+/** \brief Write sparse matrix A to file **/
+void write_sparse_matrix(struct sparse_matrix_t *A, char *filename)
+{
+    fprintf(stdout, "writing sparse matrix (%p) to '%s' %ld items\n",
+            A, filename, A->nb_item);
+    sparse_write_text(A, filename, 0, SPARSE_TEXT_LINE);
+}
+
+void
+write_sparse_matrix_with_line_offset(struct sparse_matrix_t *A,
+                                     long int offset, char *filename)
+{
+    fprintf(stdout,
+            "writing sparse matrix (%p) offset=%ld to '%s' %ld items\n", A,
+            offset, filename, A->nb_item);
+    sparse_write_text(A, filename, offset, SPARSE_TEXT_LINE);
+}
+
+/** \brief Write sparse matrix A to file, in read_ijk_sparse_matrix format **/
+void write_ijk_sparse_matrix(struct sparse_matrix_t *A, char *filename)
+{
+    fprintf(stdout, "writing ijk sparse matrix (%p) to '%s' %ld items\n",
+            A, filename, A->nb_item);
+    sparse_write_text(A, filename, 0, SPARSE_TEXT_IJK);
+}
+
+/** \brief Write sparse matrix A to file in Matrix Market format
+ (coordinate real general) **/
+void write_mm_sparse_matrix(struct sparse_matrix_t *A, char *filename)
+{
+    fprintf(stdout, "writing mm sparse matrix (%p) to '%s' %ld items\n",
+            A, filename, A->nb_item);
+    sparse_write_text(A, filename, 0, SPARSE_TEXT_MM);
 }
 
 struct vector_t *sparse_extract_line(struct sparse_matrix_t *A, long int l)
@@ -593,6 +1006,18 @@ struct vector_t *sparse_extract_line(struct sparse_matrix_t *A, long int l)
     struct sparse_item_t *cur_item;
 
     tmp = new_vector(A->nb_col);
+
+    if (A->frozen) {
+        long int k;
+
+        for (k = A->frozen->line_ptr[l]; k < A->frozen->line_ptr[l + 1];
+             k++) {
+            tmp->mat[SPARSE_LINE_COL(A->frozen, k)] =
+                SPARSE_LINE_VAL(A->frozen, k);
+        }
+        return (tmp);
+    }
+
     cur_item = A->line[l];
 
     while (cur_item) {
@@ -610,6 +1035,18 @@ struct vector_t *sparse_extract_col(struct sparse_matrix_t *A, long int c)
     struct sparse_item_t *cur_item;
 
     tmp = new_vector(A->nb_line);
+
+    if (A->frozen) {
+        long int k;
+
+        for (k = A->frozen->col_ptr[c]; k < A->frozen->col_ptr[c + 1];
+             k++) {
+            tmp->mat[SPARSE_COL_LINE(A->frozen, k)] =
+                SPARSE_COL_VAL(A->frozen, k);
+        }
+        return (tmp);
+    }
+
     cur_item = A->col[c];
 
     while (cur_item) {
@@ -672,22 +1109,43 @@ void dump_sparse_matrix_to_scilab(struct sparse_matrix_t *m)
 
 void free_sparse_matrix(struct sparse_matrix_t *m)
 {
-    long int i;
-
-    struct sparse_item_t *cur_item, *last_item;
-
     long int n = 0;
 
-    for (i = 0; i < m->nb_line; i++) {
-        cur_item = m->line[i];
-        while (cur_item) {
-            last_item = cur_item;
-            cur_item = cur_item->next_in_line;
-            free(last_item);
-            n++;
+    if (m->frozen) {
+        struct sparse_compressed_t *z = m->frozen;
+
+        void *array[] = {
+            z->line_ptr, z->col_index, z->col_index32, z->line_val,
+            z->line_val32, z->col_ptr, z->line_index, z->line_index32,
+            z->col_val, z->col_val32, z->line_val16, z->col_val16
+        };
+
+        int k;
+
+        n = m->nb_item;
+        sparse_untile(m);
+        sparse_delta_free(z->line_delta);
+        for (k = 0; k < (int) (sizeof(array) / sizeof(void *)); k++) {
+            /* arrays from a binary file belong to the mapping */
+            if (!z->map || (char *) array[k] < (char *) z->map
+                || (char *) array[k] >= (char *) z->map + z->map_size) {
+                free(array[k]);
+            }
+        }
+        if (z->map) {
+            munmap(z->map, z->map_size);
         }
+        free(z);
+        fprintf(stdout, "free frozen sparse matrix (%p): %ld items\n", m,
+                n);
+        fflush(stdout);
+        free(m);
+        return;
     }
 
+    n = m->nb_item;
+    sparse_free_arena(m);
+
     if (m->col_link_status == SPARSE_COL_LINK) {
         free(m->last_col);
     }
@@ -729,6 +1187,13 @@ struct sparse_matrix_t *sparse_matrix_resize(struct sparse_matrix_t *m,
 
     assert(m);
 
+    if (m->frozen) {
+        fprintf(stderr,
+                "sparse_matrix_resize: matrix (%p) is frozen, can't resize\n",
+                m);
+        exit(1);
+    }
+
     fprintf(stdout,
             "sparse_matrix_resize (%p) from (%ldx%ld) to (%ldx%ld)\n", m,
             m->nb_line, m->nb_col, nbline, nbcol);
@@ -817,10 +1282,39 @@ int check_sparse_matrix(struct sparse_matrix_t *m)
 
     fprintf(stderr, "Checking sparse matrix (%p) ... ", m);
 
-    cpt_col = 0;
-    for (j = 0; j < m->nb_col; j++) {
-        if (!m->col[j])
-            continue;
+    if (m->frozen) {
+        struct sparse_compressed_t *z = m->frozen;
+
+        for (j = 0; j < m->nb_col; j++) {
+            for (i = z->col_ptr[j]; i < z->col_ptr[j + 1]; i++) {
+                assert(!(i > z->col_ptr[j]
+                         && SPARSE_COL_LINE(z, i - 1) >=
+                         SPARSE_COL_LINE(z, i)));
+            }
+        }
+        for (i = 0; i < m->nb_line; i++) {
+            for (j = z->line_ptr[i]; j < z->line_ptr[i + 1]; j++) {
+                assert(!(j > z->line_ptr[i]
+                         && SPARSE_LINE_COL(z, j - 1) >=
+                         SPARSE_LINE_COL(z, j)));
+            }
+        }
+        cpt_col = z->col_ptr[m->nb_col];
+        cpt_line = z->line_ptr[m->nb_line];
+        if (cpt_col != cpt_line) {
+            fprintf(stderr,
+                    "item found using col = %ld, using line = %ld\n",
+                    cpt_col, cpt_line);
+            return (0);
+        }
+        fprintf(stderr, "(%ld items, frozen) ok\n", cpt_col);
+        return (0);
+    }
+
+    cpt_col = 0;
+    for (j = 0; j < m->nb_col; j++) {
+        if (!m->col[j])
+            continue;
 
         cur_item = m->col[j];
         while (cur_item) {
@@ -872,11 +1366,9 @@ int check_sparse_matrix(struct sparse_matrix_t *m)
 
 void sparse_compute_length(struct sparse_matrix_t *m, char *filename)
 {
-    long int i;
-
-    double length;
+    struct sparse_reduce_t r;
 
-    struct sparse_item_t *cur_item;
+    long int i;
 
     FILE *fd;
 
@@ -886,106 +1378,271 @@ void sparse_compute_length(struct sparse_matrix_t *m, char *filename)
     }
     fprintf(fd, "%ld %ld\n", m->nb_line, m->nb_col);
 
+    sparse_reduce(m, SPARSE_REDUCE_LINE_SUM | SPARSE_REDUCE_LINE_COUNT, &r);
     for (i = 0; i < m->nb_line; i++) {
-        if (!m->line[i])
+        if (r.line_count->mat[i] == 0.)
             continue;
+        fprintf(fd, "%ld %f\n", i, r.line_sum->mat[i]);
+    }
+    sparse_free_reduce(&r);
 
-        cur_item = m->line[i];
-        length = 0;
-        while (cur_item) {
-            length += cur_item->val;
-            cur_item = cur_item->next_in_line;
-        }
-        fprintf(fd, "%ld %f\n", i, length);
+    fclose(fd);
+}
 
+/* store item k of a frozen line / column, according to the storage */
+static void sparse_frozen_set_line(struct sparse_compressed_t *z, long int k,
+                                   long int j, double val)
+{
+    if (z->col_index) {
+        z->col_index[k] = j;
+    } else {
+        z->col_index32[k] = (int) j;
+    }
+    if (z->line_val) {
+        z->line_val[k] = val;
+    } else if (z->line_val32) {
+        z->line_val32[k] = (float) val;
+    } else {
+        z->line_val16[k] = sparse_double_to_value16(val / z->val_scale,
+                                                    z->storage);
     }
+}
 
-    fclose(fd);
+static void sparse_frozen_set_col(struct sparse_compressed_t *z, long int k,
+                                  long int i, double val)
+{
+    if (z->line_index) {
+        z->line_index[k] = i;
+    } else {
+        z->line_index32[k] = (int) i;
+    }
+    if (z->col_val) {
+        z->col_val[k] = val;
+    } else if (z->col_val32) {
+        z->col_val32[k] = (float) val;
+    } else {
+        z->col_val16[k] = sparse_double_to_value16(val / z->val_scale,
+                                                   z->storage);
+    }
 }
 
-struct sparse_matrix_t *AtransA(struct sparse_matrix_t *A)
+/* allocate the line (line = 1) or column (line = 0) index and value
+   arrays of n items, according to the storage */
+static void sparse_frozen_alloc(struct sparse_compressed_t *z, int line,
+                                long int n)
 {
-    struct sparse_matrix_t *AtA;
+    long int **index = line ? &z->col_index : &z->line_index;
 
-    long int i, j;
+    int **index32 = line ? &z->col_index32 : &z->line_index32;
 
-    double sum;
+    double **val = line ? &z->line_val : &z->col_val;
 
-    int sum_updated;
+    float **val32 = line ? &z->line_val32 : &z->col_val32;
 
-    struct sparse_item_t *last_item = NULL;
+    unsigned short **val16 = line ? &z->line_val16 : &z->col_val16;
+
+    *index = NULL;
+    *index32 = NULL;
+    *val = NULL;
+    *val32 = NULL;
+    *val16 = NULL;
+
+    if (z->storage & SPARSE_INDEX_32) {
+        *index32 = (int *) malloc(n * sizeof(int));
+        assert(*index32 || !n);
+    } else {
+        *index = (long int *) malloc(n * sizeof(long int));
+        assert(*index || !n);
+    }
+    if (z->storage & SPARSE_VALUE_16) {
+        *val16 = (unsigned short *) malloc(n * sizeof(unsigned short));
+        assert(*val16 || !n);
+    } else if (z->storage & SPARSE_VALUE_32) {
+        *val32 = (float *) malloc(n * sizeof(float));
+        assert(*val32 || !n);
+    } else {
+        *val = (double *) malloc(n * sizeof(double));
+        assert(*val || !n);
+    }
+}
+
+/*
+ * A^T*A, Gustavson's way : line i of A^T*A is the sum of the lines r of A
+ * having an item in column i, weighted by A(r,i). Lines are accumulated in
+ * a dense per thread accumulator (acc, mark, list of touched columns), so
+ * only the non zero contributions are computed.
+ */
+struct sparse_ata_acc_t {
+    double *acc;
+    long int *mark;
+    long int *list;
+};
+
+static int sparse_ata_cmp(const void *a, const void *b)
+{
+    long int u = *(const long int *) a, v = *(const long int *) b;
+
+    return (u < v ? -1 : u > v);
+}
+
+/* accumulate line i of A^T*A, return its number of items (list) */
+static long int sparse_ata_line(struct sparse_matrix_t *A, long int i,
+                                struct sparse_ata_acc_t *w)
+{
+    struct sparse_compressed_t *z = A->frozen;
 
     struct sparse_item_t *item1, *item2;
 
-    AtA = new_sparse_matrix(A->nb_col, A->nb_col, SPARSE_COL_LINK);
+    long int k1, k2, r, j, n = 0;
 
-    for (i = 0; i < A->nb_col; i++) {
-        last_item = NULL;
-        for (j = 0; j < A->nb_col; j++) {
-            item1 = A->col[i];
-            item2 = A->col[j];
-
-            sum = 0.;
-            sum_updated = 0;
-            while (item1 && item2) {
-                if (item1->line_index == item2->line_index) {
-                    sum_updated = 1;
-                    sum += item1->val * item2->val;
-                    item2 = item2->next_in_col;
-                    item1 = item1->next_in_col;
-                    continue;
-                }
-                if (item1->line_index > item2->line_index) {
-                    item2 = item2->next_in_col;
-                } else {
-                    item1 = item1->next_in_col;
+    double a;
+
+    if (z) {
+        for (k1 = z->col_ptr[i]; k1 < z->col_ptr[i + 1]; k1++) {
+            r = SPARSE_COL_LINE(z, k1);
+            a = SPARSE_COL_VAL(z, k1);
+            for (k2 = z->line_ptr[r]; k2 < z->line_ptr[r + 1]; k2++) {
+                j = SPARSE_LINE_COL(z, k2);
+                if (w->mark[j] != i) {
+                    w->mark[j] = i;
+                    w->acc[j] = 0.;
+                    w->list[n++] = j;
                 }
-            }
-            if (sum_updated) {
-                last_item = sparse_set_value(AtA, i, j, sum, last_item);
+                w->acc[j] += a * SPARSE_LINE_VAL(z, k2);
             }
         }
+        return (n);
     }
 
-    return (AtA);
+    for (item1 = A->col[i]; item1; item1 = item1->next_in_col) {
+        for (item2 = A->line[item1->line_index]; item2;
+             item2 = item2->next_in_line) {
+            j = item2->col_index;
+            if (w->mark[j] != i) {
+                w->mark[j] = i;
+                w->acc[j] = 0.;
+                w->list[n++] = j;
+            }
+            w->acc[j] += item1->val * item2->val;
+        }
+    }
+    return (n);
 }
 
-double mean_diag_AtA(struct sparse_matrix_t *A)
+/** \brief A^T*A, as a frozen matrix (same storage as A, float values if
+ A has 16 bit values)
+
+ Only the structurally non zero products are computed, lines of A^T*A are
+ shared among threads. A must be frozen or have its column links.
+**/
+struct sparse_matrix_t *AtransA(struct sparse_matrix_t *A)
 {
-    long int i, j;
+    struct sparse_matrix_t *AtA;
 
-    double sum, diag_sum = 0;
+    struct sparse_compressed_t *z;
 
-    int sum_updated;
+    long int i, n;
 
-    struct sparse_item_t *item1, *item2;
+    int nt;
 
-    for (i = 0; i < A->nb_col; i++) {
-        j = i;
+    assert(A->frozen || A->col_link_status == SPARSE_COL_LINK);
 
-        item1 = A->col[i];
-        item2 = A->col[j];
+    AtA = (struct sparse_matrix_t *) calloc(1, sizeof(struct sparse_matrix_t));
+    assert(AtA);
+    AtA->nb_line = A->nb_col;
+    AtA->nb_col = A->nb_col;
+    AtA->storage = A->storage;
+    if (AtA->storage & SPARSE_VALUE_16) {
+        AtA->storage = (AtA->storage & ~SPARSE_VALUE_16) | SPARSE_VALUE_32;
+    }
+    z = (struct sparse_compressed_t *)
+        calloc(1, sizeof(struct sparse_compressed_t));
+    assert(z);
+    z->storage = AtA->storage;
+    z->val_scale = 1.;
+    AtA->frozen = z;
+    z->line_ptr = (long int *) calloc(A->nb_col + 1, sizeof(long int));
+    assert(z->line_ptr);
+
+    nt = sparse_work_nb_thread(A->nb_item);
+
+    /* pass 1 : items per line, pass 2 : items */
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        struct sparse_ata_acc_t w;
+
+        long int l, k, c;
+
+        w.acc = (double *) malloc(A->nb_col * sizeof(double));
+        w.mark = (long int *) malloc(A->nb_col * sizeof(long int));
+        w.list = (long int *) malloc(A->nb_col * sizeof(long int));
+        assert(!A->nb_col || (w.acc && w.mark && w.list));
+        for (l = 0; l < A->nb_col; l++) {
+            w.mark[l] = -1;
+        }
 
-        sum = 0.;
-        sum_updated = 0;
-        while (item1 && item2) {
-            if (item1->line_index == item2->line_index) {
-                sum_updated = 1;
-                sum += item1->val * item2->val;
-                item2 = item2->next_in_col;
-                item1 = item1->next_in_col;
-                continue;
-            }
-            if (item1->line_index > item2->line_index) {
-                item2 = item2->next_in_col;
-            } else {
-                item1 = item1->next_in_col;
+#pragma omp for schedule(dynamic, 64)
+        for (l = 0; l < A->nb_col; l++) {
+            z->line_ptr[l + 1] = sparse_ata_line(A, l, &w);
+        }
+
+#pragma omp single
+        {
+            for (l = 0; l < A->nb_col; l++) {
+                z->line_ptr[l + 1] += z->line_ptr[l];
             }
+            sparse_frozen_alloc(z, 1, z->line_ptr[A->nb_col]);
+        }
+
+        for (l = 0; l < A->nb_col; l++) {
+            w.mark[l] = -1;
         }
-        if (sum_updated) {
-            diag_sum += sum;
+#pragma omp for schedule(dynamic, 64)
+        for (l = 0; l < A->nb_col; l++) {
+            c = sparse_ata_line(A, l, &w);
+            qsort(w.list, c, sizeof(long int), sparse_ata_cmp);
+            for (k = 0; k < c; k++) {
+                sparse_frozen_set_line(z, z->line_ptr[l] + k, w.list[k],
+                                       w.acc[w.list[k]]);
+            }
         }
+
+        free(w.acc);
+        free(w.mark);
+        free(w.list);
+    }
+    n = z->line_ptr[A->nb_col];
+    AtA->nb_item = n;
+
+    /* A^T*A is symmetric : its columns are its lines */
+    sparse_frozen_alloc(z, 0, n);
+    z->col_ptr = (long int *) malloc((A->nb_col + 1) * sizeof(long int));
+    assert(z->col_ptr);
+    memcpy(z->col_ptr, z->line_ptr, (A->nb_col + 1) * sizeof(long int));
+    for (i = 0; i < n; i++) {
+        sparse_frozen_set_col(z, i, SPARSE_LINE_COL(z, i),
+                              SPARSE_LINE_VAL(z, i));
+    }
+    if (z->storage & SPARSE_INDEX_DELTA) {
+        sparse_delta_encode(AtA);
     }
+
+    return (AtA);
+}
+
+double mean_diag_AtA(struct sparse_matrix_t *A)
+{
+    struct sparse_reduce_t r;
+
+    double diag_sum = 0;
+
+    long int j;
+
+    sparse_reduce(A, SPARSE_REDUCE_ATA_DIAG, &r);
+    for (j = 0; j < A->nb_col; j++) {
+        diag_sum += r.ata_diag->mat[j];
+    }
+    sparse_free_reduce(&r);
     return (diag_sum / (A->nb_col));
 }
 
@@ -1000,4 +1657,475 @@ void show_sparse_stats(struct sparse_matrix_t *A)
     fprintf(stdout, "\tsize: %ldx%ld, nb items: %ld\n",
             A->nb_line, A->nb_col, A->nb_item);
     fprintf(stdout, "\tdensity: %f\n", density);
+    if (A->arena.nb_chunk) {
+        fprintf(stdout,
+                "\titem arena: %ld items allocated in %ld chunks, %ld bytes\n",
+                A->arena.nb_alloc, A->arena.nb_chunk,
+                (long int) A->arena.bytes);
+    }
+    if (A->frozen) {
+        fprintf(stdout, "\tfrozen: %ld bytes (%s index, %s value)\n",
+                sparse_frozen_bytes(A),
+                A->frozen->line_delta ? "delta coded" :
+                A->frozen->col_index32 ? "32 bit" : "64 bit",
+                (A->frozen->storage & SPARSE_VALUE_BF16) ? "bfloat16" :
+                (A->frozen->storage & SPARSE_VALUE_FP16) ? "half" :
+                A->frozen->line_val32 ? "32 bit" : "64 bit");
+        if (A->frozen->storage & SPARSE_VALUE_16) {
+            fprintf(stdout, "\tvalue scale: %g\n", A->frozen->val_scale);
+        }
+        if (A->frozen->line_delta && A->nb_item) {
+            fprintf(stdout, "\tdelta index: %.2f bytes per item\n",
+                    (double) A->frozen->line_delta->byte_ptr[A->nb_line]
+                    / A->nb_item);
+        }
+    }
+}
+
+/* power of two scale of the 16 bit values : the largest one is stored in
+   [2^14, 2^15), below the half range with the most subnormals left */
+static double sparse_value16_scale(double max_abs)
+{
+    int e;
+
+    if (max_abs == 0. || !isfinite(max_abs)) {
+        return (1.);
+    }
+    frexp(max_abs, &e);
+    return (ldexp(1., e - 15));
+}
+
+/* v rounded to the value width of storage, with scale for 16 bit values */
+static double sparse_round_value(double v, int storage, double scale)
+{
+    if (storage & SPARSE_VALUE_16) {
+        return (scale * sparse_value16_to_double
+                (sparse_double_to_value16(v / scale, storage), storage));
+    }
+    if (storage & SPARSE_VALUE_32) {
+        return ((double) (float) v);
+    }
+    return (v);
+}
+
+/** \brief Report the error made on the values of A when they are stored
+ as float, bfloat16 and half (see new_sparse_matrix_with_storage()) :
+ max and mean relative error, items rounded to zero or to infinity.
+ Returns the max relative error for the value width of storage (0 for 64
+ bit values). A should still have its 64 bit values (not frozen, or
+ frozen with 64 bit values).
+**/
+double sparse_value_error(struct sparse_matrix_t *A, int storage)
+{
+    static const int width[] = {
+        SPARSE_VALUE_32, SPARSE_VALUE_BF16, SPARSE_VALUE_FP16
+    };
+    static const char *name[] = { "float", "bfloat16", "half" };
+
+    struct sparse_item_t *cur_item;
+
+    double max_abs = 0., v, r, scale, max_err, sum_err, result = 0.;
+
+    long int i, k, n, nb_zero, nb_inf;
+
+    int w;
+
+    n = A->frozen ? A->frozen->line_ptr[A->nb_line] : A->nb_item;
+    for (i = 0; i < A->nb_line; i++) {
+        if (A->frozen) {
+            for (k = A->frozen->line_ptr[i]; k < A->frozen->line_ptr[i + 1];
+                 k++) {
+                v = fabs(SPARSE_LINE_VAL(A->frozen, k));
+                max_abs = (v > max_abs) ? v : max_abs;
+            }
+            continue;
+        }
+        for (cur_item = A->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            v = fabs(cur_item->val);
+            max_abs = (v > max_abs) ? v : max_abs;
+        }
+    }
+    scale = sparse_value16_scale(max_abs);
+
+    fprintf(stdout, "sparse value error (%p): %ld items, max |value| %g\n",
+            A, n, max_abs);
+    for (w = 0; w < 3; w++) {
+        max_err = 0.;
+        sum_err = 0.;
+        nb_zero = 0;
+        nb_inf = 0;
+        for (i = 0; i < A->nb_line; i++) {
+            k = A->frozen ? A->frozen->line_ptr[i] : 0;
+            cur_item = A->frozen ? NULL : A->line[i];
+            while (A->frozen ? k < A->frozen->line_ptr[i + 1] :
+                   cur_item != NULL) {
+                if (A->frozen) {
+                    v = SPARSE_LINE_VAL(A->frozen, k);
+                    k++;
+                } else {
+                    v = cur_item->val;
+                    cur_item = cur_item->next_in_line;
+                }
+                if (v == 0.) {
+                    continue;
+                }
+                r = sparse_round_value(v, width[w], scale);
+                if (r == 0.) {
+                    nb_zero++;
+                }
+                if (isinf(r)) {
+                    nb_inf++;
+                    r = 1.;
+                } else {
+                    r = fabs(r - v) / fabs(v);
+                }
+                max_err = (r > max_err) ? r : max_err;
+                sum_err += r;
+            }
+        }
+        fprintf(stdout,
+                "\t%-8s: max relative error %.3e, mean %.3e, %ld to zero, %ld to infinity\n",
+                name[w], max_err, n ? sum_err / n : 0., nb_zero, nb_inf);
+        if (storage & width[w]) {
+            result = max_err;
+        }
+    }
+    fflush(stdout);
+    return (result);
+}
+
+/* count[t * nb_col + j] = number of items of thread t in column j
+   becomes the position of its first one (col_ptr being built) */
+static void sparse_col_offsets(long int *count, int nt, long int nb_col,
+                               long int *col_ptr)
+{
+    long int j, c, total = 0;
+
+    int t;
+
+    for (j = 0; j < nb_col; j++) {
+        col_ptr[j] = total;
+        for (t = 0; t < nt; t++) {
+            c = count[t * nb_col + j];
+            count[t * nb_col + j] = total;
+            total += c;
+        }
+    }
+    col_ptr[nb_col] = total;
+}
+
+/* threads for a counting sort of nb_item items on nb_col columns : a count
+   table of nb_col per thread, all of them kept within nb_col + nb_item */
+static int sparse_col_nb_thread(long int nb_item, long int nb_col)
+{
+    int nt = sparse_work_nb_thread(nb_item);
+
+    if (nb_col > 0 && nt > 1 + nb_item / nb_col) {
+        nt = (int) (1 + nb_item / nb_col);
+    }
+    return (nt);
+}
+
+/** \brief Build the column arrays of a frozen matrix from its line arrays
+
+ Counting sort on the columns : the lines are cut in parts (fewer for wide
+ matrices, each one having a count table), each part counts its columns,
+ then copies its items at their place. Items of a column stay in line
+ order.
+**/
+void sparse_freeze_col(struct sparse_matrix_t *m)
+{
+    struct sparse_compressed_t *z = m->frozen;
+
+    long int *count;
+
+    int nt;
+
+    assert(z);
+    z->col_ptr = (long int *) malloc((m->nb_col + 1) * sizeof(long int));
+    assert(z->col_ptr);
+    nt = sparse_col_nb_thread(z->line_ptr[m->nb_line], m->nb_col);
+    count = (long int *) calloc(nt * m->nb_col + 1, sizeof(long int));
+    assert(count);
+
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        long int first, last, i, k, *c;
+
+        int t;
+
+        /* nt parts whatever the size of the team */
+#pragma omp for schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            first = sparse_balanced_split(z->line_ptr, m->nb_line, t, nt);
+            last = sparse_balanced_split(z->line_ptr, m->nb_line, t + 1, nt);
+            c = count + t * m->nb_col;
+            for (k = z->line_ptr[first]; k < z->line_ptr[last]; k++) {
+                c[SPARSE_LINE_COL(z, k)]++;
+            }
+        }
+#pragma omp single
+        {
+            sparse_col_offsets(count, nt, m->nb_col, z->col_ptr);
+            sparse_frozen_alloc(z, 0, z->line_ptr[m->nb_line]);
+        }
+#pragma omp for schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            first = sparse_balanced_split(z->line_ptr, m->nb_line, t, nt);
+            last = sparse_balanced_split(z->line_ptr, m->nb_line, t + 1, nt);
+            c = count + t * m->nb_col;
+            for (i = first; i < last; i++) {
+                for (k = z->line_ptr[i]; k < z->line_ptr[i + 1]; k++) {
+                    sparse_frozen_set_col(z, c[SPARSE_LINE_COL(z, k)]++, i,
+                                          SPARSE_LINE_VAL(z, k));
+                }
+            }
+        }
+    }
+    free(count);
+}
+
+/** \brief Build the column links of a linked matrix in one go
+
+ Used to load a matrix without column links (col_link_status = 0, no
+ ordering needed) and link the columns afterwards. Same counting sort as
+ sparse_freeze_col() on the item pointers, then columns are linked in
+ parallel. m->col_link_status becomes SPARSE_COL_LINK.
+**/
+void sparse_build_col_link(struct sparse_matrix_t *m)
+{
+    struct sparse_item_t **sorted;
+
+    long int *count, *col_ptr;
+
+    int nt;
+
+    if (m->frozen) {
+        return;
+    }
+    if (!m->last_col) {
+        m->last_col = (struct sparse_item_t **)
+            calloc(m->nb_col, sizeof(struct sparse_item_t *));
+        assert(m->last_col);
+    }
+    nt = sparse_col_nb_thread(m->nb_item, m->nb_col);
+    count = (long int *) calloc(nt * m->nb_col + 1, sizeof(long int));
+    col_ptr = (long int *) malloc((m->nb_col + 1) * sizeof(long int));
+    sorted = (struct sparse_item_t **)
+        malloc((m->nb_item + 1) * sizeof(struct sparse_item_t *));
+    assert(count && col_ptr && sorted);
+
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        struct sparse_item_t *cur_item;
+
+        long int i, j, k, *c;
+
+        int t;
+
+#pragma omp for schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            c = count + t * m->nb_col;
+            for (i = m->nb_line * t / nt; i < m->nb_line * (t + 1) / nt;
+                 i++) {
+                for (cur_item = m->line[i]; cur_item;
+                     cur_item = cur_item->next_in_line) {
+                    c[cur_item->col_index]++;
+                }
+            }
+        }
+#pragma omp single
+        sparse_col_offsets(count, nt, m->nb_col, col_ptr);
+
+#pragma omp for schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            c = count + t * m->nb_col;
+            for (i = m->nb_line * t / nt; i < m->nb_line * (t + 1) / nt;
+                 i++) {
+                for (cur_item = m->line[i]; cur_item;
+                     cur_item = cur_item->next_in_line) {
+                    sorted[c[cur_item->col_index]++] = cur_item;
+                }
+            }
+        }
+#pragma omp for
+        for (j = 0; j < m->nb_col; j++) {
+            m->col[j] = NULL;
+            m->last_col[j] = NULL;
+            if (col_ptr[j] == col_ptr[j + 1]) {
+                continue;
+            }
+            m->col[j] = sorted[col_ptr[j]];
+            for (k = col_ptr[j]; k < col_ptr[j + 1] - 1; k++) {
+                sorted[k]->next_in_col = sorted[k + 1];
+            }
+            sorted[k]->next_in_col = NULL;
+            m->last_col[j] = sorted[k];
+        }
+    }
+    m->col_link_status = SPARSE_COL_LINK;
+
+    free(count);
+    free(col_ptr);
+    free(sorted);
+}
+
+/** \brief Freeze sparse matrix m into compressed arrays
+
+ Items are stored line by line (col_index, line_val indexed by line_ptr) and
+ column by column (line_index, col_val indexed by col_ptr), with the index
+ and value widths given by m->storage. 16 bit values are divided by a
+ power of two scale putting the largest one just below 2^15 (see
+ sparse_value_error()). The linked items are released : m can't be
+ modified anymore, only read.
+**/
+void sparse_freeze(struct sparse_matrix_t *m)
+{
+    struct sparse_compressed_t *z;
+
+    struct sparse_item_t *cur_item;
+
+    long int i, k, n;
+
+    double max_abs = 0.;
+
+    assert(m);
+    if (m->frozen) {
+        return;
+    }
+
+    z = (struct sparse_compressed_t *)
+        calloc(1, sizeof(struct sparse_compressed_t));
+    assert(z);
+    z->storage = m->storage;
+
+    /* line pointers, largest value for the 16 bit scale */
+    z->line_ptr = (long int *) malloc((m->nb_line + 1) * sizeof(long int));
+    assert(z->line_ptr);
+    n = 0;
+    for (i = 0; i < m->nb_line; i++) {
+        z->line_ptr[i] = n;
+        cur_item = m->line[i];
+        while (cur_item) {
+            n++;
+            if (fabs(cur_item->val) > max_abs) {
+                max_abs = fabs(cur_item->val);
+            }
+            cur_item = cur_item->next_in_line;
+        }
+    }
+    z->line_ptr[m->nb_line] = n;
+    z->val_scale = (z->storage & SPARSE_VALUE_16) ?
+        sparse_value16_scale(max_abs) : 1.;
+
+    /* line arrays */
+    sparse_frozen_alloc(z, 1, n);
+    k = 0;
+    for (i = 0; i < m->nb_line; i++) {
+        cur_item = m->line[i];
+        while (cur_item) {
+            sparse_frozen_set_line(z, k, cur_item->col_index,
+                                   cur_item->val);
+            k++;
+            cur_item = cur_item->next_in_line;
+        }
+    }
+    sparse_free_arena(m);
+
+    free(m->line);
+    free(m->col);
+    if (m->col_link_status == SPARSE_COL_LINK) {
+        free(m->last_col);
+    }
+    m->line = NULL;
+    m->col = NULL;
+    m->last_col = NULL;
+    m->nb_item = n;
+    m->frozen = z;
+
+    /* column arrays */
+    sparse_freeze_col(m);
+    if (z->storage & SPARSE_INDEX_DELTA) {
+        sparse_delta_encode(m);
+    }
+
+    fprintf(stdout, "freeze sparse matrix (%p): %ld items\n", m, n);
+    fflush(stdout);
+}
+
+int sparse_is_frozen(struct sparse_matrix_t *m)
+{
+    return (m->frozen != NULL);
+}
+
+/** \brief memory used by the frozen arrays of m **/
+long int sparse_frozen_bytes(struct sparse_matrix_t *m)
+{
+    struct sparse_compressed_t *z = m->frozen;
+
+    long int index_size, val_size;
+
+    if (!z) {
+        return (0);
+    }
+    index_size = z->line_index32 ? sizeof(int) : sizeof(long int);
+    val_size = z->line_val16 ? sizeof(unsigned short) :
+        z->line_val32 ? sizeof(float) : sizeof(double);
+    return (m->nb_item * (index_size + 2 * val_size)
+            + (z->line_delta ? sparse_delta_bytes(z) :
+               m->nb_item * index_size)
+            + (m->nb_line + m->nb_col + 2) * sizeof(long int));
+}
+
+/** \brief read-only accessors to a frozen matrix (NULL if not frozen, or
+ if the storage uses the other width) **/
+const long int *sparse_line_ptr(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->line_ptr : NULL);
+}
+
+const long int *sparse_line_col_index(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->col_index : NULL);
+}
+
+const double *sparse_line_val(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->line_val : NULL);
+}
+
+const long int *sparse_col_ptr(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->col_ptr : NULL);
+}
+
+const long int *sparse_col_line_index(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->line_index : NULL);
+}
+
+const double *sparse_col_val(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->col_val : NULL);
+}
+
+const int *sparse_line_col_index32(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->col_index32 : NULL);
+}
+
+const float *sparse_line_val32(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->line_val32 : NULL);
+}
+
+const int *sparse_col_line_index32(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->line_index32 : NULL);
+}
+
+const float *sparse_col_val32(struct sparse_matrix_t *m)
+{
+    return (m->frozen ? m->frozen->col_val32 : NULL);
 }
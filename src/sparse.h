@@ -17,6 +17,51 @@ enum {
     SPARSE_COL_LINK = 1
 };
 
+/* frozen storage widths, 64 bit index and value by default. 16 bit values
+   (bfloat16 or IEEE half) are stored divided by a power of two scale,
+   SPARSE_INDEX_DELTA codes the column indices of the lines as gaps, of one
+   width (1, 2, 4 or 8 bytes) per line */
+enum {
+    SPARSE_STORAGE_64 = 0,
+    SPARSE_INDEX_32 = 1,
+    SPARSE_VALUE_32 = 2,
+    SPARSE_VALUE_BF16 = 4,
+    SPARSE_VALUE_FP16 = 8,
+    SPARSE_INDEX_DELTA = 16
+};
+
+#define SPARSE_VALUE_16 (SPARSE_VALUE_BF16 | SPARSE_VALUE_FP16)
+
+/* what sparse_triplet_to_matrix() does with duplicate (i,j) */
+enum {
+    SPARSE_DUPLICATE_SUM = 0,
+    SPARSE_DUPLICATE_REPLACE,
+    SPARSE_DUPLICATE_ERROR
+};
+
+/* quantities computed by sparse_reduce() */
+enum {
+    SPARSE_REDUCE_LINE_NORM = 1,
+    SPARSE_REDUCE_LINE_COUNT = 2,
+    SPARSE_REDUCE_LINE_SUM = 4,
+    SPARSE_REDUCE_COL_NORM = 8,
+    SPARSE_REDUCE_COL_COUNT = 16,
+    SPARSE_REDUCE_COL_SUM = 32,
+    SPARSE_REDUCE_ATA_DIAG = 64
+};
+
+/* reorderings computed by sparse_reorder() */
+enum {
+    SPARSE_REORDER_LINES = 0,
+    SPARSE_REORDER_RCM
+};
+
+/* numbering moved by sparse_perm_to_new() / sparse_perm_to_orig() */
+enum {
+    SPARSE_PERM_LINE = 0,
+    SPARSE_PERM_COL
+};
+
 struct sparse_item_t {
     long int col_index;
     long int line_index;
@@ -26,9 +71,246 @@ struct sparse_item_t {
 };
 
 /*
- * col_link_status=SPARSE_COL_LINK, speeds up importation of sparse matrix,
- * ONLY IF the data are ordered  in the file such as :   for (l=0;
- * l<line<l++) { for (c=0; c<col; c++) read_from_file (element[l][c]); }
+ * linked items are bump allocated from chunks owned by the matrix, and
+ * released all at once
+ */
+struct sparse_arena_chunk_t {
+    struct sparse_arena_chunk_t *next;
+    long int size;
+    long int used;
+    struct sparse_item_t item[];
+};
+
+struct sparse_arena_t {
+    struct sparse_arena_chunk_t *chunk;
+    long int nb_chunk;
+    long int nb_alloc;
+    size_t bytes;
+};
+
+/*
+ * cache tiled copy of the line (or column) arrays of a frozen matrix, see
+ * sparse_tile.c. Lines (columns) are cut into blocks, starting at
+ * block[b], and their items into panels of width columns (lines), so that
+ * the part of x (y) used by block b and panel p stays in cache. Segment
+ * s = b * nb_panel + p holds the runs seg_ptr[s] .. seg_ptr[s+1]-1, run r
+ * holding the items run_ptr[r] .. run_ptr[r+1]-1 of line (column)
+ * run_outer[r]. index and val have the widths of the frozen storage.
+ */
+struct sparse_tile_t {
+    long int nb_block;
+    long int nb_panel;
+    long int width;
+    long int *block;
+    long int *seg_ptr;
+    long int *run_outer;
+    long int *run_ptr;
+    void *index;
+    void *val;
+};
+
+/*
+ * delta coded column indices of the lines of a frozen matrix, see
+ * sparse_delta.c. The first item of line i is in column first[i], the
+ * gaps from each item to the next one are at code[byte_ptr[i]] (aligned),
+ * all width[i] bytes wide (1, 2, 4 or 8 : the largest gap of the line).
+ * id tells the matrices apart for the decoding cursors.
+ */
+struct sparse_delta_t {
+    long int id;
+    long int nb_line;
+    long int *first;
+    long int *byte_ptr;
+    unsigned char *width;
+    unsigned char *code;
+};
+
+/*
+ * frozen (compressed) storage, built by sparse_freeze() :
+ * items of line i are col_index[line_ptr[i]] .. col_index[line_ptr[i+1]-1]
+ * (sorted by column), items of column j are line_index[col_ptr[j]] ..
+ * line_index[col_ptr[j+1]-1] (sorted by line).
+ *
+ * with SPARSE_INDEX_32 (resp. SPARSE_VALUE_32) storage, col_index and
+ * line_index (resp. line_val and col_val) are NULL and the *32 arrays are
+ * used instead. With SPARSE_VALUE_BF16 or SPARSE_VALUE_FP16, values are
+ * val_scale * line_val16[k] (col_val16[k]). With SPARSE_INDEX_DELTA,
+ * col_index and col_index32 are NULL, the line columns being decoded from
+ * line_delta (column arrays keep plain indices). SPARSE_LINE_COL() and
+ * friends read an item whatever the storage, sequential reads along the
+ * lines being the cheap ones with delta indices.
+ *
+ * arrays may live in a read-only mapping of a binary matrix file (map,
+ * map_size), see read_binary_sparse_matrix().
+ *
+ * line_tile and col_tile, if built by sparse_tile(), are used by the
+ * products instead of the line and column arrays.
+ */
+struct sparse_compressed_t {
+    int storage;
+    void *map;
+    size_t map_size;
+    long int *line_ptr;
+    long int *col_index;
+    int *col_index32;
+    double *line_val;
+    float *line_val32;
+    long int *col_ptr;
+    long int *line_index;
+    int *line_index32;
+    double *col_val;
+    float *col_val32;
+    unsigned short *line_val16;
+    unsigned short *col_val16;
+    double val_scale;
+    struct sparse_delta_t *line_delta;
+    struct sparse_tile_t *line_tile;
+    struct sparse_tile_t *col_tile;
+};
+
+/*
+ * (i, j, val) triplets collected before building a matrix in one go, see
+ * sparse_triplet.c. key = i * nb_col + j.
+ */
+struct sparse_triplet_t {
+    long int nb_line;
+    long int nb_col;
+    long int nb;
+    long int size;
+    int sorted;
+    unsigned long int *key;
+    double *val;
+    long int nb_duplicate;
+};
+
+/*
+ * results of sparse_reduce(), NULL if not requested : 2-norms, numbers of
+ * items and sums of the lines and columns, diagonal of A^T*A (squared
+ * column norms)
+ */
+struct sparse_reduce_t {
+    struct vector_t *line_norm;
+    struct vector_t *line_count;
+    struct vector_t *line_sum;
+    struct vector_t *col_norm;
+    struct vector_t *col_count;
+    struct vector_t *col_sum;
+    struct vector_t *ata_diag;
+};
+
+/*
+ * out-of-core matrix : a binary matrix file (see read_binary_sparse_matrix)
+ * of which only line_ptr (and col_ptr) are kept in memory. Items are read
+ * by blocks of at most block_item items into buf[0] / buf[1], the next
+ * block being read while the current one is used. See sparse_stream.c.
+ */
+struct sparse_stream_t {
+    char *filename;
+    int fd;
+    int storage;
+    int with_col;
+    long int nb_line;
+    long int nb_col;
+    long int nb_item;
+    long int *line_ptr;
+    long int *col_ptr;
+    long int offset[6];
+    long int block_item;
+    size_t index_size;
+    size_t val_size;
+    char *buf[2];
+};
+
+/*
+ * row partition of a nb_line x nb_col matrix (see sparse_shard.c) : lines
+ * first_line .. first_line + A->nb_line - 1, A numbering its columns
+ * locally, col_map[c] being the global number of local column c.
+ */
+struct sparse_shard_t {
+    int shard;
+    int nb_shard;
+    long int nb_line;
+    long int nb_col;
+    long int first_line;
+    long int *col_map;
+    struct sparse_matrix_t *A;
+    struct vector_t *x_local;
+    struct vector_t *y_local;
+};
+
+/*
+ * how the shards combine their results, one shard per process : the
+ * lines computed by each shard (A*x) are gathered into y, the column
+ * contributions (A^T*y, on the shard's local columns) are summed into x.
+ * Both leave the same y (x) in every process. data is for the
+ * implementation (shared memory, MPI communicator, ...).
+ */
+struct sparse_shard_reduce_t {
+    void (*gather_lines)(struct sparse_shard_reduce_t *red,
+                         struct sparse_shard_t *s, const double *local,
+                         struct vector_t *y);
+    void (*sum_cols)(struct sparse_shard_reduce_t *red,
+                     struct sparse_shard_t *s, const double *partial,
+                     struct vector_t *x);
+    void *data;
+};
+
+/*
+ * line and column permutations (see sparse_perm.c) : line[k] (col[k]) is
+ * the original number of line (column) k of the permuted matrix
+ */
+struct sparse_perm_t {
+    long int nb_line;
+    long int nb_col;
+    long int *line;
+    long int *col;
+};
+
+/*
+ * options and results of sparse_lsqr() / sparse_lsmr(), which minimize
+ * ||b - A*x||^2 + damp^2 * ||x||^2, x holding the initial guess. Set the
+ * defaults with sparse_lsqr_init(). hook, if not NULL, is called after
+ * each iteration with the estimates below (x is only up to date on
+ * return of the solver), a non zero return stopping it (istop = 8).
+ */
+struct sparse_lsqr_t {
+    double damp;
+    double atol;
+    double btol;
+    double conlim;
+    long int max_iter;
+    int (*hook)(struct sparse_lsqr_t *p);
+    void *hook_data;
+
+    int istop;
+    long int iter;
+    double anorm;
+    double acond;
+    double rnorm;
+    double arnorm;
+    double xnorm;
+};
+
+#define SPARSE_LINE_COL(z, k) \
+    ((z)->col_index ? (z)->col_index[k] : (z)->col_index32 ? \
+     (long int) (z)->col_index32[k] : sparse_delta_col(z, k))
+#define SPARSE_LINE_VAL(z, k) \
+    ((z)->line_val ? (z)->line_val[k] : (z)->line_val32 ? \
+     (double) (z)->line_val32[k] : sparse_frozen_val16(z, (z)->line_val16[k]))
+#define SPARSE_COL_LINE(z, k) \
+    ((z)->line_index ? (z)->line_index[k] : (long int) (z)->line_index32[k])
+#define SPARSE_COL_VAL(z, k) \
+    ((z)->col_val ? (z)->col_val[k] : (z)->col_val32 ? \
+     (double) (z)->col_val32[k] : sparse_frozen_val16(z, (z)->col_val16[k]))
+
+/*
+ * col_link_status=SPARSE_COL_LINK keeps the columns linked on each
+ * sparse_set_value(), ONLY IF the items are set in line order. Otherwise
+ * use 0 and sparse_build_col_link() once the items are set (the readers do
+ * so when asked for SPARSE_COL_LINK).
+ *
+ * once frozen, line, col and last_col are released (NULL) and the items
+ * are only available through the sparse_line_* / sparse_col_* accessors.
  */
 struct sparse_matrix_t {
     long int nb_line;
@@ -37,13 +319,21 @@ struct sparse_matrix_t {
     struct sparse_item_t **line;
     struct sparse_item_t **col;
     int col_link_status;
+    int storage;
     struct sparse_item_t **last_col;
+    struct sparse_arena_t arena;
+    struct sparse_compressed_t *frozen;
 };
 
 char *libsparseversion();
 struct sparse_matrix_t *new_sparse_matrix(long int nb_line,
                                           long int nb_col,
                                           int col_link_status);
+struct sparse_matrix_t *new_sparse_matrix_with_storage(long int nb_line,
+                                                       long int nb_col,
+                                                       int col_link_status,
+                                                       int storage);
+void sparse_set_storage(struct sparse_matrix_t *m, int storage);
 void free_sparse_matrix(struct sparse_matrix_t *m);
 
 double sparse_get_value(struct sparse_matrix_t *m, long int i, long int j);
@@ -52,11 +342,23 @@ struct sparse_item_t *sparse_set_value(struct sparse_matrix_t *m,
                                        struct sparse_item_t *last_item);
 void sparse_update_col_link(struct sparse_matrix_t *m,
                             struct sparse_item_t *item);
+struct sparse_item_t *sparse_new_items(struct sparse_matrix_t *m,
+                                       long int n);
 
 struct sparse_matrix_t *read_sparse_matrix(char *filename,
                                            int col_link_status);
 struct sparse_matrix_t *read_ijk_sparse_matrix(char *filename,
                                                int col_link_status);
+struct sparse_matrix_t *read_sparse_matrix_parallel(char *filename,
+                                                    int col_link_status,
+                                                    long int *nb_record);
+struct sparse_matrix_t *read_sparse_matrix_blocks(int nb, char **filename,
+                                                  long int *offset,
+                                                  int col_link_status);
+struct sparse_matrix_t *sparse_concat_lines(int nb,
+                                            struct sparse_matrix_t **block,
+                                            long int *offset,
+                                            int col_link_status);
 
 struct sparse_matrix_t *import_sparse_matrix(struct sparse_matrix_t *a,
                                              char *filename);
@@ -82,4 +384,155 @@ void sparse_compute_length(struct sparse_matrix_t *m, char *filename);
 struct sparse_matrix_t *AtransA(struct sparse_matrix_t *A);
 double mean_diag_AtA(struct sparse_matrix_t *A);
 void show_sparse_stats(struct sparse_matrix_t *A);
+double sparse_value_error(struct sparse_matrix_t *A, int storage);
+
+void sparse_freeze(struct sparse_matrix_t *m);
+int sparse_is_frozen(struct sparse_matrix_t *m);
+const long int *sparse_line_ptr(struct sparse_matrix_t *m);
+const long int *sparse_line_col_index(struct sparse_matrix_t *m);
+const double *sparse_line_val(struct sparse_matrix_t *m);
+const long int *sparse_col_ptr(struct sparse_matrix_t *m);
+const long int *sparse_col_line_index(struct sparse_matrix_t *m);
+const double *sparse_col_val(struct sparse_matrix_t *m);
+const int *sparse_line_col_index32(struct sparse_matrix_t *m);
+const float *sparse_line_val32(struct sparse_matrix_t *m);
+const int *sparse_col_line_index32(struct sparse_matrix_t *m);
+const float *sparse_col_val32(struct sparse_matrix_t *m);
+double sparse_frozen_val16(struct sparse_compressed_t *z, unsigned short h);
+long int sparse_frozen_bytes(struct sparse_matrix_t *m);
+void sparse_freeze_col(struct sparse_matrix_t *m);
+void sparse_build_col_link(struct sparse_matrix_t *m);
+
+void write_binary_sparse_matrix(struct sparse_matrix_t *A, char *filename,
+                                int with_col);
+struct sparse_matrix_t *read_binary_sparse_matrix(char *filename,
+                                                  int check);
+void write_ijk_sparse_matrix(struct sparse_matrix_t *A, char *filename);
+struct sparse_matrix_t *read_mm_sparse_matrix(char *filename,
+                                              int col_link_status);
+void write_mm_sparse_matrix(struct sparse_matrix_t *A, char *filename);
+void sparse_set_write_precision(int precision);
+int sparse_get_write_precision(void);
+void sparse_text_to_binary(char *text_filename, int ijk,
+                           char *binary_filename, int storage,
+                           int with_col);
+void sparse_binary_to_text(char *binary_filename, int ijk,
+                           char *text_filename);
+
+struct sparse_stream_t *sparse_stream_open(char *filename,
+                                           size_t block_bytes);
+void sparse_stream_close(struct sparse_stream_t *s);
+void sparse_stream_mult_vector(struct sparse_stream_t *s,
+                               struct vector_t *x, struct vector_t *y);
+void sparse_stream_trans_mult_vector(struct sparse_stream_t *s,
+                                     struct vector_t *y,
+                                     struct vector_t *x);
+void sparse_stream_aprod(int mode, struct sparse_stream_t *s,
+                         struct vector_t *x, struct vector_t *y);
+void sparse_text_to_binary_stream(char *text_filename,
+                                  char *binary_filename, int storage);
+
+void sparse_shard_write(struct sparse_matrix_t *A, int nb_shard,
+                        char *basename);
+struct sparse_shard_t *sparse_shard_open(char *filename, int check);
+struct sparse_shard_t *sparse_shard_open_part(char *basename, int k,
+                                              int check);
+void sparse_shard_close(struct sparse_shard_t *s);
+void sparse_shard_mult_vector(struct sparse_shard_t *s, struct vector_t *x,
+                              struct vector_t *y,
+                              struct sparse_shard_reduce_t *red);
+void sparse_shard_trans_mult_vector(struct sparse_shard_t *s,
+                                    struct vector_t *y, struct vector_t *x,
+                                    struct sparse_shard_reduce_t *red);
+void sparse_shard_aprod(int mode, struct sparse_shard_t *s,
+                        struct vector_t *x, struct vector_t *y,
+                        struct sparse_shard_reduce_t *red);
+struct sparse_shard_reduce_t *sparse_shard_shm_new(int nb_shard,
+                                                   long int nb_line,
+                                                   long int nb_col);
+void sparse_shard_shm_free(struct sparse_shard_reduce_t *red);
+
+struct sparse_perm_t *sparse_reorder(struct sparse_matrix_t *A, int method);
+void sparse_free_perm(struct sparse_perm_t *p);
+struct sparse_matrix_t *sparse_permute(struct sparse_matrix_t *A,
+                                       struct sparse_perm_t *p,
+                                       int col_link_status);
+struct vector_t *sparse_perm_to_new(struct sparse_perm_t *p, int what,
+                                    struct vector_t *v);
+struct vector_t *sparse_perm_to_orig(struct sparse_perm_t *p, int what,
+                                     struct vector_t *v);
+void write_sparse_perm(struct sparse_perm_t *p, char *filename);
+struct sparse_perm_t *read_sparse_perm(char *filename);
+
+void sparse_lsqr_init(struct sparse_lsqr_t *p);
+const char *sparse_lsqr_message(int istop);
+void sparse_lsqr(struct sparse_matrix_t *A, struct vector_t *b,
+                 struct vector_t *x, struct sparse_lsqr_t *p);
+void sparse_lsmr(struct sparse_matrix_t *A, struct vector_t *b,
+                 struct vector_t *x, struct sparse_lsqr_t *p);
+
+void sparse_tile(struct sparse_matrix_t *A, long int width);
+void sparse_untile(struct sparse_matrix_t *A);
+void sparse_tile_mult(struct sparse_compressed_t *z, struct sparse_tile_t *t,
+                      const double *in, double *out);
+void sparse_set_cache_size(long int bytes);
+long int sparse_get_cache_size(void);
+
+void sparse_delta_encode(struct sparse_matrix_t *m);
+void sparse_delta_free(struct sparse_delta_t *d);
+long int sparse_delta_col(struct sparse_compressed_t *z, long int k);
+double sparse_delta_dot(struct sparse_compressed_t *z, long int k,
+                        long int n, const double *x);
+long int sparse_delta_bytes(struct sparse_compressed_t *z);
+
+void sparse_set_nb_thread(int nb_thread);
+int sparse_get_nb_thread(void);
+int sparse_work_nb_thread(long int nb_item);
+int sparse_thread_id(void);
+long int sparse_balanced_split(const long int *ptr, long int n, long int p,
+                               long int nb_part);
+int sparse_set_simd(const char *name);
+const char *sparse_get_simd(void);
+double sparse_dot(const long int *index, const double *val,
+                  const double *x, long int n);
+double sparse_dot_index32(const int *index, const double *val,
+                          const double *x, long int n);
+double sparse_dot_value32(const long int *index, const float *val,
+                          const double *x, long int n);
+double sparse_dot_index32_value32(const int *index, const float *val,
+                                  const double *x, long int n);
+double sparse_dot_value16(const long int *index,
+                          const unsigned short *val, const double *x,
+                          long int n, int storage);
+double sparse_dot_index32_value16(const int *index,
+                                  const unsigned short *val,
+                                  const double *x, long int n, int storage);
+double sparse_dot_delta(int width, const void *gap, long int *col,
+                        const void *val, int storage, const double *x,
+                        long int n);
+unsigned short sparse_double_to_value16(double v, int storage);
+double sparse_value16_to_double(unsigned short h, int storage);
+double sparse_dot_storage(int storage, const void *index, const void *val,
+                          long int k, long int n, const double *x);
+double sparse_frozen_dot(struct sparse_compressed_t *z, int line,
+                         long int k, long int n, const double *x);
+void sparse_mult_vector(struct sparse_matrix_t *A, struct vector_t *x,
+                        struct vector_t *y);
+void sparse_trans_mult_vector(struct sparse_matrix_t *A,
+                              struct vector_t *y, struct vector_t *x);
+void sparse_aprod(int mode, struct sparse_matrix_t *A, struct vector_t *x,
+                  struct vector_t *y);
+struct sparse_triplet_t *new_sparse_triplet(long int nb_line,
+                                           long int nb_col, long int size);
+void free_sparse_triplet(struct sparse_triplet_t *t);
+void sparse_triplet_add(struct sparse_triplet_t *t, long int i, long int j,
+                        double val);
+struct sparse_matrix_t *sparse_triplet_to_matrix(struct sparse_triplet_t *t,
+                                                 int col_link_status,
+                                                 int duplicate);
+void sparse_get_values(struct sparse_matrix_t *A, long int n,
+                       const long int *i, const long int *j, double *val);
+void sparse_reduce(struct sparse_matrix_t *A, int what,
+                   struct sparse_reduce_t *r);
+void sparse_free_reduce(struct sparse_reduce_t *r);
 #endif
@@ -0,0 +1,483 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sparse.h"
+#include "sparse_binary.h"
+
+/* FNV-1a on 64 bit words, n is a multiple of 8 */
+uint64_t sparse_binary_checksum(uint64_t h, const void *data,
+                                       size_t n)
+{
+    const uint64_t *w = (const uint64_t *) data;
+
+    size_t k;
+
+    for (k = 0; k < n / 8; k++) {
+        h = (h ^ w[k]) * SPARSE_BINARY_FNV_PRIME;
+    }
+    return (h);
+}
+
+size_t sparse_binary_align(size_t n)
+{
+    return ((n + 7) & ~((size_t) 7));
+}
+
+/** \brief check the header found at the beginning of a binary file of
+ size bytes (data), exit if it is not valid : sizes, storage, and every
+ array within the file. Return the end of the arrays in the file. **/
+int64_t sparse_binary_check_header(char *caller, char *filename,
+                                   const void *data, off_t size,
+                                   struct sparse_binary_header_t *header)
+{
+    int64_t count[SPARSE_BINARY_NB_ARRAY], elem[SPARSE_BINARY_NB_ARRAY];
+
+    int64_t index_size, val_size, end;
+
+    int k, nb_array;
+
+    if (size < SPARSE_BINARY_HEADER_SIZE) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "%s: '%s' is not a binary sparse matrix\n", caller,
+                filename);
+        exit(1);
+    }
+    memcpy(header, data, sizeof(struct sparse_binary_header_t));
+    if (memcmp(header->magic, SPARSE_BINARY_MAGIC, 8)
+        || header->header_checksum !=
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET, header,
+                               offsetof(struct sparse_binary_header_t,
+                                        header_checksum))) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "%s: '%s' is not a binary sparse matrix\n", caller,
+                filename);
+        exit(1);
+    }
+    if (header->version != SPARSE_BINARY_VERSION
+        || header->endian != SPARSE_BINARY_ENDIAN) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "%s: '%s' unsupported version %d or byte order\n", caller,
+                filename, header->version);
+        exit(1);
+    }
+    if (header->nb_line < 0 || header->nb_line == INT64_MAX
+        || header->nb_col < 0 || header->nb_col == INT64_MAX
+        || header->nb_item < 0
+        || (header->storage & ~(SPARSE_INDEX_32 | SPARSE_VALUE_32))
+        || ((header->storage & SPARSE_INDEX_32)
+            && (header->nb_line > INT_MAX || header->nb_col > INT_MAX))) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "%s: '%s' invalid header\n", caller, filename);
+        exit(1);
+    }
+
+    index_size = (header->storage & SPARSE_INDEX_32) ?
+        sizeof(int) : sizeof(long int);
+    val_size = (header->storage & SPARSE_VALUE_32) ?
+        sizeof(float) : sizeof(double);
+    count[SPARSE_BINARY_LINE_PTR] = header->nb_line + 1;
+    count[SPARSE_BINARY_COL_INDEX] = header->nb_item;
+    count[SPARSE_BINARY_LINE_VAL] = header->nb_item;
+    count[SPARSE_BINARY_COL_PTR] = header->nb_col + 1;
+    count[SPARSE_BINARY_LINE_INDEX] = header->nb_item;
+    count[SPARSE_BINARY_COL_VAL] = header->nb_item;
+    elem[SPARSE_BINARY_LINE_PTR] = sizeof(long int);
+    elem[SPARSE_BINARY_COL_INDEX] = index_size;
+    elem[SPARSE_BINARY_LINE_VAL] = val_size;
+    elem[SPARSE_BINARY_COL_PTR] = sizeof(long int);
+    elem[SPARSE_BINARY_LINE_INDEX] = index_size;
+    elem[SPARSE_BINARY_COL_VAL] = val_size;
+    nb_array = (header->flags & SPARSE_BINARY_COL) ?
+        SPARSE_BINARY_NB_ARRAY : SPARSE_BINARY_COL_PTR;
+
+    /* each array, padding included, within the file */
+    end = SPARSE_BINARY_HEADER_SIZE;
+    for (k = 0; k < nb_array; k++) {
+        if (header->offset[k] % 8
+            || header->offset[k] < SPARSE_BINARY_HEADER_SIZE
+            || header->offset[k] > size
+            || count[k] > (size - header->offset[k]) / elem[k]
+            || header->offset[k] +
+            (int64_t) sparse_binary_align(count[k] * elem[k]) > size) {
+            fprintf(stdout, "\n");
+            fprintf(stderr, "%s: '%s' truncated\n", caller, filename);
+            exit(1);
+        }
+        if (header->offset[k] +
+            (int64_t) sparse_binary_align(count[k] * elem[k]) > end) {
+            end = header->offset[k] + sparse_binary_align(count[k] * elem[k]);
+        }
+    }
+    return (end);
+}
+
+/** \brief check a line_ptr/col_ptr like array of a file (n + 1 entries) :
+ from 0 to nb_item, never decreasing. Exit if not. **/
+void sparse_binary_check_ptr(char *caller, char *filename,
+                             const long int *ptr, long int n,
+                             long int nb_item)
+{
+    long int i;
+
+    for (i = 0; i < n; i++) {
+        if (ptr[i] > ptr[i + 1]) {
+            break;
+        }
+    }
+    if (ptr[0] != 0 || i < n || ptr[n] != nb_item) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "%s: '%s' corrupted\n", caller, filename);
+        exit(1);
+    }
+}
+
+/** \brief check the n indices of a file (long int, or int if index32)
+ are in [0, bound). Exit if not. **/
+void sparse_binary_check_index(char *caller, char *filename,
+                               const void *index, int index32, long int n,
+                               long int bound)
+{
+    long int k, bad = 0;
+
+    int nt = sparse_work_nb_thread(n);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) reduction(+:bad)
+    for (k = 0; k < n; k++) {
+        long int j = index32 ? (long int) ((const int *) index)[k] :
+            ((const long int *) index)[k];
+
+        bad += (j < 0 || j >= bound);
+    }
+    if (bad) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "%s: '%s' corrupted, %ld indices out of range\n",
+                caller, filename, bad);
+        exit(1);
+    }
+}
+
+/* write n bytes and the padding to 8 bytes, update the checksum */
+void sparse_binary_write(FILE * fd, char *filename, const void *data,
+                         size_t n, uint64_t * h)
+{
+    static const char zero[8] = { 0 };
+
+    size_t pad = sparse_binary_align(n) - n;
+
+    if (fwrite(data, 1, n, fd) != n || fwrite(zero, 1, pad, fd) != pad) {
+        perror(filename);
+        exit(1);
+    }
+    /* the padding is zero, so the last word can be completed */
+    *h = sparse_binary_checksum(*h, data, n - n % 8);
+    if (n % 8) {
+        uint64_t last = 0;
+
+        memcpy(&last, (const char *) data + n - n % 8, n % 8);
+        *h = sparse_binary_checksum(*h, &last, 8);
+    }
+}
+
+/** \brief Write sparse matrix A to a binary file
+
+ A is frozen first if needed. with_col = 1 also stores the column arrays,
+ otherwise they are rebuilt when the file is read. 16 bit values (and
+ their scale) and delta coded indices have no place in the file format.
+**/
+void write_binary_sparse_matrix(struct sparse_matrix_t *A, char *filename,
+                                int with_col)
+{
+    struct sparse_binary_header_t header;
+
+    struct sparse_compressed_t *z;
+
+    char block[SPARSE_BINARY_HEADER_SIZE];
+
+    size_t index_size, val_size, size[SPARSE_BINARY_NB_ARRAY];
+
+    const void *array[SPARSE_BINARY_NB_ARRAY];
+
+    uint64_t h = SPARSE_BINARY_FNV_OFFSET;
+
+    int64_t offset;
+
+    FILE *fd;
+
+    int k, nb_array;
+
+    assert(sizeof(long int) == 8);
+    if (A->storage & SPARSE_VALUE_16) {
+        fprintf(stderr,
+                "write_binary_sparse_matrix: 16 bit values can't be written, use SPARSE_VALUE_32\n");
+        exit(1);
+    }
+    if (A->storage & SPARSE_INDEX_DELTA) {
+        fprintf(stderr,
+                "write_binary_sparse_matrix: delta indices can't be written\n");
+        exit(1);
+    }
+    sparse_freeze(A);
+    z = A->frozen;
+
+    index_size = z->col_index32 ? sizeof(int) : sizeof(long int);
+    val_size = z->line_val32 ? sizeof(float) : sizeof(double);
+
+    array[SPARSE_BINARY_LINE_PTR] = z->line_ptr;
+    array[SPARSE_BINARY_COL_INDEX] =
+        z->col_index32 ? (void *) z->col_index32 : (void *) z->col_index;
+    array[SPARSE_BINARY_LINE_VAL] =
+        z->line_val32 ? (void *) z->line_val32 : (void *) z->line_val;
+    array[SPARSE_BINARY_COL_PTR] = z->col_ptr;
+    array[SPARSE_BINARY_LINE_INDEX] =
+        z->line_index32 ? (void *) z->line_index32 : (void *) z->line_index;
+    array[SPARSE_BINARY_COL_VAL] =
+        z->col_val32 ? (void *) z->col_val32 : (void *) z->col_val;
+    size[SPARSE_BINARY_LINE_PTR] = (A->nb_line + 1) * sizeof(long int);
+    size[SPARSE_BINARY_COL_INDEX] = A->nb_item * index_size;
+    size[SPARSE_BINARY_LINE_VAL] = A->nb_item * val_size;
+    size[SPARSE_BINARY_COL_PTR] = (A->nb_col + 1) * sizeof(long int);
+    size[SPARSE_BINARY_LINE_INDEX] = A->nb_item * index_size;
+    size[SPARSE_BINARY_COL_VAL] = A->nb_item * val_size;
+    nb_array = with_col ? SPARSE_BINARY_NB_ARRAY : SPARSE_BINARY_COL_PTR;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SPARSE_BINARY_MAGIC, 8);
+    header.version = SPARSE_BINARY_VERSION;
+    header.endian = SPARSE_BINARY_ENDIAN;
+    header.storage = z->storage;
+    header.flags = with_col ? SPARSE_BINARY_COL : 0;
+    header.nb_line = A->nb_line;
+    header.nb_col = A->nb_col;
+    header.nb_item = A->nb_item;
+    offset = SPARSE_BINARY_HEADER_SIZE;
+    for (k = 0; k < nb_array; k++) {
+        header.offset[k] = offset;
+        offset += sparse_binary_align(size[k]);
+    }
+
+    fprintf(stdout, "writing binary sparse matrix (%p) to '%s' %ld items\n",
+            A, filename, A->nb_item);
+    if (!(fd = fopen(filename, "w"))) {
+        perror(filename);
+        exit(1);
+    }
+    /* header is written again once the checksum is known */
+    memset(block, 0, sizeof(block));
+    if (fwrite(block, 1, sizeof(block), fd) != sizeof(block)) {
+        perror(filename);
+        exit(1);
+    }
+    for (k = 0; k < nb_array; k++) {
+        sparse_binary_write(fd, filename, array[k], size[k], &h);
+    }
+    header.data_checksum = h;
+    header.header_checksum =
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET, &header,
+                               offsetof(struct sparse_binary_header_t,
+                                        header_checksum));
+    memcpy(block, &header, sizeof(header));
+    if (fseeko(fd, 0, SEEK_SET)
+        || fwrite(block, 1, sizeof(block), fd) != sizeof(block)) {
+        perror(filename);
+        exit(1);
+    }
+    fclose(fd);
+}
+
+/** \brief Read a binary sparse matrix file
+
+ The file is mapped read-only and the frozen arrays point into the
+ mapping : nothing is parsed nor copied, values are loaded on first use.
+ line_ptr / col_ptr and the indices are always checked (so a damaged file
+ can't make the products read out of the arrays). Column arrays are built
+ in memory if the file has none. check = 1 also verifies the data
+ checksum (reads the whole file).
+**/
+struct sparse_matrix_t *read_binary_sparse_matrix(char *filename,
+                                                  int check)
+{
+    struct sparse_binary_header_t header;
+
+    struct sparse_matrix_t *a;
+
+    struct sparse_compressed_t *z;
+
+    struct stat st;
+
+    size_t index_size, val_size;
+
+    int64_t end;
+
+    char *map;
+
+    int fd;
+
+    assert(sizeof(long int) == 8);
+    fprintf(stdout, "reading binary sparse matrix from '%s' ... ",
+            filename);
+    fflush(stdout);
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (fstat(fd, &st)) {
+        perror(filename);
+        exit(1);
+    }
+    if (st.st_size < SPARSE_BINARY_HEADER_SIZE) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "read_binary_sparse_matrix: '%s' is not a binary sparse matrix\n",
+                filename);
+        exit(1);
+    }
+    map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        exit(1);
+    }
+    close(fd);
+
+    end = sparse_binary_check_header("read_binary_sparse_matrix", filename,
+                                     map, st.st_size, &header);
+    index_size = (header.storage & SPARSE_INDEX_32) ?
+        sizeof(int) : sizeof(long int);
+    val_size = (header.storage & SPARSE_VALUE_32) ?
+        sizeof(float) : sizeof(double);
+    if (check
+        && header.data_checksum !=
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET,
+                               map + SPARSE_BINARY_HEADER_SIZE,
+                               end - SPARSE_BINARY_HEADER_SIZE)) {
+        fprintf(stdout, "\n");
+        fprintf(stderr, "read_binary_sparse_matrix: '%s' corrupted\n",
+                filename);
+        exit(1);
+    }
+    /* even without the checksum, nothing out of the arrays is read */
+    sparse_binary_check_ptr("read_binary_sparse_matrix", filename,
+                            (long int *) (map +
+                                          header.offset
+                                          [SPARSE_BINARY_LINE_PTR]),
+                            header.nb_line, header.nb_item);
+    sparse_binary_check_index("read_binary_sparse_matrix", filename,
+                              map + header.offset[SPARSE_BINARY_COL_INDEX],
+                              index_size == sizeof(int), header.nb_item,
+                              header.nb_col);
+    if (header.flags & SPARSE_BINARY_COL) {
+        sparse_binary_check_ptr("read_binary_sparse_matrix", filename,
+                                (long int *) (map +
+                                              header.offset
+                                              [SPARSE_BINARY_COL_PTR]),
+                                header.nb_col, header.nb_item);
+        sparse_binary_check_index("read_binary_sparse_matrix", filename,
+                                  map +
+                                  header.offset[SPARSE_BINARY_LINE_INDEX],
+                                  index_size == sizeof(int),
+                                  header.nb_item, header.nb_line);
+    }
+    fprintf(stdout, "(%ldx%ld) %ld items\n", (long int) header.nb_line,
+            (long int) header.nb_col, (long int) header.nb_item);
+    fflush(stdout);
+
+    /* a frozen matrix without any linked item */
+    a = (struct sparse_matrix_t *) calloc(1, sizeof(struct sparse_matrix_t));
+    assert(a);
+    a->nb_line = header.nb_line;
+    a->nb_col = header.nb_col;
+    a->nb_item = header.nb_item;
+    a->storage = header.storage;
+
+    z = (struct sparse_compressed_t *)
+        calloc(1, sizeof(struct sparse_compressed_t));
+    assert(z);
+    z->storage = header.storage;
+    z->map = map;
+    z->map_size = st.st_size;
+    z->line_ptr = (long int *) (map + header.offset[SPARSE_BINARY_LINE_PTR]);
+    if (index_size == sizeof(int)) {
+        z->col_index32 =
+            (int *) (map + header.offset[SPARSE_BINARY_COL_INDEX]);
+    } else {
+        z->col_index =
+            (long int *) (map + header.offset[SPARSE_BINARY_COL_INDEX]);
+    }
+    if (val_size == sizeof(float)) {
+        z->line_val32 =
+            (float *) (map + header.offset[SPARSE_BINARY_LINE_VAL]);
+    } else {
+        z->line_val = (double *) (map + header.offset[SPARSE_BINARY_LINE_VAL]);
+    }
+    a->frozen = z;
+
+    if (!(header.flags & SPARSE_BINARY_COL)) {
+        sparse_freeze_col(a);
+        return (a);
+    }
+    z->col_ptr = (long int *) (map + header.offset[SPARSE_BINARY_COL_PTR]);
+    if (index_size == sizeof(int)) {
+        z->line_index32 =
+            (int *) (map + header.offset[SPARSE_BINARY_LINE_INDEX]);
+    } else {
+        z->line_index =
+            (long int *) (map + header.offset[SPARSE_BINARY_LINE_INDEX]);
+    }
+    if (val_size == sizeof(float)) {
+        z->col_val32 = (float *) (map + header.offset[SPARSE_BINARY_COL_VAL]);
+    } else {
+        z->col_val = (double *) (map + header.offset[SPARSE_BINARY_COL_VAL]);
+    }
+    return (a);
+}
+
+/** \brief Convert a text sparse matrix file (read_sparse_matrix format, or
+ read_ijk_sparse_matrix format if ijk = 1) to a binary one **/
+void sparse_text_to_binary(char *text_filename, int ijk,
+                           char *binary_filename, int storage,
+                           int with_col)
+{
+    struct sparse_matrix_t *a;
+
+    if (ijk) {
+        a = read_ijk_sparse_matrix(text_filename, 0);
+    } else {
+        a = read_sparse_matrix(text_filename, 0);
+    }
+    if ((storage & SPARSE_INDEX_32) &&
+        (a->nb_line > INT_MAX || a->nb_col > INT_MAX)) {
+        fprintf(stderr,
+                "sparse_text_to_binary: (%ldx%ld) too large for 32 bit indices\n",
+                a->nb_line, a->nb_col);
+        exit(1);
+    }
+    a->storage = storage;
+    write_binary_sparse_matrix(a, binary_filename, with_col);
+    free_sparse_matrix(a);
+}
+
+/** \brief Convert a binary sparse matrix file to a text one
+ (write_sparse_matrix format, or write_ijk_sparse_matrix if ijk = 1) **/
+void sparse_binary_to_text(char *binary_filename, int ijk,
+                           char *text_filename)
+{
+    struct sparse_matrix_t *a;
+
+    a = read_binary_sparse_matrix(binary_filename, 1);
+    if (ijk) {
+        write_ijk_sparse_matrix(a, text_filename);
+    } else {
+        write_sparse_matrix(a, text_filename);
+    }
+    free_sparse_matrix(a);
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __SPARSE_BINARY_H__
+#define __SPARSE_BINARY_H__
+
+/*
+ * Binary sparse matrix file :
+ *
+ *   header (struct sparse_binary_header_t, 256 bytes)
+ *   line_ptr    (nb_line + 1) x int64
+ *   col_index   nb_item x int64 or int32 (SPARSE_INDEX_32)
+ *   line_val    nb_item x double or float (SPARSE_VALUE_32)
+ *   col_ptr     (nb_col + 1) x int64          \
+ *   line_index  nb_item x int64 or int32       > only with SPARSE_BINARY_COL
+ *   col_val     nb_item x double or float     /
+ *
+ * Arrays are in host byte order, each one starts on an 8 bytes boundary,
+ * so the file is used in place once mapped. data_checksum covers all the
+ * bytes after the header, header_checksum the header up to itself.
+ */
+
+#define SPARSE_BINARY_MAGIC "SPARSEBM"
+#define SPARSE_BINARY_VERSION 1
+#define SPARSE_BINARY_ENDIAN 0x01020304
+#define SPARSE_BINARY_HEADER_SIZE 256
+
+enum {
+    SPARSE_BINARY_COL = 1
+};
+
+enum {
+    SPARSE_BINARY_LINE_PTR = 0,
+    SPARSE_BINARY_COL_INDEX,
+    SPARSE_BINARY_LINE_VAL,
+    SPARSE_BINARY_COL_PTR,
+    SPARSE_BINARY_LINE_INDEX,
+    SPARSE_BINARY_COL_VAL,
+    SPARSE_BINARY_NB_ARRAY
+};
+
+struct sparse_binary_header_t {
+    char magic[8];
+    int32_t version;
+    uint32_t endian;
+    int32_t storage;
+    int32_t flags;
+    int64_t nb_line;
+    int64_t nb_col;
+    int64_t nb_item;
+    int64_t offset[SPARSE_BINARY_NB_ARRAY];
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+};
+
+/*
+ * Shard file (one row partition, see sparse_shard.c) :
+ *
+ *   header (struct sparse_shard_header_t, 256 bytes)
+ *   col_map     nb_local_col x int64 (global column of each local one,
+ *               increasing)
+ *   line_ptr    (nb_local_line + 1) x int64
+ *   col_index   nb_item x int64 or int32 (SPARSE_INDEX_32), local columns
+ *   line_val    nb_item x double or float (SPARSE_VALUE_32)
+ *
+ * Same alignment, byte order and checksums as the binary matrix file.
+ */
+
+#define SPARSE_SHARD_MAGIC "SPARSESH"
+#define SPARSE_SHARD_VERSION 1
+
+enum {
+    SPARSE_SHARD_COL_MAP = 0,
+    SPARSE_SHARD_LINE_PTR,
+    SPARSE_SHARD_COL_INDEX,
+    SPARSE_SHARD_LINE_VAL,
+    SPARSE_SHARD_NB_ARRAY
+};
+
+struct sparse_shard_header_t {
+    char magic[8];
+    int32_t version;
+    uint32_t endian;
+    int32_t storage;
+    int32_t shard;
+    int32_t nb_shard;
+    int32_t unused;
+    int64_t nb_line;
+    int64_t nb_col;
+    int64_t first_line;
+    int64_t nb_local_line;
+    int64_t nb_local_col;
+    int64_t nb_item;
+    int64_t offset[SPARSE_SHARD_NB_ARRAY];
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+};
+
+#define SPARSE_BINARY_FNV_OFFSET 0xcbf29ce484222325ULL
+#define SPARSE_BINARY_FNV_PRIME 0x100000001b3ULL
+
+uint64_t sparse_binary_checksum(uint64_t h, const void *data, size_t n);
+size_t sparse_binary_align(size_t n);
+void sparse_binary_write(FILE * fd, char *filename, const void *data,
+                         size_t n, uint64_t * h);
+int64_t sparse_binary_check_header(char *caller, char *filename,
+                                   const void *data, off_t size,
+                                   struct sparse_binary_header_t *header);
+void sparse_binary_check_ptr(char *caller, char *filename,
+                             const long int *ptr, long int n,
+                             long int nb_item);
+void sparse_binary_check_index(char *caller, char *filename,
+                               const void *index, int index32, long int n,
+                               long int bound);
+
+#endif
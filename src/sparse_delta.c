@@ -0,0 +1,363 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "sparse.h"
+
+/*
+ * Delta coded line indices (SPARSE_INDEX_DELTA) : columns of a line are
+ * sorted, and close to each other along a ray, so the gaps between them
+ * mostly fit in one or two bytes instead of 4 or 8. Each line has its own
+ * gap width, so decoding a line is a branch free running sum. A*x reads a
+ * quarter or less of the index bandwidth, 8 and 16 bit gaps being decoded
+ * in the dot product kernels (sparse_dot_delta()), wider ones by blocks
+ * before the plain kernels.
+ *
+ * Gaps can only be summed in sequence : each thread keeps a cursor on the
+ * last item it decoded, so walking a line (or consecutive lines) item
+ * after item through SPARSE_LINE_COL() costs one gap per item, other reads
+ * restarting from the beginning of their line.
+ */
+
+/* columns decoded at once before calling the dot product kernels */
+#define SPARSE_DELTA_BLOCK 256
+
+struct sparse_delta_cursor_t {
+    long int id;                /* sparse_delta_t decoded, 0 : none */
+    long int line;              /* line of item k + 1 */
+    long int k;                 /* last item decoded */
+    long int end;               /* end of the line (line_ptr[line + 1]) */
+    long int col;               /* column of item k */
+    int width;                  /* gap width of the line */
+};
+
+static __thread struct sparse_delta_cursor_t sparse_delta_cursor;
+
+static long int sparse_delta_last_id = 0;
+
+/* width of gaps up to g */
+static int sparse_delta_gap_width(unsigned long int g)
+{
+    if (g <= 0xff) {
+        return (1);
+    }
+    if (g <= 0xffff) {
+        return (2);
+    }
+    if (g <= 0xffffffffUL) {
+        return (4);
+    }
+    return (8);
+}
+
+/* write gap g as the q-th gap of width bytes at p */
+static void sparse_delta_put(unsigned char *p, int width, long int q,
+                             unsigned long int g)
+{
+    switch (width) {
+    case 1:
+        p[q] = (unsigned char) g;
+        break;
+    case 2:
+        ((unsigned short *) p)[q] = (unsigned short) g;
+        break;
+    case 4:
+        ((unsigned int *) p)[q] = (unsigned int) g;
+        break;
+    default:
+        ((unsigned long int *) p)[q] = g;
+    }
+}
+
+#define SPARSE_DELTA_SUM(type)                                          \
+    for (q = 0; q < n; q++) {                                           \
+        col += ((const type *) p)[q];                                   \
+        if (index) {                                                    \
+            index[q] = col;                                             \
+        }                                                               \
+    }
+
+/* add the n gaps of width bytes at p to col, storing the columns in index
+   (if not NULL), return the last column */
+static inline long int sparse_delta_sum(const unsigned char *p, int width,
+                                        long int col, long int *index,
+                                        long int n)
+{
+    long int q;
+
+    switch (width) {
+    case 1:
+        SPARSE_DELTA_SUM(unsigned char)
+        break;
+    case 2:
+        SPARSE_DELTA_SUM(unsigned short)
+        break;
+    case 4:
+        SPARSE_DELTA_SUM(unsigned int)
+        break;
+    default:
+        SPARSE_DELTA_SUM(unsigned long int)
+    }
+    return (col);
+}
+
+/** \brief Replace the column indices of the lines of frozen m by their
+ delta coding (see struct sparse_delta_t)
+
+ Called by sparse_freeze() with SPARSE_INDEX_DELTA storage. Lines are
+ coded in parallel, a line having unsorted columns stops the program.
+**/
+void sparse_delta_encode(struct sparse_matrix_t *m)
+{
+    struct sparse_compressed_t *z = m->frozen;
+
+    struct sparse_delta_t *d;
+
+    long int i, nb_line = m->nb_line;
+
+    int nt;
+
+    assert(z && !z->line_delta);
+    d = (struct sparse_delta_t *) malloc(sizeof(struct sparse_delta_t));
+    assert(d);
+    d->nb_line = nb_line;
+    d->first = (long int *) malloc((nb_line + 1) * sizeof(long int));
+    d->byte_ptr = (long int *) malloc((nb_line + 1) * sizeof(long int));
+    d->width = (unsigned char *) malloc(nb_line + 1);
+    assert(d->first && d->byte_ptr && d->width);
+#pragma omp atomic capture
+    d->id = ++sparse_delta_last_id;
+
+    /* pass 1 : first column and gap width per line, pass 2 : gaps */
+    nt = sparse_work_nb_thread(m->nb_item);
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(dynamic, 1024)
+    for (i = 0; i < nb_line; i++) {
+        long int k, j, prev = -1, max_gap = 0;
+
+        for (k = z->line_ptr[i]; k < z->line_ptr[i + 1]; k++) {
+            j = SPARSE_LINE_COL(z, k);
+            if (j <= prev) {
+                fprintf(stderr,
+                        "sparse_delta_encode: line %ld of (%p) not sorted\n",
+                        i, m);
+                exit(1);
+            }
+            if (prev >= 0 && j - prev > max_gap) {
+                max_gap = j - prev;
+            }
+            prev = j;
+        }
+        k = z->line_ptr[i + 1] - z->line_ptr[i];
+        d->first[i] = k ? SPARSE_LINE_COL(z, z->line_ptr[i]) : 0;
+        d->width[i] = k > 1 ? sparse_delta_gap_width(max_gap) : 1;
+    }
+    /* gaps of each line aligned on their width */
+    d->byte_ptr[0] = 0;
+    for (i = 0; i < nb_line; i++) {
+        long int w = d->width[i];
+
+        d->byte_ptr[i] = (d->byte_ptr[i] + w - 1) / w * w;
+        d->byte_ptr[i + 1] = d->byte_ptr[i] + w *
+            (z->line_ptr[i + 1] > z->line_ptr[i] ?
+             z->line_ptr[i + 1] - z->line_ptr[i] - 1 : 0);
+    }
+    d->code = (unsigned char *) malloc(d->byte_ptr[nb_line] + 8);
+    assert(d->code);
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(dynamic, 1024)
+    for (i = 0; i < nb_line; i++) {
+        long int k, j, prev = d->first[i];
+
+        for (k = z->line_ptr[i] + 1; k < z->line_ptr[i + 1]; k++) {
+            j = SPARSE_LINE_COL(z, k);
+            sparse_delta_put(d->code + d->byte_ptr[i], d->width[i],
+                             k - 1 - z->line_ptr[i], j - prev);
+            prev = j;
+        }
+    }
+    z->line_delta = d;
+
+    free(z->col_index);
+    free(z->col_index32);
+    z->col_index = NULL;
+    z->col_index32 = NULL;
+
+    fprintf(stdout, "delta index sparse matrix (%p): %ld bytes for %ld items\n",
+            m, d->byte_ptr[nb_line], m->nb_item);
+    fflush(stdout);
+}
+
+void sparse_delta_free(struct sparse_delta_t *d)
+{
+    if (!d) {
+        return;
+    }
+    free(d->first);
+    free(d->byte_ptr);
+    free(d->width);
+    free(d->code);
+    free(d);
+}
+
+/** \brief bytes used by the delta coded indices of z (0 if none) **/
+long int sparse_delta_bytes(struct sparse_compressed_t *z)
+{
+    struct sparse_delta_t *d = z->line_delta;
+
+    if (!d) {
+        return (0);
+    }
+    return (d->byte_ptr[d->nb_line] + d->nb_line
+            + 2 * (d->nb_line + 1) * sizeof(long int));
+}
+
+/* move the cursor of this thread just before item k of z */
+static struct sparse_delta_cursor_t *
+sparse_delta_seek(struct sparse_compressed_t *z, long int k)
+{
+    struct sparse_delta_cursor_t *c = &sparse_delta_cursor;
+
+    struct sparse_delta_t *d = z->line_delta;
+
+    long int lo, hi, mid, start;
+
+    if (c->id == d->id && k == c->k + 1 && k == c->end) {
+        /* first item of the next non empty line */
+        do {
+            c->line++;
+        } while (z->line_ptr[c->line + 1] <= k);
+        c->end = z->line_ptr[c->line + 1];
+        c->width = d->width[c->line];
+        return (c);
+    }
+    if (c->id != d->id || k <= c->k || k >= c->end) {
+        /* restart at the beginning of the line ending after k */
+        lo = 0;
+        hi = d->nb_line - 1;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (z->line_ptr[mid + 1] <= k) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        c->id = d->id;
+        c->line = lo;
+        c->k = z->line_ptr[lo] - 1;
+        c->end = z->line_ptr[lo + 1];
+        c->width = d->width[lo];
+    }
+    if (c->k + 1 < k) {
+        start = z->line_ptr[c->line];
+        if (c->k < start) {
+            c->col = d->first[c->line];
+            c->k = start;
+        }
+        c->col = sparse_delta_sum(d->code + d->byte_ptr[c->line]
+                                  + (c->k - start) * c->width, c->width,
+                                  c->col, NULL, k - 1 - c->k);
+        c->k = k - 1;
+    }
+    return (c);
+}
+
+/** \brief column of item k of the lines of z, delta coded (see
+ SPARSE_LINE_COL()) **/
+long int sparse_delta_col(struct sparse_compressed_t *z, long int k)
+{
+    struct sparse_delta_cursor_t *c = &sparse_delta_cursor;
+
+    struct sparse_delta_t *d = z->line_delta;
+
+    long int start;
+
+    if (c->id == d->id && k == c->k) {
+        return (c->col);
+    }
+    c = sparse_delta_seek(z, k);
+    start = z->line_ptr[c->line];
+    if (k == start) {
+        c->col = d->first[c->line];
+    } else {
+        c->col = sparse_delta_sum(d->code + d->byte_ptr[c->line]
+                                  + (k - 1 - start) * c->width, c->width,
+                                  c->col, NULL, 1);
+    }
+    c->k = k;
+    return (c->col);
+}
+
+/* dot product of x with n items of the line values, from item k, columns
+   being in index (plain kernels) */
+static double sparse_delta_dot_block(struct sparse_compressed_t *z,
+                                     const long int *index, long int k,
+                                     long int n, const double *x)
+{
+    if (z->line_val16) {
+        return (sparse_dot_value16(index, z->line_val16 + k, x, n,
+                                   z->storage));
+    }
+    if (z->line_val32) {
+        return (sparse_dot_value32(index, z->line_val32 + k, x, n));
+    }
+    return (sparse_dot(index, z->line_val + k, x, n));
+}
+
+/** \brief dot product of x with the items [k, k+n) of the frozen lines of
+ z, delta coded, all in the same line. 16 bit values are not scaled. **/
+double sparse_delta_dot(struct sparse_compressed_t *z, long int k,
+                        long int n, const double *x)
+{
+    struct sparse_delta_cursor_t *c;
+
+    struct sparse_delta_t *d = z->line_delta;
+
+    long int index[SPARSE_DELTA_BLOCK];
+
+    long int l, q, b, start, col;
+
+    double sum = 0.;
+
+    if (n <= 0) {
+        return (0.);
+    }
+    c = sparse_delta_seek(z, k);
+    assert(k + n <= c->end);
+    start = z->line_ptr[c->line];
+    col = c->col;
+    if (c->width <= 2) {
+        /* first item of the line, then the gaps from it */
+        if (k == start) {
+            col = d->first[c->line];
+            sum = sparse_delta_dot_block(z, &col, k, 1, x);
+        }
+        l = (k == start);
+        sum += sparse_dot_delta(c->width, d->code + d->byte_ptr[c->line]
+                                + (k + l - 1 - start) * c->width, &col,
+                                z->line_val16 ?
+                                (void *) (z->line_val16 + k + l) :
+                                z->line_val32 ?
+                                (void *) (z->line_val32 + k + l) :
+                                (void *) (z->line_val + k + l),
+                                z->storage, x, n - l);
+        c->k = k + n - 1;
+        c->col = col;
+        return (sum);
+    }
+    for (l = 0; l < n; l += b) {
+        b = (n - l < SPARSE_DELTA_BLOCK) ? n - l : SPARSE_DELTA_BLOCK;
+        q = 0;
+        if (k + l == start) {
+            col = d->first[c->line];
+            index[0] = col;
+            q = 1;
+        }
+        col = sparse_delta_sum(d->code + d->byte_ptr[c->line]
+                               + (k + l + q - 1 - start) * c->width,
+                               c->width, col, index + q, b - q);
+        sum += sparse_delta_dot_block(z, index, k + l, b, x);
+    }
+    c->k = k + n - 1;
+    c->col = col;
+    return (sum);
+}
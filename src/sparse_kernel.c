@@ -0,0 +1,645 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "sparse.h"
+
+/* under this number of items per thread, threads are not worth it */
+#define SPARSE_MIN_ITEM_PER_THREAD 16384
+
+static int sparse_nb_thread = 0;
+
+/** \brief set the number of threads used by the kernels (0 = OpenMP
+ default, OMP_NUM_THREADS) **/
+void sparse_set_nb_thread(int nb_thread)
+{
+    sparse_nb_thread = nb_thread;
+}
+
+int sparse_get_nb_thread(void)
+{
+#ifdef _OPENMP
+    if (sparse_nb_thread > 0) {
+        return (sparse_nb_thread);
+    }
+    return (omp_get_max_threads());
+#else
+    return (1);
+#endif
+}
+
+/* number of threads worth using for nb_item items */
+int sparse_work_nb_thread(long int nb_item)
+{
+    long int nt;
+
+    nt = sparse_get_nb_thread();
+    if (nt > nb_item / SPARSE_MIN_ITEM_PER_THREAD) {
+        nt = nb_item / SPARSE_MIN_ITEM_PER_THREAD;
+    }
+    if (nt < 1) {
+        nt = 1;
+    }
+    return ((int) nt);
+}
+
+int sparse_thread_id(void)
+{
+#ifdef _OPENMP
+    return (omp_get_thread_num());
+#else
+    return (0);
+#endif
+}
+
+/** \brief split [0, n) in nb_part ranges holding about the same number of
+ items, ptr being a line_ptr/col_ptr like array (n+1 entries).
+
+ Part p is [sparse_balanced_split(ptr, n, p, nb_part),
+            sparse_balanced_split(ptr, n, p + 1, nb_part)).
+**/
+long int sparse_balanced_split(const long int *ptr, long int n, long int p,
+                               long int nb_part)
+{
+    long int target, lo, hi, mid;
+
+    if (p <= 0) {
+        return (0);
+    }
+    if (p >= nb_part) {
+        return (n);
+    }
+    target = ptr[0] + (ptr[n] - ptr[0]) / nb_part * p
+        + (ptr[n] - ptr[0]) % nb_part * p / nb_part;
+
+    /* first i such as ptr[i] >= target */
+    lo = 0;
+    hi = n;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ptr[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo);
+}
+
+/** \brief dot product of x with the items [k, k+n) of raw index / value
+ arrays, whose widths are given by storage (see sparse_simd.c). 16 bit
+ values are not scaled. **/
+double sparse_dot_storage(int storage, const void *index, const void *val,
+                          long int k, long int n, const double *x)
+{
+    if (storage & SPARSE_VALUE_16) {
+        if (storage & SPARSE_INDEX_32) {
+            return (sparse_dot_index32_value16((const int *) index + k,
+                                               (const unsigned short *) val
+                                               + k, x, n, storage));
+        }
+        return (sparse_dot_value16((const long int *) index + k,
+                                   (const unsigned short *) val + k, x, n,
+                                   storage));
+    }
+    /* the delta flag only concerns the lines, index is always plain here */
+    switch (storage & (SPARSE_INDEX_32 | SPARSE_VALUE_32)) {
+    case SPARSE_INDEX_32:
+        return (sparse_dot_index32((const int *) index + k,
+                                   (const double *) val + k, x, n));
+    case SPARSE_VALUE_32:
+        return (sparse_dot_value32((const long int *) index + k,
+                                   (const float *) val + k, x, n));
+    case SPARSE_INDEX_32 | SPARSE_VALUE_32:
+        return (sparse_dot_index32_value32((const int *) index + k,
+                                           (const float *) val + k, x,
+                                           n));
+    default:
+        return (sparse_dot((const long int *) index + k,
+                           (const double *) val + k, x, n));
+    }
+}
+
+/** \brief dot product of x with the items [k, k+n) of the frozen lines
+ (line = 1) or columns (line = 0) **/
+double sparse_frozen_dot(struct sparse_compressed_t *z, int line,
+                         long int k, long int n, const double *x)
+{
+    const void *index, *val;
+
+    if (line && z->line_delta) {
+        return ((z->storage & SPARSE_VALUE_16) ?
+                z->val_scale * sparse_delta_dot(z, k, n, x) :
+                sparse_delta_dot(z, k, n, x));
+    }
+    if (line) {
+        index = z->col_index32 ? (void *) z->col_index32 : z->col_index;
+        val = z->line_val32 ? (void *) z->line_val32 : z->line_val;
+        if (z->storage & SPARSE_VALUE_16) {
+            val = z->line_val16;
+        }
+    } else {
+        index = z->line_index32 ? (void *) z->line_index32 : z->line_index;
+        val = z->col_val32 ? (void *) z->col_val32 : z->col_val;
+        if (z->storage & SPARSE_VALUE_16) {
+            val = z->col_val16;
+        }
+    }
+    if (z->storage & SPARSE_VALUE_16) {
+        return (z->val_scale *
+                sparse_dot_storage(z->storage, index, val, k, n, x));
+    }
+    return (sparse_dot_storage(z->storage, index, val, k, n, x));
+}
+
+/** \brief value of a 16 bit frozen item **/
+double sparse_frozen_val16(struct sparse_compressed_t *z, unsigned short h)
+{
+    return (z->val_scale * sparse_value16_to_double(h, z->storage));
+}
+
+/* y[first..last) += A[first..last) * x */
+static void sparse_mult_lines(struct sparse_compressed_t *z,
+                              long int first, long int last,
+                              const double *x, double *y)
+{
+    const long int *line_ptr = z->line_ptr;
+
+    long int i;
+
+    for (i = first; i < last; i++) {
+        y[i] += sparse_frozen_dot(z, 1, line_ptr[i],
+                                  line_ptr[i + 1] - line_ptr[i], x);
+    }
+}
+
+/* x[first..last) += A^T[first..last) * y, using the columns */
+static void sparse_trans_mult_cols(struct sparse_compressed_t *z,
+                                   long int first, long int last,
+                                   const double *y, double *x)
+{
+    const long int *col_ptr = z->col_ptr;
+
+    long int j;
+
+    for (j = first; j < last; j++) {
+        x[j] += sparse_frozen_dot(z, 0, col_ptr[j],
+                                  col_ptr[j + 1] - col_ptr[j], y);
+    }
+}
+
+/** \brief y = y + A*x
+
+ Uses the tiled lines if built (see sparse_tile()), the compressed line
+ arrays if A is frozen, lines being shared among threads by number of
+ items, the linked lines otherwise.
+**/
+void sparse_mult_vector(struct sparse_matrix_t *A, struct vector_t *x,
+                        struct vector_t *y)
+{
+    long int i;
+
+    double sum;
+
+    struct sparse_item_t *cur_item;
+
+    assert(x->length == A->nb_col);
+    assert(y->length == A->nb_line);
+
+    if (A->frozen && A->frozen->line_tile) {
+        sparse_tile_mult(A->frozen, A->frozen->line_tile, x->mat, y->mat);
+        return;
+    }
+    if (A->frozen) {
+        int t, nt = sparse_work_nb_thread(A->nb_item);
+
+        /* nt parts whatever the size of the team OpenMP gives */
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            sparse_mult_lines(A->frozen,
+                              sparse_balanced_split(A->frozen->line_ptr,
+                                                    A->nb_line, t, nt),
+                              sparse_balanced_split(A->frozen->line_ptr,
+                                                    A->nb_line, t + 1, nt),
+                              x->mat, y->mat);
+        }
+        return;
+    }
+
+    for (i = 0; i < A->nb_line; i++) {
+        sum = 0.;
+        cur_item = A->line[i];
+        while (cur_item) {
+            sum += cur_item->val * x->mat[cur_item->col_index];
+            cur_item = cur_item->next_in_line;
+        }
+        y->mat[i] += sum;
+    }
+}
+
+/** \brief x = x + A^T*y
+
+ Uses the tiled columns if built (see sparse_tile()), the compressed
+ column arrays if A is frozen (gather, x written once, so columns are
+ shared among threads without conflict), the linked lines otherwise
+ (column links are not always built).
+**/
+void sparse_trans_mult_vector(struct sparse_matrix_t *A,
+                              struct vector_t *y, struct vector_t *x)
+{
+    long int i;
+
+    double yi;
+
+    struct sparse_item_t *cur_item;
+
+    assert(x->length == A->nb_col);
+    assert(y->length == A->nb_line);
+
+    if (A->frozen && A->frozen->col_tile) {
+        sparse_tile_mult(A->frozen, A->frozen->col_tile, y->mat, x->mat);
+        return;
+    }
+    if (A->frozen) {
+        int t, nt = sparse_work_nb_thread(A->nb_item);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1)
+        for (t = 0; t < nt; t++) {
+            sparse_trans_mult_cols(A->frozen,
+                                   sparse_balanced_split(A->frozen->col_ptr,
+                                                         A->nb_col, t, nt),
+                                   sparse_balanced_split(A->frozen->col_ptr,
+                                                         A->nb_col, t + 1,
+                                                         nt), y->mat,
+                                   x->mat);
+        }
+        return;
+    }
+
+    for (i = 0; i < A->nb_line; i++) {
+        yi = y->mat[i];
+        if (yi == 0.) {
+            continue;
+        }
+        cur_item = A->line[i];
+        while (cur_item) {
+            x->mat[cur_item->col_index] += cur_item->val * yi;
+            cur_item = cur_item->next_in_line;
+        }
+    }
+}
+
+/** \brief lsqr style product :
+
+ mode = 1 : y = y + A*x
+ mode = 2 : x = x + A^T*y
+**/
+void sparse_aprod(int mode, struct sparse_matrix_t *A, struct vector_t *x,
+                  struct vector_t *y)
+{
+    if (mode == 1) {
+        sparse_mult_vector(A, x, y);
+    } else if (mode == 2) {
+        sparse_trans_mult_vector(A, y, x);
+    } else {
+        fprintf(stderr, "sparse_aprod: unknown mode %d\n", mode);
+        exit(1);
+    }
+}
+
+/* column accumulators of a thread (NULL if not requested) */
+struct sparse_reduce_col_t {
+    double *sq;
+    double *count;
+    double *sum;
+};
+
+/* line statistics of lines [first..last), column ones into c */
+static void sparse_reduce_lines(struct sparse_matrix_t *A,
+                                struct sparse_reduce_t *r,
+                                struct sparse_reduce_col_t *c,
+                                long int first, long int last)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    struct sparse_item_t *cur_item;
+
+    long int i, j, k, count;
+
+    double v, sq, sum;
+
+    for (i = first; i < last; i++) {
+        sq = sum = 0.;
+        count = 0;
+        k = z ? z->line_ptr[i] : 0;
+        cur_item = z ? NULL : A->line[i];
+        while (z ? k < z->line_ptr[i + 1] : cur_item != NULL) {
+            if (z) {
+                j = SPARSE_LINE_COL(z, k);
+                v = SPARSE_LINE_VAL(z, k);
+                k++;
+            } else {
+                j = cur_item->col_index;
+                v = cur_item->val;
+                cur_item = cur_item->next_in_line;
+            }
+            sq += v * v;
+            sum += v;
+            count++;
+            if (c->sq) {
+                c->sq[j] += v * v;
+            }
+            if (c->count) {
+                c->count[j] += 1.;
+            }
+            if (c->sum) {
+                c->sum[j] += v;
+            }
+        }
+        if (r->line_norm) {
+            r->line_norm->mat[i] = sqrt(sq);
+        }
+        if (r->line_count) {
+            r->line_count->mat[i] = (double) count;
+        }
+        if (r->line_sum) {
+            r->line_sum->mat[i] = sum;
+        }
+    }
+}
+
+/** \brief Compute the line / column statistics given by what
+ (SPARSE_REDUCE_* flags) in one sweep over the items of A
+
+ Requested vectors are allocated into r, the others are NULL (see
+ sparse_free_reduce()). Lines are split in parts shared among threads,
+ each part accumulating the columns apart, partial columns are summed at
+ the end.
+**/
+void sparse_reduce(struct sparse_matrix_t *A, int what,
+                   struct sparse_reduce_t *r)
+{
+    struct sparse_reduce_col_t *col;
+
+    long int j;
+
+    int nt, t;
+
+    memset(r, 0, sizeof(struct sparse_reduce_t));
+    if (what & SPARSE_REDUCE_LINE_NORM) {
+        r->line_norm = new_vector(A->nb_line);
+    }
+    if (what & SPARSE_REDUCE_LINE_COUNT) {
+        r->line_count = new_vector(A->nb_line);
+    }
+    if (what & SPARSE_REDUCE_LINE_SUM) {
+        r->line_sum = new_vector(A->nb_line);
+    }
+    if (what & SPARSE_REDUCE_COL_NORM) {
+        r->col_norm = new_vector(A->nb_col);
+    }
+    if (what & SPARSE_REDUCE_COL_COUNT) {
+        r->col_count = new_vector(A->nb_col);
+    }
+    if (what & SPARSE_REDUCE_COL_SUM) {
+        r->col_sum = new_vector(A->nb_col);
+    }
+    if (what & SPARSE_REDUCE_ATA_DIAG) {
+        r->ata_diag = new_vector(A->nb_col);
+    }
+
+    /* part 0 accumulates into the results, the others apart */
+    nt = sparse_work_nb_thread(A->nb_item);
+    col = (struct sparse_reduce_col_t *)
+        calloc(nt, sizeof(struct sparse_reduce_col_t));
+    assert(col);
+    col[0].sq = r->ata_diag ? r->ata_diag->mat :
+        r->col_norm ? r->col_norm->mat : NULL;
+    col[0].count = r->col_count ? r->col_count->mat : NULL;
+    col[0].sum = r->col_sum ? r->col_sum->mat : NULL;
+    for (t = 1; t < nt; t++) {
+        if (col[0].sq) {
+            col[t].sq = (double *) calloc(A->nb_col, sizeof(double));
+            assert(col[t].sq || !A->nb_col);
+        }
+        if (col[0].count) {
+            col[t].count = (double *) calloc(A->nb_col, sizeof(double));
+            assert(col[t].count || !A->nb_col);
+        }
+        if (col[0].sum) {
+            col[t].sum = (double *) calloc(A->nb_col, sizeof(double));
+            assert(col[t].sum || !A->nb_col);
+        }
+    }
+
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        long int first, last, c;
+
+        int id, p;
+
+        /* nt parts whatever the size of the team */
+#pragma omp for schedule(static, 1)
+        for (id = 0; id < nt; id++) {
+            if (A->frozen) {
+                first = sparse_balanced_split(A->frozen->line_ptr,
+                                              A->nb_line, id, nt);
+                last = sparse_balanced_split(A->frozen->line_ptr,
+                                             A->nb_line, id + 1, nt);
+            } else {
+                first = A->nb_line * id / nt;
+                last = A->nb_line * (id + 1) / nt;
+            }
+            sparse_reduce_lines(A, r, &col[id], first, last);
+        }
+
+        if (nt > 1) {
+#pragma omp for
+            for (c = 0; c < A->nb_col; c++) {
+                for (p = 1; p < nt; p++) {
+                    if (col[0].sq) {
+                        col[0].sq[c] += col[p].sq[c];
+                    }
+                    if (col[0].count) {
+                        col[0].count[c] += col[p].count[c];
+                    }
+                    if (col[0].sum) {
+                        col[0].sum[c] += col[p].sum[c];
+                    }
+                }
+            }
+        }
+    }
+
+    for (t = 1; t < nt; t++) {
+        free(col[t].sq);
+        free(col[t].count);
+        free(col[t].sum);
+    }
+    free(col);
+
+    if (r->col_norm) {
+        for (j = 0; j < A->nb_col; j++) {
+            r->col_norm->mat[j] = sqrt(r->ata_diag ?
+                                       r->ata_diag->mat[j] :
+                                       r->col_norm->mat[j]);
+        }
+    }
+}
+
+void sparse_free_reduce(struct sparse_reduce_t *r)
+{
+    struct vector_t *v[] = {
+        r->line_norm, r->line_count, r->line_sum, r->col_norm,
+        r->col_count, r->col_sum, r->ata_diag
+    };
+
+    int k;
+
+    for (k = 0; k < (int) (sizeof(v) / sizeof(struct vector_t *)); k++) {
+        if (v[k]) {
+            free_vector(v[k]);
+        }
+    }
+    memset(r, 0, sizeof(struct sparse_reduce_t));
+}
+
+/* query k on item (i[k], j[k]) */
+struct sparse_query_t {
+    long int line;
+    long int col;
+    long int pos;
+};
+
+static int sparse_query_cmp(const void *a, const void *b)
+{
+    const struct sparse_query_t *u = a, *v = b;
+
+    if (u->line != v->line) {
+        return (u->line < v->line ? -1 : 1);
+    }
+    if (u->col != v->col) {
+        return (u->col < v->col ? -1 : 1);
+    }
+    return (u->pos < v->pos ? -1 : u->pos > v->pos);
+}
+
+/* stable counting sort of the queries in (0..n-1 if NULL) on key (in
+   [0, nb)) into out */
+static void sparse_query_count_sort(long int nb, const long int *key,
+                                    long int n, const long int *in,
+                                    long int *out)
+{
+    long int *count;
+
+    long int k, q;
+
+    count = (long int *) calloc(nb + 1, sizeof(long int));
+    assert(count);
+    for (k = 0; k < n; k++) {
+        count[key[k] + 1]++;
+    }
+    for (k = 0; k < nb; k++) {
+        count[k + 1] += count[k];
+    }
+    for (k = 0; k < n; k++) {
+        q = in ? in[k] : k;
+        out[count[key[q]]++] = q;
+    }
+    free(count);
+}
+
+/** \brief val[k] = A(i[k], j[k]) for k in [0, n)
+
+ Queries are sorted by line and column (two counting sorts, or a full
+ sort if A has more lines or columns than queries), then shared among
+ threads : a frozen line is binary searched, a linked line is walked once
+ for its increasing queries.
+**/
+void sparse_get_values(struct sparse_matrix_t *A, long int n,
+                       const long int *i, const long int *j, double *val)
+{
+    long int *order;
+
+    long int k;
+
+    int nt, t, sorted = 1;
+
+    order = (long int *) malloc(n * sizeof(long int));
+    assert(order || !n);
+    for (k = 0; k < n; k++) {
+        assert(i[k] >= 0 && i[k] < A->nb_line);
+        assert(j[k] >= 0 && j[k] < A->nb_col);
+        if (k > 0 && (i[k] < i[k - 1]
+                      || (i[k] == i[k - 1] && j[k] < j[k - 1]))) {
+            sorted = 0;
+        }
+    }
+
+    if (sorted) {
+        for (k = 0; k < n; k++) {
+            order[k] = k;
+        }
+    } else if (A->nb_line <= n && A->nb_col <= n) {
+        long int *by_col;
+
+        /* columns first, the line sort keeping them in order */
+        by_col = (long int *) malloc(n * sizeof(long int));
+        assert(by_col);
+        sparse_query_count_sort(A->nb_col, j, n, NULL, by_col);
+        sparse_query_count_sort(A->nb_line, i, n, by_col, order);
+        free(by_col);
+    } else {
+        struct sparse_query_t *query;
+
+        query = (struct sparse_query_t *)
+            malloc(n * sizeof(struct sparse_query_t));
+        assert(query);
+        for (k = 0; k < n; k++) {
+            query[k].line = i[k];
+            query[k].col = j[k];
+            query[k].pos = k;
+        }
+        qsort(query, n, sizeof(struct sparse_query_t), sparse_query_cmp);
+        for (k = 0; k < n; k++) {
+            order[k] = query[k].pos;
+        }
+        free(query);
+    }
+
+    nt = sparse_work_nb_thread(n);
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1)
+    for (t = 0; t < nt; t++) {
+        long int first = n / nt * t + (n % nt) * t / nt;
+
+        long int last = n / nt * (t + 1) + (n % nt) * (t + 1) / nt;
+
+        struct sparse_item_t *cur_item = NULL;
+
+        long int p, q, line = -1, col = -1;
+
+        for (p = first; p < last; p++) {
+            q = order[p];
+            if (A->frozen) {
+                val[q] = sparse_get_value(A, i[q], j[q]);
+                continue;
+            }
+            /* walk from the line head again if the column goes back */
+            if (i[q] != line || j[q] < col) {
+                line = i[q];
+                cur_item = A->line[line];
+            }
+            col = j[q];
+            while (cur_item && cur_item->col_index < col) {
+                cur_item = cur_item->next_in_line;
+            }
+            val[q] = (cur_item && cur_item->col_index == col) ?
+                cur_item->val : 0.;
+        }
+    }
+    free(order);
+}
@@ -0,0 +1,732 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "sparse.h"
+#include "reader.h"
+
+/* under this number of bytes per thread, the file is read serially */
+#define SPARSE_LOAD_MIN_CHUNK (4L * 1024 * 1024)
+
+/* records parsed by one thread */
+struct sparse_block_t {
+    long int nb_record;
+    long int nb_item;
+    long int max_record;
+    long int max_item;
+    long int *rayid;
+    long int *ptr;              /* items of record r : ptr[r] .. ptr[r+1]-1 */
+    long int *col;
+    double *val;
+    int ordered;                /* increasing lines and columns */
+    int error;
+    off_t end;                  /* where the parsing stopped */
+};
+
+static void sparse_block_add_record(struct sparse_block_t *b, long int rayid)
+{
+    if (b->nb_record + 1 >= b->max_record) {
+        b->max_record = 2 * b->max_record + 1024;
+        b->rayid = (long int *) realloc(b->rayid,
+                                        b->max_record * sizeof(long int));
+        assert(b->rayid);
+        b->ptr = (long int *) realloc(b->ptr,
+                                      (b->max_record + 1) *
+                                      sizeof(long int));
+        assert(b->ptr);
+    }
+    b->rayid[b->nb_record] = rayid;
+    b->ptr[b->nb_record] = b->nb_item;
+    b->nb_record++;
+    b->ptr[b->nb_record] = b->nb_item;
+}
+
+static void sparse_block_add_item(struct sparse_block_t *b, long int col,
+                                  double val)
+{
+    if (b->nb_item >= b->max_item) {
+        b->max_item = 2 * b->max_item + 65536;
+        b->col = (long int *) realloc(b->col,
+                                      b->max_item * sizeof(long int));
+        assert(b->col);
+        b->val = (double *) realloc(b->val, b->max_item * sizeof(double));
+        assert(b->val);
+    }
+    b->col[b->nb_item] = col;
+    b->val[b->nb_item] = val;
+    b->nb_item++;
+    b->ptr[b->nb_record] = b->nb_item;
+}
+
+static void sparse_block_free(struct sparse_block_t *b)
+{
+    free(b->rayid);
+    free(b->ptr);
+    free(b->col);
+    free(b->val);
+}
+
+/*
+ * is there a "rayid nb_item" header alone on its line, followed by its
+ * nb_item items ?
+ */
+static int sparse_load_is_record(struct reader_t *r, long int m, long int n)
+{
+    long int rayid, nb_item, j, index;
+
+    double val;
+
+    if (!reader_long(r, &rayid) || reader_end_of_line(r)
+        || !reader_long(r, &nb_item) || !reader_end_of_line(r)) {
+        return (0);
+    }
+    if (rayid < 0 || rayid >= m || nb_item < 0) {
+        return (0);
+    }
+    for (j = 0; j < nb_item; j++) {
+        if (!reader_long(r, &index) || !reader_double(r, &val)
+            || index < 0 || index >= n) {
+            return (0);
+        }
+    }
+    return (reader_end_of_line(r));
+}
+
+/*
+ * offset of the first record starting on a line after offset, checked by
+ * parsing it and the next one (file size if none). A wrong guess is caught
+ * later : the previous thread must stop exactly there.
+ */
+static off_t sparse_load_sync(char *filename, off_t offset, off_t size,
+                              long int m, long int n)
+{
+    struct reader_t *r;
+
+    off_t pos;
+
+    r = reader_open_at(filename, offset);
+    reader_skip_line(r);
+    while (!reader_eof(r)) {
+        pos = reader_tell(r);
+        if (sparse_load_is_record(r, m, n)
+            && (reader_eof(r) || sparse_load_is_record(r, m, n))) {
+            reader_close(r);
+            return (pos);
+        }
+        if (!reader_skip_line(r)) {
+            break;
+        }
+    }
+    reader_close(r);
+    return (size);
+}
+
+/* parse the records from the current position of r up to stop (to the
+   end of the file if stop < 0) */
+static void sparse_load_records(struct reader_t *r, off_t stop,
+                                long int m, long int n,
+                                struct sparse_block_t *b)
+{
+    long int rayid, nb_item, index, j, last_rayid = -1, last_col;
+
+    double val;
+
+    int nb_read;
+
+    b->ordered = 1;
+    while (!reader_eof(r) && (stop < 0 || reader_tell(r) < stop)) {
+        nb_read = reader_long(r, &rayid);
+        nb_read += (nb_read == 1) && reader_long(r, &nb_item);
+        if (nb_read != 2 || rayid < 0 || rayid >= m || nb_item < 0) {
+            b->error = 1;
+            break;
+        }
+        if (rayid <= last_rayid) {
+            b->ordered = 0;
+        }
+        last_rayid = rayid;
+        sparse_block_add_record(b, rayid);
+
+        last_col = -1;
+        for (j = 0; j < nb_item; j++) {
+            nb_read = reader_long(r, &index);
+            nb_read += (nb_read == 1) && reader_double(r, &val);
+            if (nb_read != 2) {
+                if (!reader_eof(r)) {
+                    b->error = 1;
+                }
+                break;
+            }
+            if (index < 0 || index >= n) {
+                b->error = 1;
+                break;
+            }
+            if (index <= last_col) {
+                b->ordered = 0;
+            }
+            last_col = index;
+            sparse_block_add_item(b, index, val);
+        }
+        if (b->error) {
+            break;
+        }
+    }
+    b->end = reader_tell(r);
+}
+
+/* parse the records starting in [start, stop) */
+static void sparse_load_block(char *filename, off_t start, off_t stop,
+                              long int m, long int n,
+                              struct sparse_block_t *b)
+{
+    struct reader_t *r;
+
+    r = reader_open_at(filename, start);
+    sparse_load_records(r, stop, m, n, b);
+    reader_close(r);
+}
+
+/* link the items of ordered blocks, each block holds its own lines */
+static void sparse_load_stitch(struct sparse_matrix_t *a,
+                               struct sparse_block_t *block, int nt)
+{
+    struct sparse_item_t *items;
+
+    long int *first;
+
+    long int total = 0;
+
+    int t;
+
+    first = (long int *) malloc((nt + 1) * sizeof(long int));
+    assert(first);
+    for (t = 0; t < nt; t++) {
+        first[t] = total;
+        total += block[t].nb_item;
+    }
+    first[nt] = total;
+    items = sparse_new_items(a, total);
+
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+    for (t = 0; t < nt; t++) {
+        struct sparse_block_t *b = &block[t];
+
+        struct sparse_item_t *item = items + first[t];
+
+        long int rec, kk;
+
+        for (rec = 0; rec < b->nb_record; rec++) {
+            if (b->ptr[rec] == b->ptr[rec + 1]) {
+                continue;
+            }
+            a->line[b->rayid[rec]] = item;
+            for (kk = b->ptr[rec]; kk < b->ptr[rec + 1]; kk++) {
+                item->line_index = b->rayid[rec];
+                item->col_index = b->col[kk];
+                item->val = b->val[kk];
+                item->next_in_col = NULL;
+                item->next_in_line =
+                    (kk + 1 < b->ptr[rec + 1]) ? item + 1 : NULL;
+                item++;
+            }
+        }
+    }
+    a->nb_item = total;
+    free(first);
+}
+
+/** \brief Read a sparse matrix file (read_sparse_matrix format) with
+ several threads
+
+ The file is split in byte ranges starting on a record. Each thread
+ parses its range into its own block, then blocks are linked together :
+ if lines come in increasing order (as write_sparse_matrix does), items
+ are linked in place without any sort, otherwise they are inserted one
+ by one as read_sparse_matrix does.
+
+ Return NULL if the file should be read serially (compressed, too small,
+ no record boundary found, parse error : read_sparse_matrix then reports
+ it).
+**/
+struct sparse_matrix_t *read_sparse_matrix_parallel(char *filename,
+                                                    int col_link_status,
+                                                    long int *nb_record)
+{
+    struct sparse_matrix_t *a;
+
+    struct sparse_block_t *block;
+
+    struct sparse_item_t *last_item;
+
+    struct reader_t *r;
+
+    long int m, n, rec, k, last_rayid = -1;
+
+    off_t start, size, *sync;
+
+    int nt, t, nb_read, ordered = 1, ok = 1;
+
+    r = reader_open(filename);
+    if (reader_compressed(r)) {
+        /* no random access */
+        reader_close(r);
+        return (NULL);
+    }
+    nb_read = reader_long(r, &m);
+    nb_read += (nb_read == 1) && reader_long(r, &n);
+    if (nb_read != 2 || reader_eof(r)) {
+        reader_close(r);
+        return (NULL);
+    }
+    start = reader_tell(r);
+    size = reader_size(r);
+    reader_close(r);
+
+    nt = sparse_get_nb_thread();
+    if (nt > (size - start) / SPARSE_LOAD_MIN_CHUNK) {
+        nt = (size - start) / SPARSE_LOAD_MIN_CHUNK;
+    }
+    if (nt < 2) {
+        return (NULL);
+    }
+
+    sync = (off_t *) malloc((nt + 1) * sizeof(off_t));
+    assert(sync);
+    sync[0] = start;
+    sync[nt] = size;
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+    for (t = 1; t < nt; t++) {
+        sync[t] = sparse_load_sync(filename,
+                                   start + (size - start) / nt * t, size,
+                                   m, n);
+    }
+    for (t = nt - 1; t > 0; t--) {
+        if (sync[t] > sync[t + 1]) {
+            sync[t] = sync[t + 1];
+        }
+    }
+
+    block = (struct sparse_block_t *)
+        calloc(nt, sizeof(struct sparse_block_t));
+    assert(block);
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+    for (t = 0; t < nt; t++) {
+        sparse_load_block(filename, sync[t], sync[t + 1], m, n, &block[t]);
+    }
+
+    /* each block must end exactly where the next one starts */
+    *nb_record = 0;
+    for (t = 0; t < nt; t++) {
+        if (block[t].error || block[t].end != sync[t + 1]) {
+            ok = 0;
+        }
+        if (!block[t].ordered) {
+            ordered = 0;
+        }
+        if (block[t].nb_record) {
+            if (block[t].rayid[0] <= last_rayid) {
+                ordered = 0;
+            }
+            last_rayid = block[t].rayid[block[t].nb_record - 1];
+        }
+        *nb_record += block[t].nb_record;
+    }
+    free(sync);
+
+    if (!ok) {
+        for (t = 0; t < nt; t++) {
+            sparse_block_free(&block[t]);
+        }
+        free(block);
+        return (NULL);
+    }
+
+    a = new_sparse_matrix(m, n, 0);
+    if (ordered) {
+        sparse_load_stitch(a, block, nt);
+    } else {
+        for (t = 0; t < nt; t++) {
+            for (rec = 0; rec < block[t].nb_record; rec++) {
+                last_item = NULL;
+                for (k = block[t].ptr[rec]; k < block[t].ptr[rec + 1]; k++) {
+                    if (last_item && last_item->col_index >= block[t].col[k]) {
+                        last_item = NULL;
+                    }
+                    last_item = sparse_set_value(a, block[t].rayid[rec],
+                                                 block[t].col[k],
+                                                 block[t].val[k], last_item);
+                }
+            }
+        }
+    }
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
+
+    for (t = 0; t < nt; t++) {
+        sparse_block_free(&block[t]);
+    }
+    free(block);
+    return (a);
+}
+
+/*
+ * row-block assembly : line L of the result comes from record src[L] of
+ * block owner[L], its items going to ptr[L] .. ptr[L+1]-1 of a single
+ * chunk. Lines are then copied in parallel, without any insertion.
+ */
+struct sparse_concat_t {
+    long int nb_line;
+    long int *ptr;
+    int *owner;
+    long int *src;
+};
+
+static void sparse_concat_init(struct sparse_concat_t *c, long int nb_line)
+{
+    c->nb_line = nb_line;
+    c->ptr = (long int *) calloc(nb_line + 1, sizeof(long int));
+    c->owner = (int *) malloc((nb_line + 1) * sizeof(int));
+    c->src = (long int *) malloc((nb_line + 1) * sizeof(long int));
+    assert(c->ptr && c->owner && c->src);
+}
+
+static void sparse_concat_free(struct sparse_concat_t *c)
+{
+    free(c->ptr);
+    free(c->owner);
+    free(c->src);
+}
+
+/* line L gets count items from record r of block k, return 0 if another
+   block already fills it */
+static int sparse_concat_add(struct sparse_concat_t *c, long int L, int k,
+                             long int r, long int count)
+{
+    if (c->ptr[L + 1]) {
+        return (0);
+    }
+    c->ptr[L + 1] = count;
+    c->owner[L] = k;
+    c->src[L] = r;
+    return (1);
+}
+
+/* position of the items of each line, return their total number */
+static long int sparse_concat_prefix(struct sparse_concat_t *c)
+{
+    long int L;
+
+    for (L = 0; L < c->nb_line; L++) {
+        c->ptr[L + 1] += c->ptr[L];
+    }
+    return (c->ptr[c->nb_line]);
+}
+
+/* link the count items of line L, their columns and values being set */
+static void sparse_concat_link(struct sparse_matrix_t *a,
+                               struct sparse_item_t *item, long int L,
+                               long int count)
+{
+    long int q;
+
+    a->line[L] = item;
+    for (q = 0; q < count; q++) {
+        item[q].line_index = L;
+        item[q].next_in_col = NULL;
+        item[q].next_in_line = (q + 1 < count) ? &item[q + 1] : NULL;
+    }
+}
+
+/** \brief Concatenate row blocks : line i of block[k] becomes line
+ offset[k] + i (offset NULL for blocks already holding their final line
+ numbers, as read from write_sparse_matrix_with_line_offset files)
+
+ The result has max(offset[k] + nb_line) lines and max(nb_col) columns,
+ the blocks (linked or frozen) are left untouched. Lines not empty in
+ several blocks are summed with sparse_set_value(), much slower.
+**/
+struct sparse_matrix_t *sparse_concat_lines(int nb,
+                                            struct sparse_matrix_t **block,
+                                            long int *offset,
+                                            int col_link_status)
+{
+    struct sparse_matrix_t *a;
+
+    struct sparse_concat_t c;
+
+    struct sparse_item_t *items = NULL, *cur_item, *last_item;
+
+    long int **count, m = 0, n = 0, i, L, total;
+
+    int k, nt, ok = 1;
+
+    for (k = 0; k < nb; k++) {
+        if (m < (offset ? offset[k] : 0) + block[k]->nb_line) {
+            m = (offset ? offset[k] : 0) + block[k]->nb_line;
+        }
+        if (n < block[k]->nb_col) {
+            n = block[k]->nb_col;
+        }
+    }
+
+    /* items per line of each block */
+    count = (long int **) malloc(nb * sizeof(long int *));
+    assert(count);
+    nt = sparse_get_nb_thread();
+    if (nt > nb) {
+        nt = nb;
+    }
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nt) if(nt > 1)
+    for (k = 0; k < nb; k++) {
+        struct sparse_matrix_t *b = block[k];
+
+        struct sparse_item_t *cur;
+
+        long int l;
+
+        count[k] = (long int *) calloc(b->nb_line + 1, sizeof(long int));
+        assert(count[k]);
+        for (l = 0; l < b->nb_line; l++) {
+            if (b->frozen) {
+                count[k][l] = b->frozen->line_ptr[l + 1]
+                    - b->frozen->line_ptr[l];
+                continue;
+            }
+            for (cur = b->line[l]; cur; cur = cur->next_in_line) {
+                count[k][l]++;
+            }
+        }
+    }
+
+    sparse_concat_init(&c, m);
+    for (k = 0; k < nb && ok; k++) {
+        for (i = 0; i < block[k]->nb_line && ok; i++) {
+            if (count[k][i]) {
+                ok = sparse_concat_add(&c, (offset ? offset[k] : 0) + i, k,
+                                       i, count[k][i]);
+            }
+        }
+    }
+    for (k = 0; k < nb; k++) {
+        free(count[k]);
+    }
+    free(count);
+
+    a = new_sparse_matrix(m, n, 0);
+    if (!ok) {
+        fprintf(stderr, "sparse_concat_lines: blocks overlap, summing\n");
+        for (k = 0; k < nb; k++) {
+            for (i = 0; i < block[k]->nb_line; i++) {
+                L = (offset ? offset[k] : 0) + i;
+                last_item = NULL;
+                if (block[k]->frozen) {
+                    struct sparse_compressed_t *z = block[k]->frozen;
+
+                    long int q;
+
+                    for (q = z->line_ptr[i]; q < z->line_ptr[i + 1]; q++) {
+                        last_item = sparse_set_value(a, L,
+                                                     SPARSE_LINE_COL(z, q),
+                                                     SPARSE_LINE_VAL(z, q),
+                                                     last_item);
+                    }
+                    continue;
+                }
+                for (cur_item = block[k]->line[i]; cur_item;
+                     cur_item = cur_item->next_in_line) {
+                    last_item = sparse_set_value(a, L, cur_item->col_index,
+                                                 cur_item->val, last_item);
+                }
+            }
+        }
+    } else {
+        total = sparse_concat_prefix(&c);
+        if (total) {
+            items = sparse_new_items(a, total);
+        }
+        nt = sparse_work_nb_thread(total);
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nt) if(nt > 1)
+        for (L = 0; L < m; L++) {
+            struct sparse_item_t *item = items + c.ptr[L], *cur;
+
+            struct sparse_matrix_t *b;
+
+            long int q, l, nb_item = c.ptr[L + 1] - c.ptr[L];
+
+            if (!nb_item) {
+                continue;
+            }
+            b = block[c.owner[L]];
+            l = c.src[L];
+            if (b->frozen) {
+                for (q = 0; q < nb_item; q++) {
+                    item[q].col_index =
+                        SPARSE_LINE_COL(b->frozen, b->frozen->line_ptr[l] + q);
+                    item[q].val =
+                        SPARSE_LINE_VAL(b->frozen, b->frozen->line_ptr[l] + q);
+                }
+            } else {
+                for (q = 0, cur = b->line[l]; cur;
+                     q++, cur = cur->next_in_line) {
+                    item[q].col_index = cur->col_index;
+                    item[q].val = cur->val;
+                }
+            }
+            sparse_concat_link(a, item, L, nb_item);
+        }
+        a->nb_item = total;
+    }
+    sparse_concat_free(&c);
+
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
+    return (a);
+}
+
+/** \brief Read row-block files (read_sparse_matrix format, compressed or
+ not) into one matrix, such as the files written by several processes
+ with write_sparse_matrix_with_line_offset
+
+ Files are parsed in parallel, one per thread. Line l of file k becomes
+ line offset[k] + l (offset NULL when the files hold the final line
+ numbers). When each file has increasing lines and columns and no line
+ is in two files, items are copied in place, otherwise they are
+ inserted one by one as read_sparse_matrix does.
+**/
+struct sparse_matrix_t *read_sparse_matrix_blocks(int nb, char **filename,
+                                                  long int *offset,
+                                                  int col_link_status)
+{
+    struct sparse_matrix_t *a;
+
+    struct sparse_block_t *block;
+
+    struct sparse_concat_t c;
+
+    struct sparse_item_t *items = NULL, *last_item;
+
+    long int *dim, m = 0, n = 0, rec, q, L, total = 0;
+
+    int k, nt, ok = 1;
+
+    fprintf(stdout, "reading %d sparse matrix blocks ... ", nb);
+    fflush(stdout);
+
+    block = (struct sparse_block_t *)
+        calloc(nb, sizeof(struct sparse_block_t));
+    dim = (long int *) malloc(2 * nb * sizeof(long int));
+    assert(block && dim);
+
+    nt = sparse_get_nb_thread();
+    if (nt > nb) {
+        nt = nb;
+    }
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nt) if(nt > 1)
+    for (k = 0; k < nb; k++) {
+        struct reader_t *r;
+
+        int nb_read;
+
+        r = reader_open(filename[k]);
+        nb_read = reader_long(r, &dim[2 * k]);
+        nb_read += (nb_read == 1) && reader_long(r, &dim[2 * k + 1]);
+        if (nb_read != 2) {
+            block[k].error = 1;
+        } else {
+            sparse_load_records(r, -1, dim[2 * k], dim[2 * k + 1],
+                                &block[k]);
+        }
+        reader_close(r);
+    }
+
+    for (k = 0; k < nb; k++) {
+        if (block[k].error) {
+            fprintf(stdout, "\n");
+            fprintf(stderr,
+                    "read_sparse_matrix_blocks: file '%s' corrupted\n",
+                    filename[k]);
+            exit(1);
+        }
+        if (m < (offset ? offset[k] : 0) + dim[2 * k]) {
+            m = (offset ? offset[k] : 0) + dim[2 * k];
+        }
+        if (n < dim[2 * k + 1]) {
+            n = dim[2 * k + 1];
+        }
+        if (!block[k].ordered) {
+            ok = 0;
+        }
+    }
+    free(dim);
+    fprintf(stdout, "(%ldx%ld) ", m, n);
+
+    sparse_concat_init(&c, m);
+    for (k = 0; k < nb && ok; k++) {
+        for (rec = 0; rec < block[k].nb_record && ok; rec++) {
+            if (block[k].ptr[rec + 1] > block[k].ptr[rec]) {
+                ok = sparse_concat_add(&c, (offset ? offset[k] : 0)
+                                       + block[k].rayid[rec], k, rec,
+                                       block[k].ptr[rec + 1]
+                                       - block[k].ptr[rec]);
+            }
+        }
+    }
+
+    a = new_sparse_matrix(m, n, 0);
+    if (!ok) {
+        for (k = 0; k < nb; k++) {
+            for (rec = 0; rec < block[k].nb_record; rec++) {
+                L = (offset ? offset[k] : 0) + block[k].rayid[rec];
+                last_item = NULL;
+                for (q = block[k].ptr[rec]; q < block[k].ptr[rec + 1]; q++) {
+                    if (last_item && last_item->col_index >= block[k].col[q]) {
+                        last_item = NULL;
+                    }
+                    last_item = sparse_set_value(a, L, block[k].col[q],
+                                                 block[k].val[q], last_item);
+                }
+            }
+        }
+    } else {
+        total = sparse_concat_prefix(&c);
+        if (total) {
+            items = sparse_new_items(a, total);
+        }
+        nt = sparse_work_nb_thread(total);
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nt) if(nt > 1)
+        for (L = 0; L < m; L++) {
+            struct sparse_block_t *b;
+
+            struct sparse_item_t *item = items + c.ptr[L];
+
+            long int q, kk, nb_item = c.ptr[L + 1] - c.ptr[L];
+
+            if (!nb_item) {
+                continue;
+            }
+            b = &block[c.owner[L]];
+            kk = b->ptr[c.src[L]];
+            for (q = 0; q < nb_item; q++) {
+                item[q].col_index = b->col[kk + q];
+                item[q].val = b->val[kk + q];
+            }
+            sparse_concat_link(a, item, L, nb_item);
+        }
+        a->nb_item = total;
+    }
+    sparse_concat_free(&c);
+    fprintf(stdout, "%ld items\n", a->nb_item);
+    fflush(stdout);
+
+    for (k = 0; k < nb; k++) {
+        sparse_block_free(&block[k]);
+    }
+    free(block);
+
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
+    return (a);
+}
@@ -0,0 +1,577 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#include "sparse.h"
+
+/*
+ * LSQR (C. C. Paige and M. A. Saunders) and LSMR (D. C.-L. Fong and
+ * M. A. Saunders) on a frozen matrix. An iteration makes two passes over
+ * A and the vectors, the BLAS-1 updates being fused with the products :
+ *
+ * - lines : u = A*v - alpha*u and ||u||^2
+ * - columns : v = A^T*u - beta*v and ||v||^2, with the x and w (h, hbar)
+ *   updates of the solver.
+ *
+ * u and v are not normalized, their scale (1/beta, 1/alpha) is applied by
+ * the next pass. The updates needing the new alpha are done by the column
+ * pass of the next iteration, LSMR's last x update by a final pass.
+ */
+
+enum sparse_lsqr_method_t {
+    SPARSE_LSQR_NONE,
+    SPARSE_LSQR_LSQR,
+    SPARSE_LSQR_LSMR
+};
+
+/* column pass : coefficients and sums (see sparse_lsqr_cols()) */
+struct sparse_lsqr_step_t {
+    int method;
+
+    /* v = a * A^T*u + c * v, v unchanged if a = 0 */
+    double a;
+    double c;
+    /* scale of v before the pass */
+    double vs;
+
+    /* lsqr : w = v + t2 * w, x = x + t1 * w */
+    double t1;
+    double t2;
+    double inv_rho;
+
+    /* lsmr : x = x + c2 * hbar, h = v - c3 * h, hbar = h - c1 * hbar */
+    double c1;
+    double c2;
+    double c3;
+
+    double vv;                  /* ||v||^2 */
+    double dd;                  /* lsqr : ||w / rho||^2 */
+    double xx;                  /* lsmr : ||x||^2, x.hbar, ||hbar||^2 */
+    double xh;
+    double hh;
+};
+
+/* Givens rotation (c, s) of (a, b) into (r, 0), r >= 0 */
+static void sparse_lsqr_rotation(double a, double b, double *c, double *s,
+                                 double *r)
+{
+    *r = hypot(a, b);
+    if (*r == 0.) {
+        *c = 1.;
+        *s = 0.;
+    } else {
+        *c = a / *r;
+        *s = b / *r;
+    }
+}
+
+/* u = a * A*v + c * u, lines shared among threads by number of items,
+   returns ||u||^2 */
+static double sparse_lsqr_lines(struct sparse_matrix_t *A, const double *v,
+                                double a, double *u, double c)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    double sum = 0.;
+
+    int t, nt = sparse_work_nb_thread(A->nb_item);
+
+    /* nt parts whatever the size of the team */
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1) \
+    reduction(+:sum)
+    for (t = 0; t < nt; t++) {
+        long int first = sparse_balanced_split(z->line_ptr, A->nb_line, t,
+                                               nt);
+
+        long int last = sparse_balanced_split(z->line_ptr, A->nb_line,
+                                              t + 1, nt);
+
+        long int i;
+
+        double ui;
+
+        for (i = first; i < last; i++) {
+            ui = a * sparse_frozen_dot(z, 1, z->line_ptr[i],
+                                       z->line_ptr[i + 1] - z->line_ptr[i],
+                                       v);
+            if (c != 0.) {
+                ui += c * u[i];
+            }
+            u[i] = ui;
+            sum += ui * ui;
+        }
+    }
+    return (sum);
+}
+
+/* column pass of an iteration, columns shared among threads by number of
+   items, each column of v, x, w (lsqr) or w = h, wbar = hbar (lsmr) being
+   read and written once */
+static void sparse_lsqr_cols(struct sparse_matrix_t *A, const double *u,
+                             double *v, double *x, double *w, double *wbar,
+                             struct sparse_lsqr_step_t *st)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    double vv = 0., dd = 0., xx = 0., xh = 0., hh = 0.;
+
+    int t, nt = sparse_work_nb_thread(A->nb_item);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1) \
+    reduction(+:vv, dd, xx, xh, hh)
+    for (t = 0; t < nt; t++) {
+        long int first = sparse_balanced_split(z->col_ptr, A->nb_col, t,
+                                               nt);
+
+        long int last = sparse_balanced_split(z->col_ptr, A->nb_col, t + 1,
+                                              nt);
+
+        long int j;
+
+        double vj, wj, hj, hb, xj;
+
+        for (j = first; j < last; j++) {
+            vj = v[j];
+            if (st->method == SPARSE_LSQR_LSQR) {
+                wj = vj * st->vs + st->t2 * w[j];
+                x[j] += st->t1 * wj;
+                w[j] = wj;
+                wj *= st->inv_rho;
+                dd += wj * wj;
+            } else if (st->method == SPARSE_LSQR_LSMR) {
+                hb = wbar[j];
+                xj = x[j] + st->c2 * hb;
+                hj = vj * st->vs - st->c3 * w[j];
+                hb = hj - st->c1 * hb;
+                x[j] = xj;
+                w[j] = hj;
+                wbar[j] = hb;
+                xx += xj * xj;
+                xh += xj * hb;
+                hh += hb * hb;
+            }
+            if (st->a != 0.) {
+                vj = st->a * sparse_frozen_dot(z, 0, z->col_ptr[j],
+                                               z->col_ptr[j + 1] -
+                                               z->col_ptr[j], u) +
+                    st->c * vj;
+                v[j] = vj;
+                vv += vj * vj;
+            }
+        }
+    }
+    st->vv = vv;
+    st->dd = dd;
+    st->xx = xx;
+    st->xh = xh;
+    st->hh = hh;
+}
+
+static double sparse_lsqr_norm(struct vector_t *b)
+{
+    double sum = 0.;
+
+    long int i;
+
+    for (i = 0; i < b->length; i++) {
+        sum += b->mat[i] * b->mat[i];
+    }
+    return (sqrt(sum));
+}
+
+/* first step of both solvers : beta*u = b - A*x, alpha*v = A^T*u, u and v
+   not normalized. Returns ||b|| */
+static double sparse_lsqr_start(struct sparse_matrix_t *A,
+                                struct vector_t *b, struct vector_t *x,
+                                double *u, double *v, double *alpha,
+                                double *beta)
+{
+    struct sparse_lsqr_step_t st;
+
+    assert(b->length == A->nb_line);
+    assert(x->length == A->nb_col);
+
+    sparse_freeze(A);
+
+    memcpy(u, b->mat, A->nb_line * sizeof(double));
+    *beta = sqrt(sparse_lsqr_lines(A, x->mat, -1., u, 1.));
+    *alpha = 0.;
+    if (*beta > 0.) {
+        memset(&st, 0, sizeof(st));
+        st.method = SPARSE_LSQR_NONE;
+        st.a = 1. / *beta;
+        sparse_lsqr_cols(A, u, v, NULL, NULL, NULL, &st);
+        *alpha = sqrt(st.vv);
+    }
+    return (sparse_lsqr_norm(b));
+}
+
+/* common stopping tests (istop 1 to 7), then the hook */
+static int sparse_lsqr_stop(struct sparse_lsqr_t *p, double bnorm)
+{
+    double test1, test2, test3, t1, rtol, ctol;
+
+    if (bnorm == 0.) {
+        bnorm = 1.;
+    }
+    ctol = p->conlim > 0. ? 1. / p->conlim : 0.;
+    test1 = p->rnorm / bnorm;
+    test2 = p->arnorm / (p->anorm * p->rnorm + DBL_EPSILON);
+    test3 = 1. / (p->acond + DBL_EPSILON);
+    t1 = test1 / (1. + p->anorm * p->xnorm / bnorm);
+    rtol = p->btol + p->atol * p->anorm * p->xnorm / bnorm;
+
+    p->istop = 0;
+    if (p->iter >= p->max_iter) {
+        p->istop = 7;
+    }
+    if (1. + test3 <= 1.) {
+        p->istop = 6;
+    }
+    if (1. + test2 <= 1.) {
+        p->istop = 5;
+    }
+    if (1. + t1 <= 1.) {
+        p->istop = 4;
+    }
+    if (test3 <= ctol) {
+        p->istop = 3;
+    }
+    if (test2 <= p->atol) {
+        p->istop = 2;
+    }
+    if (test1 <= rtol) {
+        p->istop = 1;
+    }
+    if (!p->istop && p->hook && p->hook(p)) {
+        p->istop = 8;
+    }
+    return (p->istop);
+}
+
+static void sparse_lsqr_report(char *name, struct sparse_lsqr_t *p)
+{
+    fprintf(stdout, "%s: %ld iterations, |r|=%g |A^T r|=%g : %s\n", name,
+            p->iter, p->rnorm, p->arnorm, sparse_lsqr_message(p->istop));
+    fflush(stdout);
+}
+
+/** \brief Default options : no damping, atol = btol = 1e-6, conlim = 1e8,
+ max_iter = 0 (2 * nb_col for lsqr, min(nb_line, nb_col) for lsmr) **/
+void sparse_lsqr_init(struct sparse_lsqr_t *p)
+{
+    memset(p, 0, sizeof(struct sparse_lsqr_t));
+    p->atol = 1e-6;
+    p->btol = 1e-6;
+    p->conlim = 1e8;
+}
+
+/** \brief Reason for istop **/
+const char *sparse_lsqr_message(int istop)
+{
+    switch (istop) {
+    case 0:
+        return ("x is an exact solution");
+    case 1:
+        return ("A*x - b is small enough, given atol and btol");
+    case 2:
+        return ("the least-squares solution is good enough, given atol");
+    case 3:
+        return ("cond(A) has exceeded conlim");
+    case 4:
+        return ("A*x - b is small enough for this machine");
+    case 5:
+        return ("the least-squares solution is good enough for this machine");
+    case 6:
+        return ("cond(A) seems to be too large for this machine");
+    case 7:
+        return ("the iteration limit has been reached");
+    case 8:
+        return ("stopped by the iteration hook");
+    default:
+        return ("unknown");
+    }
+}
+
+/** \brief Solve min ||b - A*x||^2 + damp^2 * ||x||^2 with LSQR
+
+ x holds the initial guess on entry, the solution on return. A is frozen
+ (see sparse_freeze()) if it is not. p gives the options (see
+ sparse_lsqr_init()) and gets the estimates of the last iteration.
+**/
+void sparse_lsqr(struct sparse_matrix_t *A, struct vector_t *b,
+                 struct vector_t *x, struct sparse_lsqr_t *p)
+{
+    struct sparse_lsqr_step_t st;
+
+    struct vector_t *u, *v, *w;
+
+    double alpha, beta, bnorm, su, dampsq, anorm2 = 0., ddnorm = 0.;
+
+    double rhobar, rhobar1, phibar, phi, rho, cs, sn, cs1, sn1, psi;
+
+    double theta, tau, res2 = 0., xxnorm = 0., z = 0., cs2 = -1., sn2 = 0.;
+
+    double delta, gambar, gamma, rhs, zbar;
+
+    u = new_vector(A->nb_line);
+    v = new_vector(A->nb_col);
+    w = new_vector(A->nb_col);
+
+    bnorm = sparse_lsqr_start(A, b, x, u->mat, v->mat, &alpha, &beta);
+    dampsq = p->damp * p->damp;
+    if (p->max_iter <= 0) {
+        p->max_iter = 2 * A->nb_col;
+    }
+
+    p->istop = 0;
+    p->iter = 0;
+    p->anorm = 0.;
+    p->acond = 0.;
+    p->xnorm = 0.;
+    p->rnorm = beta;
+    p->arnorm = alpha * beta;
+
+    rhobar = alpha;
+    phibar = beta;
+    su = beta > 0. ? 1. / beta : 0.;
+
+    /* w = v (normalized) on the first pass */
+    memset(&st, 0, sizeof(st));
+    st.method = SPARSE_LSQR_LSQR;
+    st.vs = alpha > 0. ? 1. / alpha : 0.;
+
+    while (p->arnorm != 0.) {
+        p->iter++;
+
+        /* beta*u = A*v - alpha*u */
+        beta = sqrt(sparse_lsqr_lines(A, v->mat, st.vs, u->mat,
+                                      -alpha * su));
+        if (beta > 0.) {
+            su = 1. / beta;
+            anorm2 += alpha * alpha + beta * beta + dampsq;
+            p->anorm = sqrt(anorm2);
+        }
+
+        /* eliminate the damping, then the subdiagonal beta */
+        if (p->damp > 0.) {
+            rhobar1 = hypot(rhobar, p->damp);
+            cs1 = rhobar / rhobar1;
+            sn1 = p->damp / rhobar1;
+            psi = sn1 * phibar;
+            phibar = cs1 * phibar;
+        } else {
+            rhobar1 = rhobar;
+            psi = 0.;
+        }
+        sparse_lsqr_rotation(rhobar1, beta, &cs, &sn, &rho);
+        phi = cs * phibar;
+        phibar = sn * phibar;
+        tau = sn * phi;
+
+        /* alpha*v = A^T*u - beta*v, x = x + phi/rho * w */
+        st.t1 = phi / rho;
+        st.inv_rho = 1. / rho;
+        st.a = beta > 0. ? su : 0.;
+        st.c = -beta * st.vs;
+        sparse_lsqr_cols(A, u->mat, v->mat, x->mat, w->mat, NULL, &st);
+        if (beta > 0.) {
+            alpha = sqrt(st.vv);
+            st.vs = alpha > 0. ? 1. / alpha : 0.;
+        }
+        ddnorm += st.dd;
+
+        theta = sn * alpha;
+        rhobar = -cs * alpha;
+        /* w = v - theta/rho * w on the next pass */
+        st.t2 = -theta / rho;
+
+        /* ||x|| */
+        delta = sn2 * rho;
+        gambar = -cs2 * rho;
+        rhs = phi - delta * z;
+        zbar = rhs / gambar;
+        p->xnorm = sqrt(xxnorm + zbar * zbar);
+        gamma = hypot(gambar, theta);
+        cs2 = gambar / gamma;
+        sn2 = theta / gamma;
+        z = rhs / gamma;
+        xxnorm += z * z;
+
+        p->acond = p->anorm * sqrt(ddnorm);
+        res2 += psi * psi;
+        p->rnorm = sqrt(phibar * phibar + res2);
+        p->arnorm = alpha * fabs(tau);
+
+        if (sparse_lsqr_stop(p, bnorm)) {
+            break;
+        }
+    }
+
+    sparse_lsqr_report("sparse_lsqr", p);
+
+    free_vector(u);
+    free_vector(v);
+    free_vector(w);
+}
+
+/** \brief Solve min ||b - A*x||^2 + damp^2 * ||x||^2 with LSMR
+
+ Same interface as sparse_lsqr(). ||A^T r|| decreases monotonically, so
+ LSMR may stop earlier on atol (istop 2).
+**/
+void sparse_lsmr(struct sparse_matrix_t *A, struct vector_t *b,
+                 struct vector_t *x, struct sparse_lsqr_t *p)
+{
+    struct sparse_lsqr_step_t st;
+
+    struct vector_t *u, *v, *h, *hbar;
+
+    double alpha, beta, bnorm, su;
+
+    double zetabar, alphabar, rho = 1., rhobar = 1., cbar = 1., sbar = 0.;
+
+    double chat, shat, alphahat, c, s, rhoold, rhobarold, zetaold, zeta = 0.;
+
+    double thetabar, rhotemp, thetanew;
+
+    double betadd, betad = 0., rhodold = 1., tautildeold = 0.;
+
+    double thetatilde = 0., thetatildeold, ctildeold, stildeold;
+
+    double rhotildeold, betaacute, betacheck, betahat, taud, d = 0.;
+
+    double anorm2, maxrbar = 0., minrbar = 1e100;
+
+    u = new_vector(A->nb_line);
+    v = new_vector(A->nb_col);
+    h = new_vector(A->nb_col);
+    hbar = new_vector(A->nb_col);
+
+    bnorm = sparse_lsqr_start(A, b, x, u->mat, v->mat, &alpha, &beta);
+    if (p->max_iter <= 0) {
+        p->max_iter = A->nb_line < A->nb_col ? A->nb_line : A->nb_col;
+    }
+
+    p->istop = 0;
+    p->iter = 0;
+    anorm2 = alpha * alpha;
+    p->anorm = alpha;
+    p->acond = 1.;
+    p->xnorm = 0.;
+    p->rnorm = beta;
+    p->arnorm = alpha * beta;
+
+    zetabar = alpha * beta;
+    alphabar = alpha;
+    betadd = beta;
+    su = beta > 0. ? 1. / beta : 0.;
+
+    /* h = v (normalized) on the first pass */
+    memset(&st, 0, sizeof(st));
+    st.method = SPARSE_LSQR_LSMR;
+    st.vs = alpha > 0. ? 1. / alpha : 0.;
+
+    while (p->arnorm != 0.) {
+        p->iter++;
+
+        /* beta*u = A*v - alpha*u */
+        beta = sqrt(sparse_lsqr_lines(A, v->mat, st.vs, u->mat,
+                                      -alpha * su));
+        if (beta > 0.) {
+            su = 1. / beta;
+        }
+
+        /* rotations Qhat (damping) and Q */
+        sparse_lsqr_rotation(alphabar, p->damp, &chat, &shat, &alphahat);
+        rhoold = rho;
+        sparse_lsqr_rotation(alphahat, beta, &c, &s, &rho);
+        rhobarold = rhobar;
+        zetaold = zeta;
+        thetabar = sbar * rho;
+        rhotemp = cbar * rho;
+
+        /* alpha*v = A^T*u - beta*v, hbar = h - c1 * hbar */
+        st.c1 = thetabar * rho / (rhoold * rhobarold);
+        st.a = beta > 0. ? su : 0.;
+        st.c = -beta * st.vs;
+        sparse_lsqr_cols(A, u->mat, v->mat, x->mat, h->mat, hbar->mat,
+                         &st);
+        if (beta > 0.) {
+            alpha = sqrt(st.vv);
+            st.vs = alpha > 0. ? 1. / alpha : 0.;
+        }
+
+        /* rotation Qbar */
+        thetanew = s * alpha;
+        alphabar = c * alpha;
+        sparse_lsqr_rotation(cbar * rho, thetanew, &cbar, &sbar, &rhobar);
+        zeta = cbar * zetabar;
+        zetabar = -sbar * zetabar;
+
+        /* x = x + c2 * hbar, h = v - c3 * h on the next pass */
+        st.c2 = zeta / (rho * rhobar);
+        st.c3 = thetanew / rho;
+        p->xnorm = sqrt(fabs(st.xx + st.c2 * (2. * st.xh +
+                                              st.c2 * st.hh)));
+
+        /* ||r|| */
+        betaacute = chat * betadd;
+        betacheck = -shat * betadd;
+        betahat = c * betaacute;
+        betadd = -s * betaacute;
+        thetatildeold = thetatilde;
+        sparse_lsqr_rotation(rhodold, thetabar, &ctildeold, &stildeold,
+                             &rhotildeold);
+        thetatilde = stildeold * rhobar;
+        rhodold = ctildeold * rhobar;
+        betad = -stildeold * betad + ctildeold * betahat;
+        tautildeold = (zetaold - thetatildeold * tautildeold) / rhotildeold;
+        taud = (zeta - thetatilde * tautildeold) / rhodold;
+        d += betacheck * betacheck;
+        p->rnorm = sqrt(d + (betad - taud) * (betad - taud) +
+                        betadd * betadd);
+
+        /* ||A||, cond(A) */
+        anorm2 += beta * beta;
+        p->anorm = sqrt(anorm2);
+        anorm2 += alpha * alpha;
+        if (rhobarold > maxrbar) {
+            maxrbar = rhobarold;
+        }
+        if (p->iter > 1 && rhobarold < minrbar) {
+            minrbar = rhobarold;
+        }
+        p->acond = (maxrbar > rhotemp ? maxrbar : rhotemp) /
+            (minrbar < rhotemp ? minrbar : rhotemp);
+
+        p->arnorm = fabs(zetabar);
+
+        if (sparse_lsqr_stop(p, bnorm)) {
+            break;
+        }
+    }
+
+    /* last x update */
+    if (p->iter > 0) {
+        long int j;
+
+        int nt = sparse_work_nb_thread(A->nb_col);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1)
+        for (j = 0; j < A->nb_col; j++) {
+            x->mat[j] += st.c2 * hbar->mat[j];
+        }
+    }
+
+    sparse_lsqr_report("sparse_lsmr", p);
+
+    free_vector(u);
+    free_vector(v);
+    free_vector(h);
+    free_vector(hbar);
+}
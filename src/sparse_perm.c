@@ -0,0 +1,630 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "sparse.h"
+#include "reader.h"
+#include "writer.h"
+
+/*
+ * Reorderings of the lines and columns of a matrix, to bring the items of
+ * a line (and the lines using a column) close together : x is then read
+ * by A*x, and written by A^T*y, on fewer cache lines.
+ *
+ * The permutation is kept (struct sparse_perm_t) so that vectors can be
+ * moved between the original and the permuted numberings : b to the
+ * permuted lines before solving, x back to the original columns after.
+ */
+
+/* pattern of a matrix : columns of line i in lcol[lptr[i] .. lptr[i+1]),
+   lines of column j in cline[cptr[j] .. cptr[j+1]) */
+struct sparse_pattern_t {
+    long int nb_line;
+    long int nb_col;
+    long int *lptr;
+    long int *lcol;
+    long int *cptr;
+    long int *cline;
+};
+
+/* column and its sort key */
+struct sparse_perm_key_t {
+    long int key;
+    long int col;
+};
+
+static struct sparse_pattern_t *sparse_pattern_new(struct sparse_matrix_t
+                                                   *A)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    struct sparse_pattern_t *pt;
+
+    struct sparse_item_t *cur_item;
+
+    long int i, j, k, n, *pos;
+
+    pt = (struct sparse_pattern_t *)
+        malloc(sizeof(struct sparse_pattern_t));
+    assert(pt);
+    pt->nb_line = A->nb_line;
+    pt->nb_col = A->nb_col;
+    pt->lptr = (long int *) malloc((A->nb_line + 1) * sizeof(long int));
+    pt->cptr = (long int *) calloc(A->nb_col + 1, sizeof(long int));
+    assert(pt->lptr && pt->cptr);
+
+    /* line pointers */
+    n = 0;
+    for (i = 0; i < A->nb_line; i++) {
+        pt->lptr[i] = n;
+        if (z) {
+            n += z->line_ptr[i + 1] - z->line_ptr[i];
+            continue;
+        }
+        for (cur_item = A->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            n++;
+        }
+    }
+    pt->lptr[A->nb_line] = n;
+
+    /* columns of the lines */
+    pt->lcol = (long int *) malloc((n + 1) * sizeof(long int));
+    pt->cline = (long int *) malloc((n + 1) * sizeof(long int));
+    assert(pt->lcol && pt->cline);
+    for (i = 0; i < A->nb_line; i++) {
+        k = pt->lptr[i];
+        if (z) {
+            for (j = z->line_ptr[i]; j < z->line_ptr[i + 1]; j++) {
+                pt->lcol[k++] = SPARSE_LINE_COL(z, j);
+            }
+            continue;
+        }
+        for (cur_item = A->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            pt->lcol[k++] = cur_item->col_index;
+        }
+    }
+
+    /* lines of the columns (counting sort, lines in order) */
+    for (k = 0; k < n; k++) {
+        pt->cptr[pt->lcol[k] + 1]++;
+    }
+    for (j = 0; j < A->nb_col; j++) {
+        pt->cptr[j + 1] += pt->cptr[j];
+    }
+    pos = (long int *) malloc((A->nb_col + 1) * sizeof(long int));
+    assert(pos);
+    memcpy(pos, pt->cptr, (A->nb_col + 1) * sizeof(long int));
+    for (i = 0; i < A->nb_line; i++) {
+        for (k = pt->lptr[i]; k < pt->lptr[i + 1]; k++) {
+            pt->cline[pos[pt->lcol[k]]++] = i;
+        }
+    }
+    free(pos);
+    return (pt);
+}
+
+static void sparse_pattern_free(struct sparse_pattern_t *pt)
+{
+    free(pt->lptr);
+    free(pt->lcol);
+    free(pt->cptr);
+    free(pt->cline);
+    free(pt);
+}
+
+static int sparse_perm_key_cmp(const void *a, const void *b)
+{
+    const struct sparse_perm_key_t *ka = (const struct sparse_perm_key_t *) a;
+
+    const struct sparse_perm_key_t *kb = (const struct sparse_perm_key_t *) b;
+
+    if (ka->key != kb->key) {
+        return (ka->key < kb->key ? -1 : 1);
+    }
+    return (ka->col < kb->col ? -1 : ka->col > kb->col);
+}
+
+/*
+ * breadth first search of the graph of A^T*A (columns sharing a line)
+ * from column s : the columns reached are appended to queue[*tail ..],
+ * the new neighbours of a column by increasing degree (Cuthill-McKee).
+ * A line is only expanded once, so the search is O(items).
+ */
+static void sparse_perm_bfs(struct sparse_pattern_t *pt, long int s,
+                            const long int *deg, char *col_seen,
+                            char *line_seen, long int *queue,
+                            long int *tail, struct sparse_perm_key_t *key)
+{
+    long int head, first, i, j, k, l, c;
+
+    head = *tail;
+    col_seen[s] = 1;
+    queue[(*tail)++] = s;
+    while (head < *tail) {
+        j = queue[head++];
+        first = *tail;
+        for (k = pt->cptr[j]; k < pt->cptr[j + 1]; k++) {
+            i = pt->cline[k];
+            if (line_seen[i]) {
+                continue;
+            }
+            line_seen[i] = 1;
+            for (l = pt->lptr[i]; l < pt->lptr[i + 1]; l++) {
+                c = pt->lcol[l];
+                if (!col_seen[c]) {
+                    col_seen[c] = 1;
+                    queue[(*tail)++] = c;
+                }
+            }
+        }
+        if (*tail - first > 1) {
+            for (k = first; k < *tail; k++) {
+                key[k - first].key = deg[queue[k]];
+                key[k - first].col = queue[k];
+            }
+            qsort(key, *tail - first, sizeof(struct sparse_perm_key_t),
+                  sparse_perm_key_cmp);
+            for (k = first; k < *tail; k++) {
+                queue[k] = key[k - first].col;
+            }
+        }
+    }
+}
+
+/* forget the search of queue[first .. last) */
+static void sparse_perm_bfs_reset(struct sparse_pattern_t *pt,
+                                  const long int *queue, long int first,
+                                  long int last, char *col_seen,
+                                  char *line_seen)
+{
+    long int k, l;
+
+    for (k = first; k < last; k++) {
+        col_seen[queue[k]] = 0;
+        for (l = pt->cptr[queue[k]]; l < pt->cptr[queue[k] + 1]; l++) {
+            line_seen[pt->cline[l]] = 0;
+        }
+    }
+}
+
+/*
+ * reverse Cuthill-McKee order of the columns. Each connected component is
+ * searched twice : from its column of lowest degree, then from the last
+ * column reached (far from the first one), which gives more, narrower
+ * levels, hence a smaller bandwidth.
+ */
+static void sparse_perm_rcm(struct sparse_pattern_t *pt, long int *col)
+{
+    struct sparse_perm_key_t *key;
+
+    long int *deg, *queue, j, k, tail = 0, start;
+
+    char *col_seen, *line_seen;
+
+    deg = (long int *) calloc(pt->nb_col, sizeof(long int));
+    queue = (long int *) malloc(pt->nb_col * sizeof(long int));
+    key = (struct sparse_perm_key_t *)
+        malloc(pt->nb_col * sizeof(struct sparse_perm_key_t));
+    col_seen = (char *) calloc(pt->nb_col, 1);
+    line_seen = (char *) calloc(pt->nb_line, 1);
+    assert((deg && queue && key && col_seen && line_seen) || !pt->nb_col);
+
+    /* degree (upper bound) : items of the lines of the column */
+    for (j = 0; j < pt->nb_col; j++) {
+        for (k = pt->cptr[j]; k < pt->cptr[j + 1]; k++) {
+            deg[j] += pt->lptr[pt->cline[k] + 1] - pt->lptr[pt->cline[k]];
+        }
+        key[j].key = deg[j];
+        key[j].col = j;
+    }
+    qsort(key, pt->nb_col, sizeof(struct sparse_perm_key_t),
+          sparse_perm_key_cmp);
+    /* start columns by increasing degree, key is reused by the search */
+    for (j = 0; j < pt->nb_col; j++) {
+        col[j] = key[j].col;
+    }
+
+    for (j = 0; j < pt->nb_col; j++) {
+        if (col_seen[col[j]]) {
+            continue;
+        }
+        start = tail;
+        sparse_perm_bfs(pt, col[j], deg, col_seen, line_seen, queue, &tail,
+                        key);
+        if (tail - start > 2) {
+            long int far = queue[tail - 1];
+
+            sparse_perm_bfs_reset(pt, queue, start, tail, col_seen,
+                                  line_seen);
+            tail = start;
+            sparse_perm_bfs(pt, far, deg, col_seen, line_seen, queue,
+                            &tail, key);
+        }
+    }
+    assert(tail == pt->nb_col);
+
+    for (k = 0; k < pt->nb_col; k++) {
+        col[k] = queue[pt->nb_col - 1 - k];
+    }
+
+    free(deg);
+    free(queue);
+    free(key);
+    free(col_seen);
+    free(line_seen);
+}
+
+/* lines by increasing first (permuted) column, empty lines last. Counting
+   sort, lines with the same first column keep their order */
+static void sparse_perm_sort_lines(struct sparse_pattern_t *pt,
+                                   const long int *col, long int *line)
+{
+    long int *new_col, *first, *count, i, j, k;
+
+    new_col = (long int *) malloc((pt->nb_col + 1) * sizeof(long int));
+    first = (long int *) malloc((pt->nb_line + 1) * sizeof(long int));
+    count = (long int *) calloc(pt->nb_col + 2, sizeof(long int));
+    assert(new_col && first && count);
+
+    for (k = 0; k < pt->nb_col; k++) {
+        new_col[col[k]] = k;
+    }
+    for (i = 0; i < pt->nb_line; i++) {
+        first[i] = pt->nb_col;
+        for (k = pt->lptr[i]; k < pt->lptr[i + 1]; k++) {
+            j = new_col[pt->lcol[k]];
+            if (j < first[i]) {
+                first[i] = j;
+            }
+        }
+        count[first[i] + 1]++;
+    }
+    for (j = 0; j <= pt->nb_col; j++) {
+        count[j + 1] += count[j];
+    }
+    for (i = 0; i < pt->nb_line; i++) {
+        line[count[first[i]]++] = i;
+    }
+
+    free(new_col);
+    free(first);
+    free(count);
+}
+
+/* mean distance between the first and last (permuted) columns of the
+   lines */
+static double sparse_perm_span(struct sparse_pattern_t *pt,
+                               const long int *line, const long int *col)
+{
+    long int *new_col, i, k, j, lo, hi, n = 0;
+
+    double sum = 0.;
+
+    new_col = (long int *) malloc((pt->nb_col + 1) * sizeof(long int));
+    assert(new_col);
+    for (k = 0; k < pt->nb_col; k++) {
+        new_col[col ? col[k] : k] = k;
+    }
+    for (i = 0; i < pt->nb_line; i++) {
+        long int l = line ? line[i] : i;
+
+        if (pt->lptr[l] == pt->lptr[l + 1]) {
+            continue;
+        }
+        lo = pt->nb_col;
+        hi = -1;
+        for (k = pt->lptr[l]; k < pt->lptr[l + 1]; k++) {
+            j = new_col[pt->lcol[k]];
+            lo = j < lo ? j : lo;
+            hi = j > hi ? j : hi;
+        }
+        sum += (double) (hi - lo);
+        n++;
+    }
+    free(new_col);
+    return (n ? sum / n : 0.);
+}
+
+static struct sparse_perm_t *sparse_new_perm(long int nb_line,
+                                             long int nb_col)
+{
+    struct sparse_perm_t *p;
+
+    p = (struct sparse_perm_t *) malloc(sizeof(struct sparse_perm_t));
+    assert(p);
+    p->nb_line = nb_line;
+    p->nb_col = nb_col;
+    p->line = (long int *) malloc((nb_line + 1) * sizeof(long int));
+    p->col = (long int *) malloc((nb_col + 1) * sizeof(long int));
+    assert(p->line && p->col);
+    return (p);
+}
+
+void sparse_free_perm(struct sparse_perm_t *p)
+{
+    free(p->line);
+    free(p->col);
+    free(p);
+}
+
+/** \brief Compute a reordering of A (A is not modified) :
+
+ SPARSE_REORDER_LINES : lines sorted by their first column, columns kept
+ SPARSE_REORDER_RCM : columns in reverse Cuthill-McKee order of the graph
+ of A^T*A (columns are neighbours if they share a line), then lines sorted
+ by their first permuted column
+**/
+struct sparse_perm_t *sparse_reorder(struct sparse_matrix_t *A, int method)
+{
+    struct sparse_pattern_t *pt;
+
+    struct sparse_perm_t *p;
+
+    long int j;
+
+    if (method != SPARSE_REORDER_LINES && method != SPARSE_REORDER_RCM) {
+        fprintf(stderr, "sparse_reorder: unknown method %d\n", method);
+        exit(1);
+    }
+
+    pt = sparse_pattern_new(A);
+    p = sparse_new_perm(A->nb_line, A->nb_col);
+    if (method == SPARSE_REORDER_RCM) {
+        sparse_perm_rcm(pt, p->col);
+    } else {
+        for (j = 0; j < A->nb_col; j++) {
+            p->col[j] = j;
+        }
+    }
+    sparse_perm_sort_lines(pt, p->col, p->line);
+
+    fprintf(stdout, "sparse_reorder: mean line span %.1f -> %.1f\n",
+            sparse_perm_span(pt, NULL, NULL),
+            sparse_perm_span(pt, p->line, p->col));
+    fflush(stdout);
+
+    sparse_pattern_free(pt);
+    return (p);
+}
+
+static int sparse_perm_item_cmp(const void *a, const void *b)
+{
+    const struct sparse_item_t *ia = (const struct sparse_item_t *) a;
+
+    const struct sparse_item_t *ib = (const struct sparse_item_t *) b;
+
+    return (ia->col_index < ib->col_index ? -1 :
+            ia->col_index > ib->col_index);
+}
+
+/* sort n items on their column, insertion sort for short lines */
+static void sparse_perm_sort_items(struct sparse_item_t *item, long int n)
+{
+    struct sparse_item_t cur;
+
+    long int k, l;
+
+    if (n > 32) {
+        qsort(item, n, sizeof(struct sparse_item_t), sparse_perm_item_cmp);
+        return;
+    }
+    for (k = 1; k < n; k++) {
+        cur = item[k];
+        for (l = k; l > 0 && item[l - 1].col_index > cur.col_index; l--) {
+            item[l] = item[l - 1];
+        }
+        item[l] = cur;
+    }
+}
+
+/** \brief Permuted copy of A : item (i, j) of the result is item
+ (p->line[i], p->col[j]) of A. The result keeps the storage of A, its
+ columns are linked if col_link_status = SPARSE_COL_LINK. **/
+struct sparse_matrix_t *sparse_permute(struct sparse_matrix_t *A,
+                                       struct sparse_perm_t *p,
+                                       int col_link_status)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    struct sparse_matrix_t *a;
+
+    struct sparse_item_t *items;
+
+    long int *new_col, *ptr, i, k, n;
+
+    int nt;
+
+    assert(p->nb_line == A->nb_line && p->nb_col == A->nb_col);
+
+    new_col = (long int *) malloc((A->nb_col + 1) * sizeof(long int));
+    ptr = (long int *) malloc((A->nb_line + 1) * sizeof(long int));
+    assert(new_col && ptr);
+    for (k = 0; k < A->nb_col; k++) {
+        new_col[p->col[k]] = k;
+    }
+
+    /* first item of each permuted line */
+    n = 0;
+    for (i = 0; i < A->nb_line; i++) {
+        struct sparse_item_t *cur_item;
+
+        ptr[i] = n;
+        if (z) {
+            n += z->line_ptr[p->line[i] + 1] - z->line_ptr[p->line[i]];
+            continue;
+        }
+        for (cur_item = A->line[p->line[i]]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            n++;
+        }
+    }
+    ptr[A->nb_line] = n;
+
+    a = new_sparse_matrix_with_storage(A->nb_line, A->nb_col, 0, A->storage);
+    items = n ? sparse_new_items(a, n) : NULL;
+    nt = sparse_work_nb_thread(n);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(dynamic, 1024)
+    for (i = 0; i < A->nb_line; i++) {
+        struct sparse_item_t *cur_item;
+
+        long int l = p->line[i], k, m = ptr[i];
+
+        if (z) {
+            for (k = z->line_ptr[l]; k < z->line_ptr[l + 1]; k++, m++) {
+                items[m].col_index = new_col[SPARSE_LINE_COL(z, k)];
+                items[m].val = SPARSE_LINE_VAL(z, k);
+            }
+        } else {
+            for (cur_item = A->line[l]; cur_item;
+                 cur_item = cur_item->next_in_line, m++) {
+                items[m].col_index = new_col[cur_item->col_index];
+                items[m].val = cur_item->val;
+            }
+        }
+        if (m == ptr[i]) {
+            continue;
+        }
+        sparse_perm_sort_items(items + ptr[i], m - ptr[i]);
+        for (k = ptr[i]; k < m; k++) {
+            items[k].line_index = i;
+            items[k].next_in_col = NULL;
+            items[k].next_in_line = k + 1 < m ? &items[k + 1] : NULL;
+        }
+        a->line[i] = &items[ptr[i]];
+    }
+    a->nb_item = n;
+
+    free(new_col);
+    free(ptr);
+
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
+    return (a);
+}
+
+/* permutation of the lines (what = SPARSE_PERM_LINE) or of the columns
+   (SPARSE_PERM_COL) */
+static long int *sparse_perm_get(struct sparse_perm_t *p, int what,
+                                 struct vector_t *v, char *func)
+{
+    long int n = what == SPARSE_PERM_LINE ? p->nb_line : p->nb_col;
+
+    if (what != SPARSE_PERM_LINE && what != SPARSE_PERM_COL) {
+        fprintf(stderr, "%s: unknown permutation %d\n", func, what);
+        exit(1);
+    }
+    if (v->length != n) {
+        fprintf(stderr, "%s: vector length %ld, permutation %ld\n", func,
+                v->length, n);
+        exit(1);
+    }
+    return (what == SPARSE_PERM_LINE ? p->line : p->col);
+}
+
+/** \brief v in the permuted numbering, e.g. b before solving with the
+ permuted matrix (what = SPARSE_PERM_LINE) **/
+struct vector_t *sparse_perm_to_new(struct sparse_perm_t *p, int what,
+                                    struct vector_t *v)
+{
+    struct vector_t *w;
+
+    long int *perm, k;
+
+    perm = sparse_perm_get(p, what, v, "sparse_perm_to_new");
+    w = new_vector(v->length);
+    for (k = 0; k < v->length; k++) {
+        w->mat[k] = v->mat[perm[k]];
+    }
+    return (w);
+}
+
+/** \brief v in the original numbering, e.g. the solution x of the
+ permuted matrix (what = SPARSE_PERM_COL) **/
+struct vector_t *sparse_perm_to_orig(struct sparse_perm_t *p, int what,
+                                     struct vector_t *v)
+{
+    struct vector_t *w;
+
+    long int *perm, k;
+
+    perm = sparse_perm_get(p, what, v, "sparse_perm_to_orig");
+    w = new_vector(v->length);
+    for (k = 0; k < v->length; k++) {
+        w->mat[perm[k]] = v->mat[k];
+    }
+    return (w);
+}
+
+/** \brief Write p as text : nb_line nb_col, then the original number of
+ each line, then of each column, one per line **/
+void write_sparse_perm(struct sparse_perm_t *p, char *filename)
+{
+    struct writer_t *w;
+
+    long int k;
+
+    w = writer_open(filename);
+    writer_long(w, p->nb_line);
+    writer_char(w, ' ');
+    writer_long(w, p->nb_col);
+    writer_char(w, '\n');
+    for (k = 0; k < p->nb_line; k++) {
+        writer_long(w, p->line[k]);
+        writer_char(w, '\n');
+    }
+    for (k = 0; k < p->nb_col; k++) {
+        writer_long(w, p->col[k]);
+        writer_char(w, '\n');
+    }
+    writer_close(w);
+}
+
+/* read n numbers, each of [0, n) once */
+static void sparse_perm_read(struct reader_t *r, long int n, long int *perm,
+                             char *filename)
+{
+    char *seen;
+
+    long int k;
+
+    seen = (char *) calloc(n + 1, 1);
+    assert(seen);
+    for (k = 0; k < n; k++) {
+        if (reader_long(r, &perm[k]) != 1 || perm[k] < 0 || perm[k] >= n
+            || seen[perm[k]]) {
+            fprintf(stderr, "read_sparse_perm: '%s' bad permutation\n",
+                    filename);
+            exit(1);
+        }
+        seen[perm[k]] = 1;
+    }
+    free(seen);
+}
+
+/** \brief Read a permutation written by write_sparse_perm() **/
+struct sparse_perm_t *read_sparse_perm(char *filename)
+{
+    struct reader_t *r;
+
+    struct sparse_perm_t *p;
+
+    long int nb_line, nb_col;
+
+    r = reader_open(filename);
+    if (reader_long(r, &nb_line) != 1 || reader_long(r, &nb_col) != 1
+        || nb_line < 0 || nb_col < 0) {
+        fprintf(stderr, "read_sparse_perm: '%s' bad header\n", filename);
+        exit(1);
+    }
+    p = sparse_new_perm(nb_line, nb_col);
+    sparse_perm_read(r, nb_line, p->line, filename);
+    sparse_perm_read(r, nb_col, p->col, filename);
+    reader_close(r);
+    return (p);
+}
@@ -0,0 +1,628 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sparse.h"
+#include "sparse_binary.h"
+
+/*
+ * Row partitions (shards) of a matrix : each shard holds a range of lines
+ * with its own column numbering (only the columns it touches), so that a
+ * process only needs its shard file. A*x and A^T*y are computed on the
+ * shard, then combined with the other shards by a reduction
+ * (struct sparse_shard_reduce_t) : lines are gathered, columns summed.
+ */
+
+/* shard k of the file set written by sparse_shard_write() */
+static void sparse_shard_filename(char *filename, size_t size,
+                                  char *basename, int k)
+{
+    snprintf(filename, size, "%s.%d", basename, k);
+}
+
+/* write lines [first, last) of frozen A as shard k */
+static void sparse_shard_write_one(struct sparse_matrix_t *A,
+                                   char *filename, int k, int nb_shard,
+                                   long int first, long int last)
+{
+    struct sparse_shard_header_t header;
+
+    struct sparse_compressed_t *z = A->frozen;
+
+    char block[SPARSE_BINARY_HEADER_SIZE];
+
+    const void *array[SPARSE_SHARD_NB_ARRAY];
+
+    size_t size[SPARSE_SHARD_NB_ARRAY], index_size, val_size;
+
+    long int *local, *col_map, *line_ptr, *col_index = NULL;
+
+    int *col_index32 = NULL;
+
+    long int i, j, q, nb_local_col = 0, nb_item;
+
+    uint64_t h = SPARSE_BINARY_FNV_OFFSET;
+
+    int64_t offset;
+
+    FILE *fd;
+
+    int a;
+
+    /* local number of the touched columns, in increasing order */
+    local = (long int *) malloc(A->nb_col * sizeof(long int));
+    assert(local);
+    for (j = 0; j < A->nb_col; j++) {
+        local[j] = -1;
+    }
+    for (q = z->line_ptr[first]; q < z->line_ptr[last]; q++) {
+        local[SPARSE_LINE_COL(z, q)] = 0;
+    }
+    for (j = 0; j < A->nb_col; j++) {
+        if (!local[j]) {
+            local[j] = nb_local_col++;
+        }
+    }
+    col_map = (long int *) malloc((nb_local_col + 1) * sizeof(long int));
+    assert(col_map);
+    for (j = 0; j < A->nb_col; j++) {
+        if (local[j] >= 0) {
+            col_map[local[j]] = j;
+        }
+    }
+
+    nb_item = z->line_ptr[last] - z->line_ptr[first];
+    line_ptr = (long int *) malloc((last - first + 1) * sizeof(long int));
+    assert(line_ptr);
+    for (i = first; i <= last; i++) {
+        line_ptr[i - first] = z->line_ptr[i] - z->line_ptr[first];
+    }
+    /* the local matrix has 32 bit indices on both sides, as the reader
+       requires */
+    if (nb_local_col <= INT_MAX && last - first <= INT_MAX) {
+        index_size = sizeof(int);
+        col_index32 = (int *) malloc((nb_item + 1) * sizeof(int));
+        assert(col_index32);
+    } else {
+        index_size = sizeof(long int);
+        col_index = (long int *) malloc((nb_item + 1) * sizeof(long int));
+        assert(col_index);
+    }
+    for (q = 0; q < nb_item; q++) {
+        j = local[SPARSE_LINE_COL(z, z->line_ptr[first] + q)];
+        if (col_index32) {
+            col_index32[q] = (int) j;
+        } else {
+            col_index[q] = j;
+        }
+    }
+    free(local);
+
+    /* values are written as they are stored */
+    val_size = z->line_val32 ? sizeof(float) : sizeof(double);
+    array[SPARSE_SHARD_COL_MAP] = col_map;
+    array[SPARSE_SHARD_LINE_PTR] = line_ptr;
+    array[SPARSE_SHARD_COL_INDEX] =
+        col_index32 ? (void *) col_index32 : (void *) col_index;
+    array[SPARSE_SHARD_LINE_VAL] = z->line_val32 ?
+        (void *) (z->line_val32 + z->line_ptr[first]) :
+        (void *) (z->line_val + z->line_ptr[first]);
+    size[SPARSE_SHARD_COL_MAP] = nb_local_col * sizeof(long int);
+    size[SPARSE_SHARD_LINE_PTR] = (last - first + 1) * sizeof(long int);
+    size[SPARSE_SHARD_COL_INDEX] = nb_item * index_size;
+    size[SPARSE_SHARD_LINE_VAL] = nb_item * val_size;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SPARSE_SHARD_MAGIC, 8);
+    header.version = SPARSE_SHARD_VERSION;
+    header.endian = SPARSE_BINARY_ENDIAN;
+    header.storage = (col_index32 ? SPARSE_INDEX_32 : 0)
+        | (z->line_val32 ? SPARSE_VALUE_32 : 0);
+    header.shard = k;
+    header.nb_shard = nb_shard;
+    header.nb_line = A->nb_line;
+    header.nb_col = A->nb_col;
+    header.first_line = first;
+    header.nb_local_line = last - first;
+    header.nb_local_col = nb_local_col;
+    header.nb_item = nb_item;
+    offset = SPARSE_BINARY_HEADER_SIZE;
+    for (a = 0; a < SPARSE_SHARD_NB_ARRAY; a++) {
+        header.offset[a] = offset;
+        offset += sparse_binary_align(size[a]);
+    }
+
+    if (!(fd = fopen(filename, "w"))) {
+        perror(filename);
+        exit(1);
+    }
+    /* header is written again once the checksum is known */
+    memset(block, 0, sizeof(block));
+    if (fwrite(block, 1, sizeof(block), fd) != sizeof(block)) {
+        perror(filename);
+        exit(1);
+    }
+    for (a = 0; a < SPARSE_SHARD_NB_ARRAY; a++) {
+        sparse_binary_write(fd, filename, array[a], size[a], &h);
+    }
+    header.data_checksum = h;
+    header.header_checksum =
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET, &header,
+                               offsetof(struct sparse_shard_header_t,
+                                        header_checksum));
+    memcpy(block, &header, sizeof(header));
+    if (fseeko(fd, 0, SEEK_SET)
+        || fwrite(block, 1, sizeof(block), fd) != sizeof(block)) {
+        perror(filename);
+        exit(1);
+    }
+    fclose(fd);
+
+    free(col_map);
+    free(line_ptr);
+    free(col_index);
+    free(col_index32);
+}
+
+/** \brief Split A in nb_shard row partitions of about the same number of
+ items, written to basename.0 .. basename.<nb_shard - 1>
+
+ A is frozen first if needed. Each file holds its global line range and
+ the global number of the columns it touches (sparse_shard_open()).
+**/
+void sparse_shard_write(struct sparse_matrix_t *A, int nb_shard,
+                        char *basename)
+{
+    int k, nt;
+
+    assert(sizeof(long int) == 8);
+    assert(nb_shard > 0);
+    if (A->storage & SPARSE_VALUE_16) {
+        fprintf(stderr,
+                "sparse_shard_write: 16 bit values can't be written, use SPARSE_VALUE_32\n");
+        exit(1);
+    }
+    sparse_freeze(A);
+    fprintf(stdout, "writing sparse matrix (%p) to %d shards '%s.*' %ld items\n",
+            A, nb_shard, basename, A->nb_item);
+
+    nt = sparse_get_nb_thread();
+    if (nt > nb_shard) {
+        nt = nb_shard;
+    }
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nt) if(nt > 1)
+    for (k = 0; k < nb_shard; k++) {
+        char filename[PATH_MAX];
+
+        sparse_shard_filename(filename, sizeof(filename), basename, k);
+        sparse_shard_write_one(A, filename, k, nb_shard,
+                               sparse_balanced_split(A->frozen->line_ptr,
+                                                     A->nb_line, k,
+                                                     nb_shard),
+                               sparse_balanced_split(A->frozen->line_ptr,
+                                                     A->nb_line, k + 1,
+                                                     nb_shard));
+    }
+}
+
+/* stop on a bad shard file */
+static void sparse_shard_error(char *filename, char *msg)
+{
+    fprintf(stdout, "\n");
+    fprintf(stderr, "sparse_shard_open: '%s' %s\n", filename, msg);
+    exit(1);
+}
+
+/** \brief Map a shard file written by sparse_shard_write()
+
+ The local matrix (nb_local_line x nb_local_col) is frozen and uses the
+ file in place, its column arrays are built in memory. The line range,
+ col_map, line_ptr and the local indices are always checked, check = 1
+ also verifies the data checksum.
+**/
+struct sparse_shard_t *sparse_shard_open(char *filename, int check)
+{
+    struct sparse_shard_header_t header;
+
+    struct sparse_shard_t *s;
+
+    struct sparse_matrix_t *a;
+
+    struct sparse_compressed_t *z;
+
+    struct stat st;
+
+    int64_t count[SPARSE_SHARD_NB_ARRAY], elem[SPARSE_SHARD_NB_ARRAY];
+
+    int64_t index_size, val_size, end, c;
+
+    const long int *col_map;
+
+    char *map;
+
+    int fd, k;
+
+    assert(sizeof(long int) == 8);
+    fprintf(stdout, "reading sparse matrix shard from '%s' ... ", filename);
+    fflush(stdout);
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (fstat(fd, &st)) {
+        perror(filename);
+        exit(1);
+    }
+    if (st.st_size < SPARSE_BINARY_HEADER_SIZE) {
+        sparse_shard_error(filename, "is not a sparse matrix shard");
+    }
+    map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        exit(1);
+    }
+    close(fd);
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, SPARSE_SHARD_MAGIC, 8)
+        || header.header_checksum !=
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET, &header,
+                               offsetof(struct sparse_shard_header_t,
+                                        header_checksum))) {
+        sparse_shard_error(filename, "is not a sparse matrix shard");
+    }
+    if (header.version != SPARSE_SHARD_VERSION
+        || header.endian != SPARSE_BINARY_ENDIAN) {
+        sparse_shard_error(filename, "unsupported version or byte order");
+    }
+    if (header.nb_line < 0 || header.nb_col < 0 || header.first_line < 0
+        || header.nb_local_line < 0 || header.nb_local_line == INT64_MAX
+        || header.first_line > header.nb_line - header.nb_local_line
+        || header.nb_local_col < 0 || header.nb_local_col > header.nb_col
+        || header.nb_item < 0
+        || (header.storage & ~(SPARSE_INDEX_32 | SPARSE_VALUE_32))
+        || ((header.storage & SPARSE_INDEX_32)
+            && (header.nb_local_line > INT_MAX
+                || header.nb_local_col > INT_MAX))) {
+        sparse_shard_error(filename, "invalid header");
+    }
+    index_size = (header.storage & SPARSE_INDEX_32) ?
+        sizeof(int) : sizeof(long int);
+    val_size = (header.storage & SPARSE_VALUE_32) ?
+        sizeof(float) : sizeof(double);
+    count[SPARSE_SHARD_COL_MAP] = header.nb_local_col;
+    count[SPARSE_SHARD_LINE_PTR] = header.nb_local_line + 1;
+    count[SPARSE_SHARD_COL_INDEX] = header.nb_item;
+    count[SPARSE_SHARD_LINE_VAL] = header.nb_item;
+    elem[SPARSE_SHARD_COL_MAP] = sizeof(long int);
+    elem[SPARSE_SHARD_LINE_PTR] = sizeof(long int);
+    elem[SPARSE_SHARD_COL_INDEX] = index_size;
+    elem[SPARSE_SHARD_LINE_VAL] = val_size;
+
+    /* each array, padding included, within the file */
+    end = SPARSE_BINARY_HEADER_SIZE;
+    for (k = 0; k < SPARSE_SHARD_NB_ARRAY; k++) {
+        if (header.offset[k] % 8
+            || header.offset[k] < SPARSE_BINARY_HEADER_SIZE
+            || header.offset[k] > st.st_size
+            || count[k] > (st.st_size - header.offset[k]) / elem[k]
+            || header.offset[k] +
+            (int64_t) sparse_binary_align(count[k] * elem[k]) > st.st_size) {
+            sparse_shard_error(filename, "truncated");
+        }
+        if (header.offset[k] +
+            (int64_t) sparse_binary_align(count[k] * elem[k]) > end) {
+            end = header.offset[k] + sparse_binary_align(count[k] * elem[k]);
+        }
+    }
+    if (check
+        && header.data_checksum !=
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET,
+                               map + SPARSE_BINARY_HEADER_SIZE,
+                               end - SPARSE_BINARY_HEADER_SIZE)) {
+        sparse_shard_error(filename, "corrupted");
+    }
+
+    /* even without the checksum, nothing out of the arrays or of the
+       global vectors is read */
+    col_map = (const long int *) (map + header.offset[SPARSE_SHARD_COL_MAP]);
+    for (c = 0; c < header.nb_local_col; c++) {
+        if (col_map[c] < (c ? col_map[c - 1] + 1 : 0)
+            || col_map[c] >= header.nb_col) {
+            sparse_shard_error(filename, "corrupted");
+        }
+    }
+    sparse_binary_check_ptr("sparse_shard_open", filename,
+                            (long int *) (map +
+                                          header.offset
+                                          [SPARSE_SHARD_LINE_PTR]),
+                            header.nb_local_line, header.nb_item);
+    sparse_binary_check_index("sparse_shard_open", filename,
+                              map + header.offset[SPARSE_SHARD_COL_INDEX],
+                              index_size == sizeof(int), header.nb_item,
+                              header.nb_local_col);
+    fprintf(stdout, "shard %d/%d lines %ld..%ld, %ld columns, %ld items\n",
+            header.shard, header.nb_shard, (long int) header.first_line,
+            (long int) (header.first_line + header.nb_local_line - 1),
+            (long int) header.nb_local_col, (long int) header.nb_item);
+    fflush(stdout);
+
+    /* the local matrix, as read_binary_sparse_matrix() builds it */
+    a = (struct sparse_matrix_t *) calloc(1, sizeof(struct sparse_matrix_t));
+    assert(a);
+    a->nb_line = header.nb_local_line;
+    a->nb_col = header.nb_local_col;
+    a->nb_item = header.nb_item;
+    a->storage = header.storage;
+    z = (struct sparse_compressed_t *)
+        calloc(1, sizeof(struct sparse_compressed_t));
+    assert(z);
+    z->storage = header.storage;
+    z->map = map;
+    z->map_size = st.st_size;
+    z->line_ptr = (long int *) (map + header.offset[SPARSE_SHARD_LINE_PTR]);
+    if (index_size == sizeof(int)) {
+        z->col_index32 = (int *) (map + header.offset[SPARSE_SHARD_COL_INDEX]);
+    } else {
+        z->col_index =
+            (long int *) (map + header.offset[SPARSE_SHARD_COL_INDEX]);
+    }
+    if (val_size == sizeof(float)) {
+        z->line_val32 = (float *) (map + header.offset[SPARSE_SHARD_LINE_VAL]);
+    } else {
+        z->line_val = (double *) (map + header.offset[SPARSE_SHARD_LINE_VAL]);
+    }
+    a->frozen = z;
+    sparse_freeze_col(a);
+
+    s = (struct sparse_shard_t *) calloc(1, sizeof(struct sparse_shard_t));
+    assert(s);
+    s->shard = header.shard;
+    s->nb_shard = header.nb_shard;
+    s->nb_line = header.nb_line;
+    s->nb_col = header.nb_col;
+    s->first_line = header.first_line;
+    s->col_map = (long int *) (map + header.offset[SPARSE_SHARD_COL_MAP]);
+    s->A = a;
+    s->x_local = new_vector(a->nb_col);
+    s->y_local = new_vector(a->nb_line);
+    return (s);
+}
+
+/** \brief Open shard k of the files written by sparse_shard_write() **/
+struct sparse_shard_t *sparse_shard_open_part(char *basename, int k,
+                                              int check)
+{
+    char filename[PATH_MAX];
+
+    sparse_shard_filename(filename, sizeof(filename), basename, k);
+    return (sparse_shard_open(filename, check));
+}
+
+void sparse_shard_close(struct sparse_shard_t *s)
+{
+    free_vector(s->x_local);
+    free_vector(s->y_local);
+    /* col_map belongs to the mapping, released with the matrix */
+    free_sparse_matrix(s->A);
+    free(s);
+}
+
+/** \brief y = y + A*x, x and y being the whole vectors
+
+ The shard computes its lines, red->gather_lines() then brings every
+ shard's lines into y. red = NULL only updates the lines of the shard in
+ the y of the calling process (all the shards used in one process).
+**/
+void sparse_shard_mult_vector(struct sparse_shard_t *s, struct vector_t *x,
+                              struct vector_t *y,
+                              struct sparse_shard_reduce_t *red)
+{
+    long int c, i;
+
+    assert(x->length == s->nb_col);
+    assert(y->length == s->nb_line);
+
+    for (c = 0; c < s->A->nb_col; c++) {
+        s->x_local->mat[c] = x->mat[s->col_map[c]];
+    }
+    memset(s->y_local->mat, 0, s->A->nb_line * sizeof(double));
+    sparse_mult_vector(s->A, s->x_local, s->y_local);
+
+    if (red) {
+        red->gather_lines(red, s, s->y_local->mat, y);
+        return;
+    }
+    for (i = 0; i < s->A->nb_line; i++) {
+        y->mat[s->first_line + i] += s->y_local->mat[i];
+    }
+}
+
+/** \brief x = x + A^T*y, x and y being the whole vectors
+
+ The shard computes the contribution of its lines to the columns it
+ touches, red->sum_cols() then sums the contributions of all the shards
+ into x. red = NULL only adds the shard's own contribution.
+**/
+void sparse_shard_trans_mult_vector(struct sparse_shard_t *s,
+                                    struct vector_t *y, struct vector_t *x,
+                                    struct sparse_shard_reduce_t *red)
+{
+    struct vector_t y_shard;
+
+    long int c;
+
+    assert(x->length == s->nb_col);
+    assert(y->length == s->nb_line);
+
+    /* the lines of the shard, in place */
+    y_shard.length = s->A->nb_line;
+    y_shard.mat = y->mat + s->first_line;
+    memset(s->x_local->mat, 0, s->A->nb_col * sizeof(double));
+    sparse_trans_mult_vector(s->A, &y_shard, s->x_local);
+
+    if (red) {
+        red->sum_cols(red, s, s->x_local->mat, x);
+        return;
+    }
+    for (c = 0; c < s->A->nb_col; c++) {
+        x->mat[s->col_map[c]] += s->x_local->mat[c];
+    }
+}
+
+/** \brief lsqr's aprod on a shard : mode 1 y = y + A*x, mode 2
+ x = x + A^T*y **/
+void sparse_shard_aprod(int mode, struct sparse_shard_t *s,
+                        struct vector_t *x, struct vector_t *y,
+                        struct sparse_shard_reduce_t *red)
+{
+    if (mode == 1) {
+        sparse_shard_mult_vector(s, x, y, red);
+    } else {
+        sparse_shard_trans_mult_vector(s, y, x, red);
+    }
+}
+
+/*
+ * shared memory reduction between nb_shard processes of one machine,
+ * one per shard : a process shared barrier, a column slot per shard and
+ * the lines, in an anonymous shared mapping inherited through fork().
+ */
+struct sparse_shard_shm_t {
+    pthread_barrier_t barrier;
+    int nb_shard;
+    long int nb_line;
+    long int nb_col;
+    size_t size;
+    double *col;                /* nb_shard x nb_col */
+    double *line;               /* nb_line */
+};
+
+static void sparse_shard_shm_gather_lines(struct sparse_shard_reduce_t *red,
+                                          struct sparse_shard_t *s,
+                                          const double *local,
+                                          struct vector_t *y)
+{
+    struct sparse_shard_shm_t *shm = (struct sparse_shard_shm_t *) red->data;
+
+    long int i;
+
+    memcpy(shm->line + s->first_line, local,
+           s->A->nb_line * sizeof(double));
+    pthread_barrier_wait(&shm->barrier);
+    for (i = 0; i < shm->nb_line; i++) {
+        y->mat[i] += shm->line[i];
+    }
+    pthread_barrier_wait(&shm->barrier);
+}
+
+static void sparse_shard_shm_sum_cols(struct sparse_shard_reduce_t *red,
+                                      struct sparse_shard_t *s,
+                                      const double *partial,
+                                      struct vector_t *x)
+{
+    struct sparse_shard_shm_t *shm = (struct sparse_shard_shm_t *) red->data;
+
+    double *slot = shm->col + (long int) s->shard * shm->nb_col;
+
+    long int c, j;
+
+    int nt;
+
+    for (c = 0; c < s->A->nb_col; c++) {
+        slot[s->col_map[c]] = partial[c];
+    }
+    pthread_barrier_wait(&shm->barrier);
+    /* same order of the sums in every process : same x everywhere */
+    nt = sparse_work_nb_thread(shm->nb_col * shm->nb_shard);
+#pragma omp parallel for num_threads(nt) if(nt > 1)
+    for (j = 0; j < shm->nb_col; j++) {
+        double sum = 0.;
+
+        int k;
+
+        for (k = 0; k < shm->nb_shard; k++) {
+            sum += shm->col[(long int) k * shm->nb_col + j];
+        }
+        x->mat[j] += sum;
+    }
+    pthread_barrier_wait(&shm->barrier);
+    /* the slot is all zero for the next call */
+    for (c = 0; c < s->A->nb_col; c++) {
+        slot[s->col_map[c]] = 0.;
+    }
+}
+
+/** \brief Shared memory reduction for nb_shard processes, each one using
+ shard k (sparse_shard_open_part()) of a nb_line x nb_col matrix
+
+ To be created before fork(), every process then calls the shard kernels
+ the same number of times, and sparse_shard_shm_free() at the end. A
+ stand-in for the interconnect (MPI_Allreduce, ...) of a multi-node run.
+**/
+struct sparse_shard_reduce_t *sparse_shard_shm_new(int nb_shard,
+                                                   long int nb_line,
+                                                   long int nb_col)
+{
+    struct sparse_shard_reduce_t *red;
+
+    struct sparse_shard_shm_t *shm;
+
+    pthread_barrierattr_t attr;
+
+    size_t size;
+
+    char *map;
+
+    size = sparse_binary_align(sizeof(struct sparse_shard_shm_t))
+        + ((size_t) nb_shard * nb_col + nb_line) * sizeof(double);
+    map = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("sparse_shard_shm_new");
+        exit(1);
+    }
+    /* the mapping is zero filled */
+    shm = (struct sparse_shard_shm_t *) map;
+    shm->nb_shard = nb_shard;
+    shm->nb_line = nb_line;
+    shm->nb_col = nb_col;
+    shm->size = size;
+    shm->col = (double *)
+        (map + sparse_binary_align(sizeof(struct sparse_shard_shm_t)));
+    shm->line = shm->col + (size_t) nb_shard * nb_col;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (pthread_barrier_init(&shm->barrier, &attr, nb_shard)) {
+        fprintf(stderr, "sparse_shard_shm_new: pthread_barrier_init failed\n");
+        exit(1);
+    }
+    pthread_barrierattr_destroy(&attr);
+
+    red = (struct sparse_shard_reduce_t *)
+        malloc(sizeof(struct sparse_shard_reduce_t));
+    assert(red);
+    red->gather_lines = sparse_shard_shm_gather_lines;
+    red->sum_cols = sparse_shard_shm_sum_cols;
+    red->data = shm;
+    return (red);
+}
+
+/** \brief Release the shared memory reduction in the calling process **/
+void sparse_shard_shm_free(struct sparse_shard_reduce_t *red)
+{
+    struct sparse_shard_shm_t *shm = (struct sparse_shard_shm_t *) red->data;
+
+    munmap(shm, shm->size);
+    free(red);
+}
@@ -0,0 +1,646 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "sparse.h"
+
+/* x86-64 only : the kernels gather through 64 bit long int indices */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SPARSE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Sparse dot products sum(val[k] * x[index[k]]), the inner loop of A*x
+ * (over a compressed line) and of A^T*y (over a compressed column).
+ * One kernel per instruction set and per frozen storage (64/32 bit index,
+ * double/float/bfloat16/half value, always accumulated in double), the
+ * best instruction set supported by the cpu is picked once when the
+ * library is loaded. The 16 bit kernels return the unscaled sum, the
+ * caller multiplies it by the matrix val_scale.
+ *
+ * The delta kernels read delta coded lines (see sparse_delta.c) : index
+ * k is col plus the sum of the 8 or 16 bit gaps 0..k, computed on the fly
+ * (a prefix sum in the vector registers before the gather, only the
+ * running base being carried from one vector to the next), col being
+ * updated to the last index.
+ */
+
+/* bfloat16 is the high half of a float */
+static inline float sparse_bf16_to_float(unsigned short h)
+{
+    unsigned int b = (unsigned int) h << 16;
+
+    float f;
+
+    memcpy(&f, &b, sizeof(f));
+    return (f);
+}
+
+/* round to nearest even, NaN stays a (quiet) NaN */
+static unsigned short sparse_float_to_bf16(float f)
+{
+    unsigned int b;
+
+    memcpy(&b, &f, sizeof(b));
+    if ((b & 0x7fffffff) > 0x7f800000) {
+        return ((unsigned short) ((b >> 16) | 0x40));
+    }
+    b += 0x7fff + ((b >> 16) & 1);
+    return ((unsigned short) (b >> 16));
+}
+
+/* IEEE half : 1 sign, 5 exponent (bias 15), 10 mantissa bits */
+static inline float sparse_fp16_to_float(unsigned short h)
+{
+    unsigned int e = (h >> 10) & 0x1f, m = h & 0x3ff, b;
+
+    float f;
+
+    if (e == 0) {
+        f = (float) m * 5.9604644775390625e-8f;    /* 2^-24 */
+        return ((h & 0x8000) ? -f : f);
+    }
+    b = ((unsigned int) (h & 0x8000) << 16) | (m << 13);
+    b |= (e == 31) ? 0x7f800000 : (e + 112) << 23;
+    memcpy(&f, &b, sizeof(f));
+    return (f);
+}
+
+/* round to nearest even, overflow to infinity, underflow to subnormals
+   then zero */
+static unsigned short sparse_float_to_fp16(float f)
+{
+    unsigned int b, sign, m, r, rem, half, shift;
+
+    memcpy(&b, &f, sizeof(b));
+    sign = (b >> 16) & 0x8000;
+    b &= 0x7fffffff;
+    if (b >= 0x7f800000) {
+        return ((unsigned short) (sign | 0x7c00 |
+                                  (b > 0x7f800000 ? 0x200 : 0)));
+    }
+    if (b >= 0x477ff000) {      /* rounds to 65520 or more */
+        return ((unsigned short) (sign | 0x7c00));
+    }
+    if (b < 0x33000000) {       /* 2^-25 or less */
+        return ((unsigned short) sign);
+    }
+    if (b < 0x38800000) {       /* below 2^-14 : subnormal */
+        m = (b & 0x7fffff) | 0x800000;
+        shift = 126 - (b >> 23);
+        r = m >> shift;
+        rem = m & ((1u << shift) - 1);
+        half = 1u << (shift - 1);
+    } else {
+        r = (b - 0x38000000) >> 13;
+        rem = b & 0x1fff;
+        half = 0x1000;
+    }
+    if (rem > half || (rem == half && (r & 1))) {
+        r++;
+    }
+    return ((unsigned short) (sign | r));
+}
+
+#define SPARSE_CONV(v) ((double) (v))
+#define SPARSE_CONV_BF16(v) ((double) sparse_bf16_to_float(v))
+#define SPARSE_CONV_FP16(v) ((double) sparse_fp16_to_float(v))
+
+#define SPARSE_DOT_GENERIC(name, index_t, val_t, CONV)                  \
+static double name(const index_t *index, const val_t *val,              \
+                   const double *x, long int n)                         \
+{                                                                       \
+    long int k;                                                         \
+    double sum = 0.;                                                    \
+                                                                        \
+    for (k = 0; k < n; k++) {                                           \
+        sum += CONV(val[k]) * x[index[k]];                              \
+    }                                                                   \
+    return (sum);                                                       \
+}
+
+SPARSE_DOT_GENERIC(sparse_dot_generic, long int, double, SPARSE_CONV)
+SPARSE_DOT_GENERIC(sparse_dot_generic_i32, int, double, SPARSE_CONV)
+SPARSE_DOT_GENERIC(sparse_dot_generic_f32, long int, float, SPARSE_CONV)
+SPARSE_DOT_GENERIC(sparse_dot_generic_i32_f32, int, float, SPARSE_CONV)
+SPARSE_DOT_GENERIC(sparse_dot_generic_bf16, long int, unsigned short,
+                   SPARSE_CONV_BF16)
+SPARSE_DOT_GENERIC(sparse_dot_generic_i32_bf16, int, unsigned short,
+                   SPARSE_CONV_BF16)
+SPARSE_DOT_GENERIC(sparse_dot_generic_fp16, long int, unsigned short,
+                   SPARSE_CONV_FP16)
+SPARSE_DOT_GENERIC(sparse_dot_generic_i32_fp16, int, unsigned short,
+                   SPARSE_CONV_FP16)
+
+#define SPARSE_DELTA_GENERIC(name, gap_t, val_t, CONV)                  \
+static double name(const void *gap, long int *col, const void *val,     \
+                   const double *x, long int n)                         \
+{                                                                       \
+    const gap_t *g = (const gap_t *) gap;                               \
+    const val_t *v = (const val_t *) val;                               \
+    long int k, j = *col;                                               \
+    double sum = 0.;                                                    \
+                                                                        \
+    for (k = 0; k < n; k++) {                                           \
+        j += g[k];                                                      \
+        sum += CONV(v[k]) * x[j];                                       \
+    }                                                                   \
+    *col = j;                                                           \
+    return (sum);                                                       \
+}
+
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g8, unsigned char, double,
+                     SPARSE_CONV)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g8_f32, unsigned char, float,
+                     SPARSE_CONV)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g8_bf16, unsigned char,
+                     unsigned short, SPARSE_CONV_BF16)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g8_fp16, unsigned char,
+                     unsigned short, SPARSE_CONV_FP16)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g16, unsigned short, double,
+                     SPARSE_CONV)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g16_f32, unsigned short, float,
+                     SPARSE_CONV)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g16_bf16, unsigned short,
+                     unsigned short, SPARSE_CONV_BF16)
+SPARSE_DELTA_GENERIC(sparse_delta_generic_g16_fp16, unsigned short,
+                     unsigned short, SPARSE_CONV_FP16)
+
+#ifdef SPARSE_X86_SIMD
+/* SSE2 : no gather, x values are loaded by pairs */
+#define SSE2_LOAD64(p) _mm_loadu_pd(p)
+#define SSE2_LOAD32(p) \
+    _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *) (p))))
+
+#define SPARSE_DOT_SSE2(name, index_t, val_t, LOADV)                    \
+__attribute__ ((target("sse2")))                                        \
+static double name(const index_t *index, const val_t *val,              \
+                   const double *x, long int n)                         \
+{                                                                       \
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();           \
+    __m128d xv;                                                         \
+    double tmp[2];                                                      \
+    long int k;                                                         \
+                                                                        \
+    for (k = 0; k + 4 <= n; k += 4) {                                   \
+        xv = _mm_loadh_pd(_mm_load_sd(x + index[k]), x + index[k + 1]); \
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(LOADV(val + k), xv));        \
+        xv = _mm_loadh_pd(_mm_load_sd(x + index[k + 2]),                \
+                          x + index[k + 3]);                            \
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(LOADV(val + k + 2), xv));    \
+    }                                                                   \
+    _mm_storeu_pd(tmp, _mm_add_pd(acc0, acc1));                         \
+    tmp[0] += tmp[1];                                                   \
+    for (; k < n; k++) {                                                \
+        tmp[0] += (double) val[k] * x[index[k]];                        \
+    }                                                                   \
+    return (tmp[0]);                                                    \
+}
+
+SPARSE_DOT_SSE2(sparse_dot_sse2, long int, double, SSE2_LOAD64)
+SPARSE_DOT_SSE2(sparse_dot_sse2_i32, int, double, SSE2_LOAD64)
+SPARSE_DOT_SSE2(sparse_dot_sse2_f32, long int, float, SSE2_LOAD32)
+SPARSE_DOT_SSE2(sparse_dot_sse2_i32_f32, int, float, SSE2_LOAD32)
+
+/* AVX2 : 4 wide gather + fma, 16 bit values are widened with f16c (half)
+   or a shift (bfloat16) */
+#define AVX2_GATHER64(x, p) \
+    _mm256_i64gather_pd(x, _mm256_loadu_si256((const __m256i *) (p)), 8)
+#define AVX2_GATHER32(x, p) \
+    _mm256_i32gather_pd(x, _mm_loadu_si128((const __m128i *) (p)), 8)
+#define AVX2_LOAD64(p) _mm256_loadu_pd(p)
+#define AVX2_LOAD32(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define AVX2_LOADBF16(p)                                                \
+    _mm256_cvtps_pd(_mm_castsi128_ps(_mm_slli_epi32(_mm_cvtepu16_epi32  \
+        (_mm_loadl_epi64((const __m128i *) (p))), 16)))
+#define AVX2_LOADFP16(p) \
+    _mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i *) (p))))
+#define AVX2_CONVFP16(v) ((double) _cvtsh_ss(v))
+
+#define SPARSE_DOT_AVX2(name, index_t, val_t, GATHER, LOADV, CONV)      \
+__attribute__ ((target("avx2,fma,f16c")))                               \
+static double name(const index_t *index, const val_t *val,              \
+                   const double *x, long int n)                         \
+{                                                                       \
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();     \
+    __m128d lo;                                                         \
+    long int k;                                                         \
+    double sum;                                                         \
+                                                                        \
+    for (k = 0; k + 8 <= n; k += 8) {                                   \
+        acc0 = _mm256_fmadd_pd(LOADV(val + k), GATHER(x, index + k),    \
+                               acc0);                                   \
+        acc1 = _mm256_fmadd_pd(LOADV(val + k + 4),                      \
+                               GATHER(x, index + k + 4), acc1);         \
+    }                                                                   \
+    if (k + 4 <= n) {                                                   \
+        acc0 = _mm256_fmadd_pd(LOADV(val + k), GATHER(x, index + k),    \
+                               acc0);                                   \
+        k += 4;                                                         \
+    }                                                                   \
+    acc0 = _mm256_add_pd(acc0, acc1);                                   \
+    lo = _mm_add_pd(_mm256_castpd256_pd128(acc0),                       \
+                    _mm256_extractf128_pd(acc0, 1));                    \
+    sum = _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));       \
+    for (; k < n; k++) {                                                \
+        sum += CONV(val[k]) * x[index[k]];                              \
+    }                                                                   \
+    return (sum);                                                       \
+}
+
+SPARSE_DOT_AVX2(sparse_dot_avx2, long int, double, AVX2_GATHER64,
+                AVX2_LOAD64, SPARSE_CONV)
+SPARSE_DOT_AVX2(sparse_dot_avx2_i32, int, double, AVX2_GATHER32,
+                AVX2_LOAD64, SPARSE_CONV)
+SPARSE_DOT_AVX2(sparse_dot_avx2_f32, long int, float, AVX2_GATHER64,
+                AVX2_LOAD32, SPARSE_CONV)
+SPARSE_DOT_AVX2(sparse_dot_avx2_i32_f32, int, float, AVX2_GATHER32,
+                AVX2_LOAD32, SPARSE_CONV)
+SPARSE_DOT_AVX2(sparse_dot_avx2_bf16, long int, unsigned short,
+                AVX2_GATHER64, AVX2_LOADBF16, SPARSE_CONV_BF16)
+SPARSE_DOT_AVX2(sparse_dot_avx2_i32_bf16, int, unsigned short,
+                AVX2_GATHER32, AVX2_LOADBF16, SPARSE_CONV_BF16)
+SPARSE_DOT_AVX2(sparse_dot_avx2_fp16, long int, unsigned short,
+                AVX2_GATHER64, AVX2_LOADFP16, AVX2_CONVFP16)
+SPARSE_DOT_AVX2(sparse_dot_avx2_i32_fp16, int, unsigned short,
+                AVX2_GATHER32, AVX2_LOADFP16, AVX2_CONVFP16)
+
+/* 4 gaps widened to 64 bit */
+static inline int sparse_load_int(const void *p)
+{
+    int v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v);
+}
+
+#define AVX2_GAP8(p) _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(sparse_load_int(p)))
+#define AVX2_GAP16(p) \
+    _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *) (p)))
+
+#define SPARSE_DELTA_AVX2(name, gap_t, GAP, val_t, LOADV, CONV)         \
+__attribute__ ((target("avx2,fma,f16c")))                               \
+static double name(const void *gap, long int *col, const void *val,     \
+                   const double *x, long int n)                         \
+{                                                                       \
+    const gap_t *g = (const gap_t *) gap;                               \
+    const val_t *v = (const val_t *) val;                               \
+    __m256i zero = _mm256_setzero_si256(), base, idx, tot;              \
+    __m256d acc = _mm256_setzero_pd();                                  \
+    __m128d lo;                                                         \
+    long int k, j;                                                      \
+    double sum;                                                         \
+                                                                        \
+    base = _mm256_set1_epi64x(*col);                                    \
+    for (k = 0; k + 4 <= n; k += 4) {                                   \
+        idx = GAP(g + k);                                               \
+        idx = _mm256_add_epi64(idx, _mm256_blend_epi32                  \
+                               (_mm256_permute4x64_epi64(idx, 0x90),    \
+                                zero, 0x03));                           \
+        idx = _mm256_add_epi64(idx,                                     \
+                               _mm256_permute2x128_si256(idx, idx,      \
+                                                         0x08));        \
+        tot = _mm256_permute4x64_epi64(idx, 0xff);                      \
+        idx = _mm256_add_epi64(idx, base);                              \
+        base = _mm256_add_epi64(base, tot);                             \
+        acc = _mm256_fmadd_pd(LOADV(v + k),                             \
+                              _mm256_i64gather_pd(x, idx, 8), acc);     \
+    }                                                                   \
+    lo = _mm_add_pd(_mm256_castpd256_pd128(acc),                        \
+                    _mm256_extractf128_pd(acc, 1));                     \
+    sum = _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));       \
+    j = _mm_cvtsi128_si64(_mm256_castsi256_si128(base));                \
+    for (; k < n; k++) {                                                \
+        j += g[k];                                                      \
+        sum += CONV(v[k]) * x[j];                                       \
+    }                                                                   \
+    *col = j;                                                           \
+    return (sum);                                                       \
+}
+
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g8, unsigned char, AVX2_GAP8, double,
+                  AVX2_LOAD64, SPARSE_CONV)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g8_f32, unsigned char, AVX2_GAP8, float,
+                  AVX2_LOAD32, SPARSE_CONV)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g8_bf16, unsigned char, AVX2_GAP8,
+                  unsigned short, AVX2_LOADBF16, SPARSE_CONV_BF16)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g8_fp16, unsigned char, AVX2_GAP8,
+                  unsigned short, AVX2_LOADFP16, AVX2_CONVFP16)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g16, unsigned short, AVX2_GAP16,
+                  double, AVX2_LOAD64, SPARSE_CONV)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g16_f32, unsigned short, AVX2_GAP16,
+                  float, AVX2_LOAD32, SPARSE_CONV)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g16_bf16, unsigned short, AVX2_GAP16,
+                  unsigned short, AVX2_LOADBF16, SPARSE_CONV_BF16)
+SPARSE_DELTA_AVX2(sparse_delta_avx2_g16_fp16, unsigned short, AVX2_GAP16,
+                  unsigned short, AVX2_LOADFP16, AVX2_CONVFP16)
+
+/* AVX-512 : 8 wide masked gather + fma, the tail is masked too */
+#define AVX512_GATHER64(mask, x, p)                                     \
+    _mm512_mask_i64gather_pd(_mm512_setzero_pd(), mask,                 \
+                             _mm512_maskz_loadu_epi64(mask, p), x, 8)
+#define AVX512_GATHER32(mask, x, p)                                     \
+    _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask,                 \
+                             _mm512_castsi512_si256                     \
+                             (_mm512_maskz_loadu_epi32                  \
+                              ((__mmask16) (mask), p)), x, 8)
+#define AVX512_LOAD64(mask, p) _mm512_maskz_loadu_pd(mask, p)
+#define AVX512_LOAD32(mask, p)                                          \
+    _mm512_cvtps_pd(_mm512_castps512_ps256                              \
+                    (_mm512_maskz_loadu_ps((__mmask16) (mask), p)))
+
+#define SPARSE_DOT_AVX512(name, index_t, val_t, GATHER, LOADV)          \
+__attribute__ ((target("avx512f")))                                     \
+static double name(const index_t *index, const val_t *val,              \
+                   const double *x, long int n)                         \
+{                                                                       \
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();     \
+    __mmask8 mask;                                                      \
+    long int k;                                                         \
+                                                                        \
+    for (k = 0; k + 16 <= n; k += 16) {                                 \
+        acc0 = _mm512_fmadd_pd(LOADV(0xff, val + k),                    \
+                               GATHER(0xff, x, index + k), acc0);       \
+        acc1 = _mm512_fmadd_pd(LOADV(0xff, val + k + 8),                \
+                               GATHER(0xff, x, index + k + 8), acc1);   \
+    }                                                                   \
+    for (; k < n; k += 8) {                                             \
+        mask = (n - k >= 8) ? 0xff : (__mmask8) ((1 << (n - k)) - 1);   \
+        acc0 = _mm512_fmadd_pd(LOADV(mask, val + k),                    \
+                               GATHER(mask, x, index + k), acc0);       \
+    }                                                                   \
+    return (_mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)));           \
+}
+
+SPARSE_DOT_AVX512(sparse_dot_avx512, long int, double, AVX512_GATHER64,
+                  AVX512_LOAD64)
+SPARSE_DOT_AVX512(sparse_dot_avx512_i32, int, double, AVX512_GATHER32,
+                  AVX512_LOAD64)
+SPARSE_DOT_AVX512(sparse_dot_avx512_f32, long int, float, AVX512_GATHER64,
+                  AVX512_LOAD32)
+SPARSE_DOT_AVX512(sparse_dot_avx512_i32_f32, int, float, AVX512_GATHER32,
+                  AVX512_LOAD32)
+
+/* 8 gaps widened to 64 bit */
+#define AVX512_GAP8(p) \
+    _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *) (p)))
+#define AVX512_GAP16(p) \
+    _mm512_cvtepu16_epi64(_mm_loadu_si128((const __m128i *) (p)))
+
+#define SPARSE_DELTA_AVX512(name, gap_t, GAP, val_t, LOADV)             \
+__attribute__ ((target("avx512f")))                                     \
+static double name(const void *gap, long int *col, const void *val,     \
+                   const double *x, long int n)                         \
+{                                                                       \
+    const gap_t *g = (const gap_t *) gap;                               \
+    const val_t *v = (const val_t *) val;                               \
+    __m512i zero = _mm512_setzero_si512(), last, base, idx, tot;        \
+    __m512d acc = _mm512_setzero_pd();                                  \
+    long int k, j;                                                      \
+    double sum;                                                         \
+                                                                        \
+    last = _mm512_set1_epi64(7);                                        \
+    base = _mm512_set1_epi64(*col);                                     \
+    for (k = 0; k + 8 <= n; k += 8) {                                   \
+        idx = GAP(g + k);                                               \
+        idx = _mm512_add_epi64(idx, _mm512_alignr_epi64(idx, zero, 7)); \
+        idx = _mm512_add_epi64(idx, _mm512_alignr_epi64(idx, zero, 6)); \
+        idx = _mm512_add_epi64(idx, _mm512_alignr_epi64(idx, zero, 4)); \
+        tot = _mm512_permutexvar_epi64(last, idx);                      \
+        idx = _mm512_add_epi64(idx, base);                              \
+        base = _mm512_add_epi64(base, tot);                             \
+        acc = _mm512_fmadd_pd(LOADV(0xff, v + k),                       \
+                              _mm512_i64gather_pd(idx, x, 8), acc);     \
+    }                                                                   \
+    sum = _mm512_reduce_add_pd(acc);                                    \
+    j = _mm_cvtsi128_si64(_mm512_castsi512_si128(base));                \
+    for (; k < n; k++) {                                                \
+        j += g[k];                                                      \
+        sum += (double) v[k] * x[j];                                    \
+    }                                                                   \
+    *col = j;                                                           \
+    return (sum);                                                       \
+}
+
+SPARSE_DELTA_AVX512(sparse_delta_avx512_g8, unsigned char, AVX512_GAP8,
+                    double, AVX512_LOAD64)
+SPARSE_DELTA_AVX512(sparse_delta_avx512_g8_f32, unsigned char, AVX512_GAP8,
+                    float, AVX512_LOAD32)
+SPARSE_DELTA_AVX512(sparse_delta_avx512_g16, unsigned short, AVX512_GAP16,
+                    double, AVX512_LOAD64)
+SPARSE_DELTA_AVX512(sparse_delta_avx512_g16_f32, unsigned short,
+                    AVX512_GAP16, float, AVX512_LOAD32)
+#endif
+
+struct sparse_simd_t {
+    const char *name;
+    double (*dot) (const long int *, const double *, const double *,
+                   long int);
+    double (*dot_i32) (const int *, const double *, const double *,
+                       long int);
+    double (*dot_f32) (const long int *, const float *, const double *,
+                       long int);
+    double (*dot_i32_f32) (const int *, const float *, const double *,
+                           long int);
+    double (*dot_bf16) (const long int *, const unsigned short *,
+                        const double *, long int);
+    double (*dot_i32_bf16) (const int *, const unsigned short *,
+                            const double *, long int);
+    double (*dot_fp16) (const long int *, const unsigned short *,
+                        const double *, long int);
+    double (*dot_i32_fp16) (const int *, const unsigned short *,
+                            const double *, long int);
+    /* [8 bit, 16 bit gaps][double, float, bfloat16, half values] */
+    double (*dot_delta[2][4]) (const void *, long int *, const void *,
+                               const double *, long int);
+};
+
+/* avx512 reuses the avx2 16 bit kernels, sse2 the generic ones */
+static struct sparse_simd_t sparse_simd_kernel[] = {
+#ifdef SPARSE_X86_SIMD
+    {"avx512", sparse_dot_avx512, sparse_dot_avx512_i32,
+     sparse_dot_avx512_f32, sparse_dot_avx512_i32_f32,
+     sparse_dot_avx2_bf16, sparse_dot_avx2_i32_bf16,
+     sparse_dot_avx2_fp16, sparse_dot_avx2_i32_fp16,
+     {{sparse_delta_avx512_g8, sparse_delta_avx512_g8_f32,
+       sparse_delta_avx2_g8_bf16, sparse_delta_avx2_g8_fp16},
+      {sparse_delta_avx512_g16, sparse_delta_avx512_g16_f32,
+       sparse_delta_avx2_g16_bf16, sparse_delta_avx2_g16_fp16}}},
+    {"avx2", sparse_dot_avx2, sparse_dot_avx2_i32,
+     sparse_dot_avx2_f32, sparse_dot_avx2_i32_f32,
+     sparse_dot_avx2_bf16, sparse_dot_avx2_i32_bf16,
+     sparse_dot_avx2_fp16, sparse_dot_avx2_i32_fp16,
+     {{sparse_delta_avx2_g8, sparse_delta_avx2_g8_f32,
+       sparse_delta_avx2_g8_bf16, sparse_delta_avx2_g8_fp16},
+      {sparse_delta_avx2_g16, sparse_delta_avx2_g16_f32,
+       sparse_delta_avx2_g16_bf16, sparse_delta_avx2_g16_fp16}}},
+    {"sse2", sparse_dot_sse2, sparse_dot_sse2_i32,
+     sparse_dot_sse2_f32, sparse_dot_sse2_i32_f32,
+     sparse_dot_generic_bf16, sparse_dot_generic_i32_bf16,
+     sparse_dot_generic_fp16, sparse_dot_generic_i32_fp16,
+     {{sparse_delta_generic_g8, sparse_delta_generic_g8_f32,
+       sparse_delta_generic_g8_bf16, sparse_delta_generic_g8_fp16},
+      {sparse_delta_generic_g16, sparse_delta_generic_g16_f32,
+       sparse_delta_generic_g16_bf16, sparse_delta_generic_g16_fp16}}},
+#endif
+    {"generic", sparse_dot_generic, sparse_dot_generic_i32,
+     sparse_dot_generic_f32, sparse_dot_generic_i32_f32,
+     sparse_dot_generic_bf16, sparse_dot_generic_i32_bf16,
+     sparse_dot_generic_fp16, sparse_dot_generic_i32_fp16,
+     {{sparse_delta_generic_g8, sparse_delta_generic_g8_f32,
+       sparse_delta_generic_g8_bf16, sparse_delta_generic_g8_fp16},
+      {sparse_delta_generic_g16, sparse_delta_generic_g16_f32,
+       sparse_delta_generic_g16_bf16, sparse_delta_generic_g16_fp16}}},
+    {NULL}
+};
+
+static struct sparse_simd_t *sparse_simd = NULL;
+
+static int sparse_simd_supported(const char *name)
+{
+#ifdef SPARSE_X86_SIMD
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx512")) {
+        return (__builtin_cpu_supports("avx512f")
+                && __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma")
+                && __builtin_cpu_supports("f16c"));
+    }
+    if (!strcmp(name, "avx2")) {
+        return (__builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma")
+                && __builtin_cpu_supports("f16c"));
+    }
+    if (!strcmp(name, "sse2")) {
+        return (__builtin_cpu_supports("sse2"));
+    }
+#endif
+    return (!strcmp(name, "generic"));
+}
+
+/** \brief select the dot product kernels by name (avx512, avx2, sse2,
+ generic), return 0 if they are not available on this cpu **/
+int sparse_set_simd(const char *name)
+{
+    struct sparse_simd_t *k;
+
+    for (k = sparse_simd_kernel; k->name; k++) {
+        if (!strcmp(k->name, name)) {
+            if (!sparse_simd_supported(name)) {
+                return (0);
+            }
+            sparse_simd = k;
+            return (1);
+        }
+    }
+    return (0);
+}
+
+const char *sparse_get_simd(void)
+{
+    return (sparse_simd->name);
+}
+
+/*
+ * picks the best kernels when the library is loaded, SPARSE_SIMD in the
+ * environment forces a given set
+ */
+__attribute__ ((constructor))
+static void sparse_simd_init(void)
+{
+    struct sparse_simd_t *k;
+
+    char *env;
+
+    env = getenv("SPARSE_SIMD");
+    if (env && sparse_set_simd(env)) {
+        return;
+    }
+    for (k = sparse_simd_kernel; k->name; k++) {
+        if (sparse_simd_supported(k->name)) {
+            sparse_simd = k;
+            return;
+        }
+    }
+}
+
+/** \brief sum(val[k] * x[index[k]]) for k in [0, n) **/
+double sparse_dot(const long int *index, const double *val,
+                  const double *x, long int n)
+{
+    return (sparse_simd->dot(index, val, x, n));
+}
+
+double sparse_dot_index32(const int *index, const double *val,
+                          const double *x, long int n)
+{
+    return (sparse_simd->dot_i32(index, val, x, n));
+}
+
+double sparse_dot_value32(const long int *index, const float *val,
+                          const double *x, long int n)
+{
+    return (sparse_simd->dot_f32(index, val, x, n));
+}
+
+double sparse_dot_index32_value32(const int *index, const float *val,
+                                  const double *x, long int n)
+{
+    return (sparse_simd->dot_i32_f32(index, val, x, n));
+}
+
+/** \brief sum(val[k] * x[index[k]]) with SPARSE_VALUE_BF16 or
+ SPARSE_VALUE_FP16 values (storage), unscaled **/
+double sparse_dot_value16(const long int *index, const unsigned short *val,
+                          const double *x, long int n, int storage)
+{
+    if (storage & SPARSE_VALUE_BF16) {
+        return (sparse_simd->dot_bf16(index, val, x, n));
+    }
+    return (sparse_simd->dot_fp16(index, val, x, n));
+}
+
+double sparse_dot_index32_value16(const int *index,
+                                  const unsigned short *val,
+                                  const double *x, long int n, int storage)
+{
+    if (storage & SPARSE_VALUE_BF16) {
+        return (sparse_simd->dot_i32_bf16(index, val, x, n));
+    }
+    return (sparse_simd->dot_i32_fp16(index, val, x, n));
+}
+
+/** \brief round v to a SPARSE_VALUE_BF16 or SPARSE_VALUE_FP16 value **/
+unsigned short sparse_double_to_value16(double v, int storage)
+{
+    if (storage & SPARSE_VALUE_BF16) {
+        return (sparse_float_to_bf16((float) v));
+    }
+    return (sparse_float_to_fp16((float) v));
+}
+
+double sparse_value16_to_double(unsigned short h, int storage)
+{
+    if (storage & SPARSE_VALUE_BF16) {
+        return (SPARSE_CONV_BF16(h));
+    }
+    return (SPARSE_CONV_FP16(h));
+}
+
+/** \brief sum(val[k] * x[col + gap[0] + .. + gap[k]]) for k in [0, n),
+ gaps being 1 or 2 bytes wide (width), values of the given storage
+ (16 bit ones unscaled). col becomes the last index. **/
+double sparse_dot_delta(int width, const void *gap, long int *col,
+                        const void *val, int storage, const double *x,
+                        long int n)
+{
+    int v = (storage & SPARSE_VALUE_BF16) ? 2 :
+        (storage & SPARSE_VALUE_FP16) ? 3 :
+        (storage & SPARSE_VALUE_32) ? 1 : 0;
+
+    assert(width == 1 || width == 2);
+    return (sparse_simd->dot_delta[width - 1][v] (gap, col, val, x, n));
+}
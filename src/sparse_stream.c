@@ -0,0 +1,857 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sparse.h"
+#include "sparse_binary.h"
+#include "reader.h"
+
+/*
+ * Out-of-core products : the matrix stays in a binary file, y = A*x and
+ * x = A^T*y go through it block by block. While block k is used by the
+ * OpenMP threads, a pthread reads block k+1 (pread into the other buffer),
+ * so the disk and the CPUs work at the same time.
+ *
+ * A*x reads the line arrays. A^T*y reads the column arrays if the file has
+ * some (gather, same as A*x), otherwise the line arrays again (scatter :
+ * each part of the lines adds into its own copy of x, the copies being
+ * summed at the end, so nb_col doubles per thread).
+ *
+ * The overlap of the reads with the products has not been measured : a
+ * single pthread reads one block ahead, it only helps if a block takes
+ * about as long to read as to multiply, and not at all when the file is
+ * in the page cache.
+ */
+
+#define SPARSE_STREAM_BLOCK_BYTES (64L << 20)
+#define SPARSE_STREAM_WRITE_BYTES (16L << 20)
+
+struct sparse_stream_block_t {
+    struct sparse_stream_t *s;
+    int array;
+    long int first_item;
+    long int nb_item;
+    char *buf;
+};
+
+/* read n bytes at offset, exit on error */
+static void sparse_stream_pread(int fd, char *filename, void *buf, size_t n,
+                                off_t offset)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = pread(fd, buf, n, offset);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            perror(filename);
+            exit(1);
+        }
+        if (r == 0) {
+            fprintf(stderr, "sparse_stream: '%s' truncated\n", filename);
+            exit(1);
+        }
+        buf = (char *) buf + r;
+        n -= r;
+        offset += r;
+    }
+}
+
+/* write n bytes at offset, exit on error */
+static void sparse_stream_pwrite(int fd, char *filename, const void *buf,
+                                 size_t n, off_t offset)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = pwrite(fd, buf, n, offset);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            perror(filename);
+            exit(1);
+        }
+        buf = (const char *) buf + r;
+        n -= r;
+        offset += r;
+    }
+}
+
+/* values of a block buffer start after the indices */
+static size_t sparse_stream_val_offset(struct sparse_stream_t *s)
+{
+    return (sparse_binary_align(s->block_item * s->index_size));
+}
+
+/* read a block : indices and values of the items [first_item,
+   first_item+nb_item) of the line (array = SPARSE_BINARY_COL_INDEX) or
+   column (SPARSE_BINARY_LINE_INDEX) arrays. Thread entry point. */
+static void *sparse_stream_read_block(void *arg)
+{
+    struct sparse_stream_block_t *b = (struct sparse_stream_block_t *) arg;
+
+    struct sparse_stream_t *s = b->s;
+
+    sparse_stream_pread(s->fd, s->filename, b->buf,
+                        b->nb_item * s->index_size,
+                        s->offset[b->array] +
+                        b->first_item * s->index_size);
+    sparse_stream_pread(s->fd, s->filename,
+                        b->buf + sparse_stream_val_offset(s),
+                        b->nb_item * s->val_size,
+                        s->offset[b->array + 1] +
+                        b->first_item * s->val_size);
+    return (NULL);
+}
+
+/* end of the block starting at first : as many lines (columns) as
+   possible within block_item items */
+static long int sparse_stream_block_end(const long int *ptr, long int n,
+                                        long int first,
+                                        long int block_item)
+{
+    long int lo = first + 1, hi = n, mid;
+
+    while (lo < hi) {
+        mid = hi - (hi - lo) / 2;
+        if (ptr[mid] - ptr[first] <= block_item) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return (lo);
+}
+
+/* out[first..last) += block . in, lines shared among threads by number of
+   items */
+static void sparse_stream_gather(struct sparse_stream_block_t *b,
+                                 const long int *ptr, long int first,
+                                 long int last, const double *in,
+                                 double *out)
+{
+    struct sparse_stream_t *s = b->s;
+
+    const char *index = b->buf;
+
+    const char *val = b->buf + sparse_stream_val_offset(s);
+
+    int nt = sparse_work_nb_thread(b->nb_item);
+
+    int t;
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1)
+    for (t = 0; t < nt; t++) {
+        long int i, end;
+
+        i = first + sparse_balanced_split(ptr + first, last - first, t, nt);
+        end = first + sparse_balanced_split(ptr + first, last - first,
+                                            t + 1, nt);
+        for (; i < end; i++) {
+            out[i] += sparse_dot_storage(s->storage, index, val,
+                                         ptr[i] - b->first_item,
+                                         ptr[i + 1] - ptr[i], in);
+        }
+    }
+}
+
+/* out[p] += block^T . in[first..last), the lines being split in nt parts
+   by number of items, part p adding into out[p] */
+static void sparse_stream_scatter(struct sparse_stream_block_t *b,
+                                  const long int *ptr, long int first,
+                                  long int last, const double *in,
+                                  double **out, int nt)
+{
+    struct sparse_stream_t *s = b->s;
+
+    const char *index = b->buf;
+
+    const char *val = b->buf + sparse_stream_val_offset(s);
+
+    int p;
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(static, 1)
+    for (p = 0; p < nt; p++) {
+        long int i, j, k, end;
+
+        double yi, v;
+
+        i = first + sparse_balanced_split(ptr + first, last - first, p, nt);
+        end = first + sparse_balanced_split(ptr + first, last - first,
+                                            p + 1, nt);
+        for (; i < end; i++) {
+            yi = in[i];
+            if (yi == 0.) {
+                continue;
+            }
+            for (k = ptr[i] - b->first_item;
+                 k < ptr[i + 1] - b->first_item; k++) {
+                j = (s->storage & SPARSE_INDEX_32) ?
+                    (long int) ((const int *) index)[k] :
+                    ((const long int *) index)[k];
+                v = (s->storage & SPARSE_VALUE_32) ?
+                    (double) ((const float *) val)[k] :
+                    ((const double *) val)[k];
+                out[p][j] += v * yi;
+            }
+        }
+    }
+}
+
+/* go through the line (col = 0) or column (col = 1) arrays, reading
+   block k+1 while block k is used */
+static void sparse_stream_run(struct sparse_stream_t *s, int col,
+                              int scatter, const double *in, double *out)
+{
+    struct sparse_stream_block_t block[2];
+
+    const long int *ptr = col ? s->col_ptr : s->line_ptr;
+
+    long int n = col ? s->nb_col : s->nb_line;
+
+    long int first, last, next = 0, j;
+
+    pthread_t thread;
+
+    double **acc = NULL;
+
+    int cur = 0, ahead, k, nt = 1;
+
+    if (n == 0) {
+        return;
+    }
+    /* part 0 of the scatter adds into out, the others apart */
+    if (scatter) {
+        nt = sparse_work_nb_thread(s->nb_item);
+        acc = (double **) malloc(nt * sizeof(double *));
+        assert(acc);
+        acc[0] = out;
+        for (k = 1; k < nt; k++) {
+            acc[k] = (double *) calloc(s->nb_col, sizeof(double));
+            assert(acc[k] || !s->nb_col);
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        block[k].s = s;
+        block[k].array =
+            col ? SPARSE_BINARY_LINE_INDEX : SPARSE_BINARY_COL_INDEX;
+        block[k].buf = s->buf[k];
+    }
+
+    first = 0;
+    last = sparse_stream_block_end(ptr, n, first, s->block_item);
+    block[cur].first_item = ptr[first];
+    block[cur].nb_item = ptr[last] - ptr[first];
+    sparse_stream_read_block(&block[cur]);
+
+    while (first < n) {
+        ahead = 0;
+        if (last < n) {
+            next = sparse_stream_block_end(ptr, n, last, s->block_item);
+            block[1 - cur].first_item = ptr[last];
+            block[1 - cur].nb_item = ptr[next] - ptr[last];
+            if (pthread_create(&thread, NULL, sparse_stream_read_block,
+                               &block[1 - cur])) {
+                fprintf(stderr,
+                        "sparse_stream: can't start the read ahead thread\n");
+                exit(1);
+            }
+            ahead = 1;
+        }
+        /* the file is not trusted : indices of each block are checked
+           before use */
+        sparse_binary_check_index("sparse_stream", s->filename,
+                                  block[cur].buf,
+                                  (s->storage & SPARSE_INDEX_32) != 0,
+                                  block[cur].nb_item,
+                                  col ? s->nb_line : s->nb_col);
+        if (scatter) {
+            sparse_stream_scatter(&block[cur], ptr, first, last, in, acc,
+                                  nt);
+        } else {
+            sparse_stream_gather(&block[cur], ptr, first, last, in, out);
+        }
+        if (ahead) {
+            pthread_join(thread, NULL);
+        }
+        first = last;
+        last = next;
+        cur = 1 - cur;
+    }
+
+    if (scatter) {
+#pragma omp parallel for num_threads(nt) if(nt > 1) private(k)
+        for (j = 0; j < s->nb_col; j++) {
+            for (k = 1; k < nt; k++) {
+                out[j] += acc[k][j];
+            }
+        }
+        for (k = 1; k < nt; k++) {
+            free(acc[k]);
+        }
+        free(acc);
+    }
+}
+
+/* longest line (column) */
+static long int sparse_stream_max_length(const long int *ptr, long int n)
+{
+    long int i, max = 0;
+
+    for (i = 0; i < n; i++) {
+        if (ptr[i + 1] - ptr[i] > max) {
+            max = ptr[i + 1] - ptr[i];
+        }
+    }
+    return (max);
+}
+
+/* read a line_ptr / col_ptr array and check it */
+static long int *sparse_stream_read_ptr(struct sparse_stream_t *s,
+                                        long int n, int array)
+{
+    long int *ptr;
+
+    ptr = (long int *) malloc((n + 1) * sizeof(long int));
+    assert(ptr);
+    sparse_stream_pread(s->fd, s->filename, ptr, (n + 1) * sizeof(long int),
+                        s->offset[array]);
+    sparse_binary_check_ptr("sparse_stream_open", s->filename, ptr, n,
+                            s->nb_item);
+    return (ptr);
+}
+
+/** \brief Open a binary sparse matrix file (see write_binary_sparse_matrix)
+ for out-of-core products
+
+ Only line_ptr (and col_ptr) are loaded, items are read by blocks of about
+ block_bytes bytes (0 = 64 MB), two blocks being in memory at a time. The
+ data checksum is not verified (it would read the whole file).
+**/
+struct sparse_stream_t *sparse_stream_open(char *filename,
+                                           size_t block_bytes)
+{
+    struct sparse_binary_header_t header;
+
+    struct sparse_stream_t *s;
+
+    char block[SPARSE_BINARY_HEADER_SIZE];
+
+    struct stat st;
+
+    long int max;
+
+    int k;
+
+    assert(sizeof(long int) == 8);
+    fprintf(stdout, "opening sparse matrix stream '%s' ... ", filename);
+    fflush(stdout);
+
+    s = (struct sparse_stream_t *) calloc(1, sizeof(struct sparse_stream_t));
+    assert(s);
+    s->filename = strdup(filename);
+    assert(s->filename);
+    if ((s->fd = open(filename, O_RDONLY)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (fstat(s->fd, &st)) {
+        perror(filename);
+        exit(1);
+    }
+    memset(block, 0, sizeof(block));
+    sparse_stream_pread(s->fd, filename, block,
+                        st.st_size < SPARSE_BINARY_HEADER_SIZE ?
+                        st.st_size : SPARSE_BINARY_HEADER_SIZE, 0);
+    sparse_binary_check_header("sparse_stream_open", filename, block,
+                               st.st_size, &header);
+
+    s->storage = header.storage;
+    s->with_col = (header.flags & SPARSE_BINARY_COL) != 0;
+    s->nb_line = header.nb_line;
+    s->nb_col = header.nb_col;
+    s->nb_item = header.nb_item;
+    for (k = 0; k < SPARSE_BINARY_NB_ARRAY; k++) {
+        s->offset[k] = header.offset[k];
+    }
+    s->index_size = (s->storage & SPARSE_INDEX_32) ?
+        sizeof(int) : sizeof(long int);
+    s->val_size = (s->storage & SPARSE_VALUE_32) ?
+        sizeof(float) : sizeof(double);
+
+    s->line_ptr = sparse_stream_read_ptr(s, s->nb_line,
+                                         SPARSE_BINARY_LINE_PTR);
+    max = sparse_stream_max_length(s->line_ptr, s->nb_line);
+    if (s->with_col) {
+        s->col_ptr = sparse_stream_read_ptr(s, s->nb_col,
+                                            SPARSE_BINARY_COL_PTR);
+        if (sparse_stream_max_length(s->col_ptr, s->nb_col) > max) {
+            max = sparse_stream_max_length(s->col_ptr, s->nb_col);
+        }
+    }
+
+    /* a block holds at least the longest line (column) */
+    if (!block_bytes) {
+        block_bytes = SPARSE_STREAM_BLOCK_BYTES;
+    }
+    s->block_item = block_bytes / (s->index_size + s->val_size);
+    if (s->block_item < max) {
+        s->block_item = max;
+    }
+    if (s->block_item < 1) {
+        s->block_item = 1;
+    }
+    for (k = 0; k < 2; k++) {
+        s->buf[k] = (char *) malloc(sparse_stream_val_offset(s) +
+                                    s->block_item * s->val_size);
+        assert(s->buf[k]);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    fprintf(stdout, "(%ldx%ld) %ld items, blocks of %ld items\n",
+            s->nb_line, s->nb_col, s->nb_item, s->block_item);
+    fflush(stdout);
+    return (s);
+}
+
+void sparse_stream_close(struct sparse_stream_t *s)
+{
+    if (!s) {
+        return;
+    }
+    close(s->fd);
+    free(s->buf[0]);
+    free(s->buf[1]);
+    free(s->line_ptr);
+    free(s->col_ptr);
+    free(s->filename);
+    free(s);
+}
+
+/** \brief y = y + A*x, A being read from its file **/
+void sparse_stream_mult_vector(struct sparse_stream_t *s,
+                               struct vector_t *x, struct vector_t *y)
+{
+    assert(x->length == s->nb_col);
+    assert(y->length == s->nb_line);
+
+    sparse_stream_run(s, 0, 0, x->mat, y->mat);
+}
+
+/** \brief x = x + A^T*y, A being read from its file (column arrays if
+ any) **/
+void sparse_stream_trans_mult_vector(struct sparse_stream_t *s,
+                                     struct vector_t *y,
+                                     struct vector_t *x)
+{
+    assert(x->length == s->nb_col);
+    assert(y->length == s->nb_line);
+
+    if (s->with_col) {
+        sparse_stream_run(s, 1, 0, y->mat, x->mat);
+    } else {
+        sparse_stream_run(s, 0, 1, y->mat, x->mat);
+    }
+}
+
+/** \brief lsqr style product on a streamed matrix :
+
+ mode = 1 : y = y + A*x
+ mode = 2 : x = x + A^T*y
+**/
+void sparse_stream_aprod(int mode, struct sparse_stream_t *s,
+                         struct vector_t *x, struct vector_t *y)
+{
+    if (mode == 1) {
+        sparse_stream_mult_vector(s, x, y);
+    } else if (mode == 2) {
+        sparse_stream_trans_mult_vector(s, y, x);
+    } else {
+        fprintf(stderr, "sparse_stream_aprod: unknown mode %d\n", mode);
+        exit(1);
+    }
+}
+
+/*
+ * text to binary conversion without the matrix in memory
+ */
+
+/* pwrite combining consecutive writes */
+struct sparse_stream_writer_t {
+    int fd;
+    char *filename;
+    off_t offset;
+    size_t used;
+    char *buf;
+};
+
+static void sparse_stream_flush(struct sparse_stream_writer_t *w)
+{
+    if (w->used) {
+        sparse_stream_pwrite(w->fd, w->filename, w->buf, w->used,
+                             w->offset);
+    }
+    w->used = 0;
+}
+
+static void sparse_stream_put(struct sparse_stream_writer_t *w,
+                              off_t offset, const void *data, size_t n)
+{
+    if (w->used && offset != w->offset + (off_t) w->used) {
+        sparse_stream_flush(w);
+    }
+    if (w->used + n > SPARSE_STREAM_WRITE_BYTES) {
+        sparse_stream_flush(w);
+    }
+    if (n > SPARSE_STREAM_WRITE_BYTES) {
+        sparse_stream_pwrite(w->fd, w->filename, data, n, offset);
+        return;
+    }
+    if (!w->used) {
+        w->offset = offset;
+    }
+    memcpy(w->buf + w->used, data, n);
+    w->used += n;
+}
+
+struct sparse_stream_item_t {
+    long int col;
+    long int rank;
+    double val;
+};
+
+static int sparse_stream_item_cmp(const void *a, const void *b)
+{
+    const struct sparse_stream_item_t *u = a, *v = b;
+
+    if (u->col != v->col) {
+        return (u->col < v->col ? -1 : 1);
+    }
+    return (u->rank < v->rank ? -1 : u->rank > v->rank);
+}
+
+/*
+ * one pass over the text file. Items of a line are sorted by column,
+ * duplicates are summed (as sparse_set_value does) and their number is
+ * returned. Without writer, counts the items of each line into count[] ;
+ * with writers, writes them at line_ptr[line] in the index / value arrays.
+ */
+static long int sparse_stream_text_pass(char *filename, long int m, long int n,
+                                    long int *count, char *seen,
+                                    const long int *line_ptr, int storage,
+                                    struct sparse_stream_writer_t *w_index,
+                                    off_t index_offset,
+                                    struct sparse_stream_writer_t *w_val,
+                                    off_t val_offset)
+{
+    struct reader_t *fd;
+
+    struct sparse_stream_item_t *item = NULL;
+
+    char *index_buf = NULL, *val_buf = NULL;
+
+    long int size = 0, rayid, nb_item, j, k, nb, index, skip;
+
+    long int nb_duplicate = 0;
+
+    double val;
+
+    int nb_read, sorted;
+
+    /* (m,n) already checked */
+    fd = reader_open(filename);
+    reader_long(fd, &skip);
+    reader_long(fd, &skip);
+
+    while (!reader_eof(fd)) {
+        nb_read = reader_long(fd, &rayid);
+        nb_read += (nb_read == 1) && reader_long(fd, &nb_item);
+        if (nb_read != 2) {
+            fprintf(stdout, "\n");
+            fprintf(stderr,
+                    "sparse_text_to_binary_stream: file '%s' corrupted nread=%d\n",
+                    filename, nb_read);
+            exit(1);
+        }
+        if (rayid < 0 || rayid >= m || nb_item < 0) {
+            fprintf(stdout, "\n");
+            fprintf(stderr,
+                    "sparse_text_to_binary_stream: bad line %ld (%ld items) in '%s'\n",
+                    rayid, nb_item, filename);
+            exit(1);
+        }
+        if (nb_item > size) {
+            size = nb_item;
+            item = (struct sparse_stream_item_t *)
+                realloc(item, size * sizeof(struct sparse_stream_item_t));
+            index_buf = (char *) realloc(index_buf, size * sizeof(long int));
+            val_buf = (char *) realloc(val_buf, size * sizeof(double));
+            assert(item && index_buf && val_buf);
+        }
+
+        sorted = 1;
+        for (j = 0; j < nb_item; j++) {
+            nb_read = reader_long(fd, &index);
+            nb_read += (nb_read == 1) && reader_double(fd, &val);
+            if (nb_read != 2) {
+                if (reader_eof(fd)) {
+                    break;
+                }
+                fprintf(stdout, "\n");
+                fprintf(stderr,
+                        "sparse_text_to_binary_stream: error reading item (%ld,%ld) in '%s' nread=%d\n",
+                        rayid, j, filename, nb_read);
+                exit(1);
+            }
+            if (index < 0 || index >= n) {
+                fprintf(stdout, "\n");
+                fprintf(stderr,
+                        "sparse_text_to_binary_stream: bad column %ld line %ld in '%s'\n",
+                        index, rayid, filename);
+                exit(1);
+            }
+            item[j].col = index;
+            item[j].rank = j;
+            item[j].val = val;
+            if (j > 0 && item[j - 1].col >= index) {
+                sorted = 0;
+            }
+        }
+        nb_item = j;
+
+        /* sort, sum duplicates */
+        nb = nb_item;
+        if (!sorted) {
+            qsort(item, nb_item, sizeof(struct sparse_stream_item_t),
+                  sparse_stream_item_cmp);
+            nb = 0;
+            for (j = 0; j < nb_item; j++) {
+                if (nb > 0 && item[nb - 1].col == item[j].col) {
+                    item[nb - 1].val += item[j].val;
+                    nb_duplicate++;
+                } else {
+                    item[nb++] = item[j];
+                }
+            }
+        }
+
+        if (!w_index) {
+            if (seen[rayid]) {
+                fprintf(stdout, "\n");
+                fprintf(stderr,
+                        "sparse_text_to_binary_stream: line %ld is split in several records in '%s', use sparse_text_to_binary()\n",
+                        rayid, filename);
+                exit(1);
+            }
+            seen[rayid] = 1;
+            count[rayid] = nb;
+            continue;
+        }
+
+        for (k = 0; k < nb; k++) {
+            if (storage & SPARSE_INDEX_32) {
+                ((int *) index_buf)[k] = (int) item[k].col;
+            } else {
+                ((long int *) index_buf)[k] = item[k].col;
+            }
+            if (storage & SPARSE_VALUE_32) {
+                ((float *) val_buf)[k] = (float) item[k].val;
+            } else {
+                ((double *) val_buf)[k] = item[k].val;
+            }
+        }
+        k = (storage & SPARSE_INDEX_32) ? sizeof(int) : sizeof(long int);
+        sparse_stream_put(w_index, index_offset + line_ptr[rayid] * k,
+                          index_buf, nb * k);
+        k = (storage & SPARSE_VALUE_32) ? sizeof(float) : sizeof(double);
+        sparse_stream_put(w_val, val_offset + line_ptr[rayid] * k,
+                          val_buf, nb * k);
+    }
+
+    reader_close(fd);
+    free(item);
+    free(index_buf);
+    free(val_buf);
+    return (nb_duplicate);
+}
+
+/** \brief Convert a text sparse matrix file (read_sparse_matrix format) to a
+ binary one (line arrays only) without loading the matrix
+
+ The text file is read twice : items are counted per line, then written in
+ place. Memory use is about 9 bytes per line. Each line must be in a single
+ record (lines may come in any order), sparse_text_to_binary() handles the
+ other files.
+**/
+void sparse_text_to_binary_stream(char *text_filename,
+                                  char *binary_filename, int storage)
+{
+    struct sparse_binary_header_t header;
+
+    struct sparse_stream_writer_t w_index, w_val;
+
+    struct reader_t *fd;
+
+    char block[SPARSE_BINARY_HEADER_SIZE];
+
+    size_t index_size, val_size;
+
+    uint64_t h = SPARSE_BINARY_FNV_OFFSET;
+
+    long int m, n, i, sum, *line_ptr, nb_duplicate;
+
+    int64_t offset;
+
+    off_t pos;
+
+    char *seen;
+
+    int nb_read, out;
+
+    assert(sizeof(long int) == 8);
+    fprintf(stdout, "converting sparse matrix '%s' to '%s' ... ",
+            text_filename, binary_filename);
+    fflush(stdout);
+
+    fd = reader_open(text_filename);
+    nb_read = reader_long(fd, &m);
+    nb_read += (nb_read == 1) && reader_long(fd, &n);
+    reader_close(fd);
+    if (nb_read != 2 || m < 0 || n < 0) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "sparse_text_to_binary_stream: error reading (m,n) in '%s'\n",
+                text_filename);
+        exit(1);
+    }
+    if ((storage & SPARSE_INDEX_32) && (m > INT_MAX || n > INT_MAX)) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "sparse_text_to_binary_stream: (%ldx%ld) too large for 32 bit indices\n",
+                m, n);
+        exit(1);
+    }
+    if (storage & SPARSE_VALUE_16) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "sparse_text_to_binary_stream: 16 bit values can't be written, use SPARSE_VALUE_32\n");
+        exit(1);
+    }
+    if (storage & SPARSE_INDEX_DELTA) {
+        fprintf(stdout, "\n");
+        fprintf(stderr,
+                "sparse_text_to_binary_stream: delta indices can't be written\n");
+        exit(1);
+    }
+    fprintf(stdout, "(%ldx%ld) ", m, n);
+    fflush(stdout);
+
+    /* pass 1 : items per line */
+    line_ptr = (long int *) calloc(m + 1, sizeof(long int));
+    seen = (char *) calloc(m + 1, sizeof(char));
+    assert(line_ptr && seen);
+    nb_duplicate = sparse_stream_text_pass(text_filename, m, n, line_ptr,
+                                           seen, NULL, storage, NULL, 0,
+                                           NULL, 0);
+    free(seen);
+    sum = 0;
+    for (i = 0; i <= m; i++) {
+        long int c = line_ptr[i];
+
+        line_ptr[i] = sum;
+        sum += c;
+    }
+
+    index_size = (storage & SPARSE_INDEX_32) ? sizeof(int) : sizeof(long int);
+    val_size = (storage & SPARSE_VALUE_32) ? sizeof(float) : sizeof(double);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SPARSE_BINARY_MAGIC, 8);
+    header.version = SPARSE_BINARY_VERSION;
+    header.endian = SPARSE_BINARY_ENDIAN;
+    header.storage = storage;
+    header.flags = 0;
+    header.nb_line = m;
+    header.nb_col = n;
+    header.nb_item = line_ptr[m];
+    offset = SPARSE_BINARY_HEADER_SIZE;
+    header.offset[SPARSE_BINARY_LINE_PTR] = offset;
+    offset += sparse_binary_align((m + 1) * sizeof(long int));
+    header.offset[SPARSE_BINARY_COL_INDEX] = offset;
+    offset += sparse_binary_align(line_ptr[m] * index_size);
+    header.offset[SPARSE_BINARY_LINE_VAL] = offset;
+    offset += sparse_binary_align(line_ptr[m] * val_size);
+
+    if ((out = open(binary_filename, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+        perror(binary_filename);
+        exit(1);
+    }
+    /* zero padding, header written once the checksum is known */
+    if (ftruncate(out, offset)) {
+        perror(binary_filename);
+        exit(1);
+    }
+    sparse_stream_pwrite(out, binary_filename, line_ptr,
+                         (m + 1) * sizeof(long int),
+                         header.offset[SPARSE_BINARY_LINE_PTR]);
+
+    /* pass 2 : items */
+    w_index.fd = w_val.fd = out;
+    w_index.filename = w_val.filename = binary_filename;
+    w_index.used = w_val.used = 0;
+    w_index.buf = (char *) malloc(SPARSE_STREAM_WRITE_BYTES);
+    w_val.buf = (char *) malloc(SPARSE_STREAM_WRITE_BYTES);
+    assert(w_index.buf && w_val.buf);
+    sparse_stream_text_pass(text_filename, m, n, NULL, NULL, line_ptr,
+                            storage, &w_index,
+                            header.offset[SPARSE_BINARY_COL_INDEX], &w_val,
+                            header.offset[SPARSE_BINARY_LINE_VAL]);
+    sparse_stream_flush(&w_index);
+    sparse_stream_flush(&w_val);
+    free(line_ptr);
+
+    /* data checksum, the arrays being written out of order */
+    for (pos = SPARSE_BINARY_HEADER_SIZE; pos < offset;) {
+        size_t len = offset - pos < SPARSE_STREAM_WRITE_BYTES ?
+            (size_t) (offset - pos) : SPARSE_STREAM_WRITE_BYTES;
+
+        sparse_stream_pread(out, binary_filename, w_index.buf, len, pos);
+        h = sparse_binary_checksum(h, w_index.buf, len);
+        pos += len;
+    }
+    free(w_index.buf);
+    free(w_val.buf);
+
+    header.data_checksum = h;
+    header.header_checksum =
+        sparse_binary_checksum(SPARSE_BINARY_FNV_OFFSET, &header,
+                               offsetof(struct sparse_binary_header_t,
+                                        header_checksum));
+    memset(block, 0, sizeof(block));
+    memcpy(block, &header, sizeof(header));
+    sparse_stream_pwrite(out, binary_filename, block, sizeof(block), 0);
+    if (close(out)) {
+        perror(binary_filename);
+        exit(1);
+    }
+    fprintf(stdout, "%ld items\n", (long int) header.nb_item);
+    fflush(stdout);
+    if (nb_duplicate) {
+        fprintf(stderr,
+                "sparse_text_to_binary_stream: %ld duplicates summed in '%s'\n",
+                nb_duplicate, text_filename);
+    }
+}
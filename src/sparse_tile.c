@@ -0,0 +1,433 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include "sparse.h"
+
+/*
+ * Cache tiling of a frozen matrix : when x has more columns than the cache
+ * holds, A*x gathers x from anywhere in memory. The tiled copy processes
+ * a block of lines panel by panel, a panel being a range of columns whose
+ * part of x fits in (half) the cache, the lines of the block being
+ * revisited for each panel (their part of y fits in a quarter of the
+ * cache). A^T*y is tiled the same way on the columns, y being cut into
+ * panels of lines.
+ *
+ * Items of a line in a panel form a run, each run costing an update of
+ * the output : short lines spread over many panels give runs of one or
+ * two items, measure before keeping the tiles.
+ */
+
+#define SPARSE_DEFAULT_CACHE (256 * 1024)
+
+/* runs shorter than this are summed inline, not by sparse_dot_storage() */
+#define SPARSE_TILE_SHORT_RUN 8
+
+/* 0 : detect */
+static long int sparse_cache_size = 0;
+
+/** \brief Cache size used to choose the tiles (0 : detect it again) **/
+void sparse_set_cache_size(long int bytes)
+{
+    sparse_cache_size = bytes;
+}
+
+/* size of the level 2 cache (per core) from sysfs, 0 if unknown */
+static long int sparse_sysfs_cache_size(void)
+{
+    char filename[256], unit;
+
+    long int size = 0, level, k;
+
+    FILE *fd;
+
+    for (k = 0; k < 8 && !size; k++) {
+        snprintf(filename, sizeof(filename),
+                 "/sys/devices/system/cpu/cpu0/cache/index%ld/level", k);
+        fd = fopen(filename, "r");
+        if (!fd) {
+            break;
+        }
+        if (fscanf(fd, "%ld", &level) != 1) {
+            level = 0;
+        }
+        fclose(fd);
+        if (level != 2) {
+            continue;
+        }
+        snprintf(filename, sizeof(filename),
+                 "/sys/devices/system/cpu/cpu0/cache/index%ld/size", k);
+        fd = fopen(filename, "r");
+        if (!fd) {
+            continue;
+        }
+        unit = 0;
+        if (fscanf(fd, "%ld%c", &size, &unit) < 1) {
+            size = 0;
+        }
+        fclose(fd);
+        if (unit == 'K') {
+            size *= 1024;
+        } else if (unit == 'M') {
+            size *= 1024 * 1024;
+        }
+    }
+    return (size);
+}
+
+/** \brief Cache size used to choose the tiles : sparse_set_cache_size(),
+ or the level 2 cache size of the machine, or 256 KB **/
+long int sparse_get_cache_size(void)
+{
+    long int size = 0;
+
+    if (sparse_cache_size > 0) {
+        return (sparse_cache_size);
+    }
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (size <= 0) {
+        size = sparse_sysfs_cache_size();
+    }
+    if (size <= 0) {
+        size = SPARSE_DEFAULT_CACHE;
+    }
+    return (size);
+}
+
+/* inner index of item k of raw index array */
+static long int sparse_tile_inner(const void *index, int index32, long int k)
+{
+    return (index32 ? (long int) ((const int *) index)[k] :
+            ((const long int *) index)[k]);
+}
+
+/*
+ * tiled copy of the lines (ptr, index, val : line arrays) or of the
+ * columns (column arrays) of z. Two passes over the blocks : runs and items
+ * of each segment are counted, then placed.
+ */
+static struct sparse_tile_t *sparse_tile_build(struct sparse_compressed_t *z,
+                                               const long int *ptr,
+                                               const void *index,
+                                               const void *val,
+                                               long int nb_outer,
+                                               long int nb_inner,
+                                               long int width,
+                                               long int block_size)
+{
+    struct sparse_tile_t *t;
+
+    long int *seg_item, nb_seg, s, nb_run, nb_item;
+
+    size_t isz, vsz;
+
+    int nt, index32 = (z->storage & SPARSE_INDEX_32) != 0;
+
+    isz = index32 ? sizeof(int) : sizeof(long int);
+    vsz = (z->storage & SPARSE_VALUE_16) ? sizeof(unsigned short) :
+        (z->storage & SPARSE_VALUE_32) ? sizeof(float) : sizeof(double);
+    nb_item = ptr[nb_outer];
+
+    t = (struct sparse_tile_t *) calloc(1, sizeof(struct sparse_tile_t));
+    assert(t);
+    t->width = width;
+    t->nb_panel = (nb_inner + width - 1) / width;
+    if (t->nb_panel < 1) {
+        t->nb_panel = 1;
+    }
+    t->nb_block = (nb_outer + block_size - 1) / block_size;
+    if (t->nb_block < 1) {
+        t->nb_block = 1;
+    }
+    t->block = (long int *) malloc((t->nb_block + 1) * sizeof(long int));
+    assert(t->block);
+    for (s = 0; s < t->nb_block; s++) {
+        t->block[s] = s * block_size;
+    }
+    t->block[t->nb_block] = nb_outer;
+
+    nb_seg = t->nb_block * t->nb_panel;
+    t->seg_ptr = (long int *) calloc(nb_seg + 1, sizeof(long int));
+    seg_item = (long int *) calloc(nb_seg + 1, sizeof(long int));
+    assert(t->seg_ptr && seg_item);
+
+    nt = sparse_work_nb_thread(nb_item);
+
+    /* runs and items of each segment */
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        long int *last, b, i, k, p;
+
+        last = (long int *) malloc(t->nb_panel * sizeof(long int));
+        assert(last);
+#pragma omp for schedule(dynamic, 1)
+        for (b = 0; b < t->nb_block; b++) {
+            long int *nrun = t->seg_ptr + b * t->nb_panel + 1;
+
+            long int *nit = seg_item + b * t->nb_panel + 1;
+
+            for (p = 0; p < t->nb_panel; p++) {
+                last[p] = -1;
+            }
+            for (i = t->block[b]; i < t->block[b + 1]; i++) {
+                for (k = ptr[i]; k < ptr[i + 1]; k++) {
+                    p = sparse_tile_inner(index, index32, k) / width;
+                    if (last[p] != i) {
+                        last[p] = i;
+                        nrun[p]++;
+                    }
+                    nit[p]++;
+                }
+            }
+        }
+        free(last);
+    }
+    for (s = 0; s < nb_seg; s++) {
+        t->seg_ptr[s + 1] += t->seg_ptr[s];
+        seg_item[s + 1] += seg_item[s];
+    }
+    nb_run = t->seg_ptr[nb_seg];
+
+    t->run_outer = (long int *) malloc((nb_run + 1) * sizeof(long int));
+    t->run_ptr = (long int *) malloc((nb_run + 1) * sizeof(long int));
+    t->index = malloc((nb_item + 1) * isz);
+    t->val = malloc((nb_item + 1) * vsz);
+    assert(t->run_outer && t->run_ptr && t->index && t->val);
+    t->run_ptr[nb_run] = nb_item;
+
+    /* place them : the items of a line in a panel are contiguous, as the
+       lines of a block are read in order */
+#pragma omp parallel num_threads(nt) if(nt > 1)
+    {
+        long int *last, *run, *item, b, i, k, p;
+
+        last = (long int *) malloc(3 * t->nb_panel * sizeof(long int));
+        assert(last);
+        run = last + t->nb_panel;
+        item = run + t->nb_panel;
+#pragma omp for schedule(dynamic, 1)
+        for (b = 0; b < t->nb_block; b++) {
+            for (p = 0; p < t->nb_panel; p++) {
+                last[p] = -1;
+                run[p] = t->seg_ptr[b * t->nb_panel + p];
+                item[p] = seg_item[b * t->nb_panel + p];
+            }
+            for (i = t->block[b]; i < t->block[b + 1]; i++) {
+                for (k = ptr[i]; k < ptr[i + 1]; k++) {
+                    p = sparse_tile_inner(index, index32, k) / width;
+                    if (last[p] != i) {
+                        last[p] = i;
+                        t->run_outer[run[p]] = i;
+                        t->run_ptr[run[p]] = item[p];
+                        run[p]++;
+                    }
+                    memcpy((char *) t->index + item[p] * isz,
+                           (const char *) index + k * isz, isz);
+                    memcpy((char *) t->val + item[p] * vsz,
+                           (const char *) val + k * vsz, vsz);
+                    item[p]++;
+                }
+            }
+        }
+        free(last);
+    }
+
+    free(seg_item);
+    return (t);
+}
+
+static void sparse_tile_free(struct sparse_tile_t *t)
+{
+    if (!t) {
+        return;
+    }
+    free(t->block);
+    free(t->seg_ptr);
+    free(t->run_outer);
+    free(t->run_ptr);
+    free(t->index);
+    free(t->val);
+    free(t);
+}
+
+/* dot product of x with the items [k, k+n) of a run, 16 bit values are
+   not scaled */
+static double sparse_tile_dot(int storage, const void *index,
+                              const void *val, long int k, long int n,
+                              const double *x)
+{
+    double sum = 0.;
+
+    long int l;
+
+    if (n >= SPARSE_TILE_SHORT_RUN) {
+        return (sparse_dot_storage(storage, index, val, k, n, x));
+    }
+    for (l = k; l < k + n; l++) {
+        sum += ((storage & SPARSE_VALUE_16) ?
+                sparse_value16_to_double(((const unsigned short *) val)[l],
+                                         storage) :
+                (storage & SPARSE_VALUE_32) ?
+                (double) ((const float *) val)[l] :
+                ((const double *) val)[l]) *
+            x[sparse_tile_inner(index, storage & SPARSE_INDEX_32, l)];
+    }
+    return (sum);
+}
+
+/** \brief out = out + tiled product with in : y = y + A*x with
+ t = z->line_tile, x = x + A^T*y with t = z->col_tile. Blocks are shared
+ among threads, each block being written by one thread only. **/
+void sparse_tile_mult(struct sparse_compressed_t *z, struct sparse_tile_t *t,
+                      const double *in, double *out)
+{
+    long int b, nb_item = t->run_ptr[t->seg_ptr[t->nb_block * t->nb_panel]];
+
+    int storage = z->storage, nt = sparse_work_nb_thread(nb_item);
+
+    double scale = (storage & SPARSE_VALUE_16) ? z->val_scale : 1.;
+
+#pragma omp parallel for num_threads(nt) if(nt > 1) schedule(dynamic, 1)
+    for (b = 0; b < t->nb_block; b++) {
+        long int r, s;
+
+        for (s = b * t->nb_panel; s < (b + 1) * t->nb_panel; s++) {
+            for (r = t->seg_ptr[s]; r < t->seg_ptr[s + 1]; r++) {
+                out[t->run_outer[r]] += scale *
+                    sparse_tile_dot(storage, t->index, t->val,
+                                    t->run_ptr[r],
+                                    t->run_ptr[r + 1] - t->run_ptr[r], in);
+            }
+        }
+    }
+}
+
+/* plain line indices of A decoded from its delta coding, with the index
+   width of the storage */
+static void *sparse_tile_line_index(struct sparse_matrix_t *A)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    int index32 = (z->storage & SPARSE_INDEX_32) != 0;
+
+    void *index;
+
+    long int k;
+
+    index = malloc((A->nb_item + 1) *
+                   (index32 ? sizeof(int) : sizeof(long int)));
+    assert(index);
+    for (k = 0; k < A->nb_item; k++) {
+        if (index32) {
+            ((int *) index)[k] = (int) SPARSE_LINE_COL(z, k);
+        } else {
+            ((long int *) index)[k] = SPARSE_LINE_COL(z, k);
+        }
+    }
+    return (index);
+}
+
+/* tiled copy of the lines (line = 1) or of the columns of A, blocks
+   having their part of the output in a quarter of the cache, with at
+   least 4 blocks per thread */
+static struct sparse_tile_t *sparse_tile_side(struct sparse_matrix_t *A,
+                                              int line, long int width,
+                                              long int cache)
+{
+    struct sparse_compressed_t *z = A->frozen;
+
+    struct sparse_tile_t *t;
+
+    long int nb_outer, block_size;
+
+    void *index;
+
+    int nt = sparse_get_nb_thread();
+
+    nb_outer = line ? A->nb_line : A->nb_col;
+    block_size = cache / (4 * sizeof(double));
+    if (nb_outer / block_size < 4 * nt) {
+        block_size = nb_outer / (4 * nt) + 1;
+    }
+    if (line) {
+        index = z->line_delta ? sparse_tile_line_index(A) :
+            z->col_index32 ? (void *) z->col_index32 : z->col_index;
+        t = sparse_tile_build(z, z->line_ptr, index,
+                              z->line_val16 ? (void *) z->line_val16 :
+                              z->line_val32 ?
+                              (void *) z->line_val32 : z->line_val,
+                              A->nb_line, A->nb_col, width, block_size);
+        if (z->line_delta) {
+            free(index);
+        }
+        return (t);
+    }
+    return (sparse_tile_build(z, z->col_ptr,
+                              z->line_index32 ?
+                              (void *) z->line_index32 : z->line_index,
+                              z->col_val16 ? (void *) z->col_val16 :
+                              z->col_val32 ?
+                              (void *) z->col_val32 : z->col_val,
+                              A->nb_col, A->nb_line, width, block_size));
+}
+
+/* number of runs of a tiled copy */
+static long int sparse_tile_nb_run(struct sparse_tile_t *t)
+{
+    return (t ? t->seg_ptr[t->nb_block * t->nb_panel] : 0);
+}
+
+/** \brief Build the cache tiled copies of A (frozen if it is not), used
+ by sparse_mult_vector() and sparse_trans_mult_vector()
+
+ Panels are width columns (lines) wide, width = 0 choosing them from the
+ cache size (x panel in half the cache, see sparse_get_cache_size()).
+ Only the products whose input vector is wider than a panel are tiled.
+ The tiled copies take about the memory of the frozen arrays again.
+**/
+void sparse_tile(struct sparse_matrix_t *A, long int width)
+{
+    struct sparse_compressed_t *z;
+
+    long int cache;
+
+    sparse_freeze(A);
+    sparse_untile(A);
+    z = A->frozen;
+
+    cache = sparse_get_cache_size();
+    if (width <= 0) {
+        width = cache / (2 * sizeof(double));
+    }
+    if (A->nb_col > width) {
+        z->line_tile = sparse_tile_side(A, 1, width, cache);
+    }
+    if (A->nb_line > width) {
+        z->col_tile = sparse_tile_side(A, 0, width, cache);
+    }
+
+    fprintf(stdout,
+            "tile sparse matrix (%p): panels of %ld, %ld line runs, "
+            "%ld column runs for %ld items\n", A, width,
+            sparse_tile_nb_run(z->line_tile),
+            sparse_tile_nb_run(z->col_tile), A->nb_item);
+    fflush(stdout);
+}
+
+/** \brief Release the tiled copies of A, products use the frozen line and
+ column arrays again **/
+void sparse_untile(struct sparse_matrix_t *A)
+{
+    if (!A->frozen) {
+        return;
+    }
+    sparse_tile_free(A->frozen->line_tile);
+    sparse_tile_free(A->frozen->col_tile);
+    A->frozen->line_tile = NULL;
+    A->frozen->col_tile = NULL;
+}
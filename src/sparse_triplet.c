@@ -0,0 +1,251 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+
+#include "sparse.h"
+
+/*
+ * Triplet (coordinate) assembly : items are appended to flat arrays, then
+ * sorted on key = i * nb_col + j with a parallel LSD radix sort (stable,
+ * so duplicates stay in input order), merged and linked in one pass. This
+ * is O(nb) whatever the order of the items, where sparse_set_value() walks
+ * the line for each item.
+ */
+
+#define SPARSE_RADIX_BITS 11
+#define SPARSE_RADIX (1 << SPARSE_RADIX_BITS)
+
+/** \brief Create an empty triplet list for a nb_line x nb_col matrix, size
+ being a hint of the number of items **/
+struct sparse_triplet_t *new_sparse_triplet(long int nb_line,
+                                           long int nb_col, long int size)
+{
+    struct sparse_triplet_t *t;
+
+    if (nb_line < 0 || nb_col < 0 ||
+        (nb_col > 0 && nb_line > LONG_MAX / nb_col)) {
+        fprintf(stderr, "new_sparse_triplet: bad size (%ldx%ld)\n",
+                nb_line, nb_col);
+        exit(1);
+    }
+    if (size < 1024) {
+        size = 1024;
+    }
+
+    t = (struct sparse_triplet_t *) calloc(1, sizeof(struct sparse_triplet_t));
+    assert(t);
+    t->nb_line = nb_line;
+    t->nb_col = nb_col;
+    t->size = size;
+    t->sorted = 1;
+    t->key = (unsigned long int *) malloc(size * sizeof(unsigned long int));
+    t->val = (double *) malloc(size * sizeof(double));
+    assert(t->key && t->val);
+    return (t);
+}
+
+void free_sparse_triplet(struct sparse_triplet_t *t)
+{
+    free(t->key);
+    free(t->val);
+    free(t);
+}
+
+/** \brief Append item (i,j) = val **/
+void sparse_triplet_add(struct sparse_triplet_t *t, long int i, long int j,
+                        double val)
+{
+    unsigned long int key;
+
+    if (i < 0 || i >= t->nb_line || j < 0 || j >= t->nb_col) {
+        fprintf(stderr,
+                "sparse_triplet_add: (%ld,%ld) out of (%ldx%ld)\n", i, j,
+                t->nb_line, t->nb_col);
+        exit(1);
+    }
+    if (t->nb == t->size) {
+        t->size *= 2;
+        t->key = (unsigned long int *)
+            realloc(t->key, t->size * sizeof(unsigned long int));
+        t->val = (double *) realloc(t->val, t->size * sizeof(double));
+        assert(t->key && t->val);
+    }
+    key = (unsigned long int) i * t->nb_col + j;
+    if (t->nb && key < t->key[t->nb - 1]) {
+        t->sorted = 0;
+    }
+    t->key[t->nb] = key;
+    t->val[t->nb] = val;
+    t->nb++;
+}
+
+/* first item of slice p of n items cut in nb_slice */
+static long int sparse_triplet_slice(long int n, int p, int nb_slice)
+{
+    return (n / nb_slice * p + (n % nb_slice) * p / nb_slice);
+}
+
+/* stable sort of the items on their key, SPARSE_RADIX_BITS bits per pass,
+   the items being cut in slices sorted in parallel */
+static void sparse_triplet_sort(struct sparse_triplet_t *t)
+{
+    unsigned long int *tmp_key, *swap_key, max;
+
+    double *tmp_val, *swap_val;
+
+    long int *hist;
+
+    int nt, shift, bits = 0;
+
+    /* largest key */
+    max = (unsigned long int) t->nb_line * t->nb_col - 1;
+    while (bits < 64 && (max >> bits) > 0) {
+        bits++;
+    }
+
+    tmp_key = (unsigned long int *)
+        malloc(t->nb * sizeof(unsigned long int));
+    tmp_val = (double *) malloc(t->nb * sizeof(double));
+    nt = sparse_work_nb_thread(t->nb);
+    hist = (long int *) malloc(nt * SPARSE_RADIX * sizeof(long int));
+    assert(tmp_key && tmp_val && hist);
+
+    for (shift = 0; shift < bits; shift += SPARSE_RADIX_BITS) {
+#pragma omp parallel num_threads(nt) if(nt > 1)
+        {
+            long int k, d, q, c, offset;
+
+            int p;
+
+            /* nt slices whatever the size of the team */
+#pragma omp for schedule(static, 1)
+            for (p = 0; p < nt; p++) {
+                long int *h = hist + p * SPARSE_RADIX;
+
+                for (d = 0; d < SPARSE_RADIX; d++) {
+                    h[d] = 0;
+                }
+                for (k = sparse_triplet_slice(t->nb, p, nt);
+                     k < sparse_triplet_slice(t->nb, p + 1, nt); k++) {
+                    h[(t->key[k] >> shift) & (SPARSE_RADIX - 1)]++;
+                }
+            }
+#pragma omp single
+            {
+                /* digit d of slice q goes after digit d of slices < q */
+                offset = 0;
+                for (d = 0; d < SPARSE_RADIX; d++) {
+                    for (q = 0; q < nt; q++) {
+                        c = hist[q * SPARSE_RADIX + d];
+                        hist[q * SPARSE_RADIX + d] = offset;
+                        offset += c;
+                    }
+                }
+            }
+#pragma omp for schedule(static, 1)
+            for (p = 0; p < nt; p++) {
+                long int *h = hist + p * SPARSE_RADIX;
+
+                for (k = sparse_triplet_slice(t->nb, p, nt);
+                     k < sparse_triplet_slice(t->nb, p + 1, nt); k++) {
+                    d = h[(t->key[k] >> shift) & (SPARSE_RADIX - 1)]++;
+                    tmp_key[d] = t->key[k];
+                    tmp_val[d] = t->val[k];
+                }
+            }
+        }
+        swap_key = t->key;
+        t->key = tmp_key;
+        tmp_key = swap_key;
+        swap_val = t->val;
+        t->val = tmp_val;
+        tmp_val = swap_val;
+    }
+    t->sorted = 1;
+
+    free(tmp_key);
+    free(tmp_val);
+    free(hist);
+}
+
+/* merge the items with the same key (sorted), count them */
+static void sparse_triplet_merge(struct sparse_triplet_t *t, int duplicate)
+{
+    long int k, n = 0;
+
+    for (k = 0; k < t->nb; k++) {
+        if (n > 0 && t->key[k] == t->key[n - 1]) {
+            if (duplicate == SPARSE_DUPLICATE_ERROR) {
+                fprintf(stderr,
+                        "sparse_triplet_to_matrix: duplicate (%ld,%ld)\n",
+                        (long int) (t->key[k] / t->nb_col),
+                        (long int) (t->key[k] % t->nb_col));
+                exit(1);
+            }
+            if (duplicate == SPARSE_DUPLICATE_REPLACE) {
+                t->val[n - 1] = t->val[k];
+            } else {
+                t->val[n - 1] += t->val[k];
+            }
+            t->nb_duplicate++;
+            continue;
+        }
+        t->key[n] = t->key[k];
+        t->val[n] = t->val[k];
+        n++;
+    }
+    t->nb = n;
+}
+
+/** \brief Build a matrix from the triplets
+
+ Duplicate (i,j) are summed (SPARSE_DUPLICATE_SUM, as sparse_set_value
+ does), the last one is kept (SPARSE_DUPLICATE_REPLACE) or the program
+ stops (SPARSE_DUPLICATE_ERROR). t->nb_duplicate counts them. t is left
+ sorted and merged.
+**/
+struct sparse_matrix_t *sparse_triplet_to_matrix(struct sparse_triplet_t *t,
+                                                 int col_link_status,
+                                                 int duplicate)
+{
+    struct sparse_matrix_t *a;
+
+    struct sparse_item_t *items;
+
+    long int k;
+
+    int nt;
+
+    if (!t->sorted) {
+        sparse_triplet_sort(t);
+    }
+    sparse_triplet_merge(t, duplicate);
+
+    a = new_sparse_matrix(t->nb_line, t->nb_col, 0);
+    items = t->nb ? sparse_new_items(a, t->nb) : NULL;
+    nt = sparse_work_nb_thread(t->nb);
+
+#pragma omp parallel for num_threads(nt) if(nt > 1)
+    for (k = 0; k < t->nb; k++) {
+        long int i = t->key[k] / t->nb_col;
+
+        items[k].line_index = i;
+        items[k].col_index = t->key[k] % t->nb_col;
+        items[k].val = t->val[k];
+        items[k].next_in_col = NULL;
+        items[k].next_in_line = (k + 1 < t->nb &&
+                                 (long int) (t->key[k + 1] / t->nb_col) ==
+                                 i) ? &items[k + 1] : NULL;
+        if (k == 0 || (long int) (t->key[k - 1] / t->nb_col) != i) {
+            a->line[i] = &items[k];
+        }
+    }
+    a->nb_item = t->nb;
+
+    if (col_link_status == SPARSE_COL_LINK) {
+        sparse_build_col_link(a);
+    }
+    return (a);
+}
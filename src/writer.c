@@ -0,0 +1,558 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define WRITER_GZIP 1
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define WRITER_ZSTD 1
+#include <zstd.h>
+#endif
+
+#include "sparse.h"
+#include "writer.h"
+
+#define WRITER_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* compressed bytes written at once */
+#define WRITER_CODEC_OUTPUT (1024 * 1024)
+
+/* fast levels : the codec thread has to keep up with the formatting */
+#define WRITER_GZIP_LEVEL 1
+#define WRITER_ZSTD_LEVEL 3
+
+enum writer_codec_type_t {
+    WRITER_CODEC_NONE = 0,
+    WRITER_CODEC_GZIP,
+    WRITER_CODEC_ZSTD
+};
+
+struct writer_codec_t {
+    int type;
+    int fd;
+    char *filename;
+    unsigned char *out;
+#ifdef WRITER_GZIP
+    z_stream z;
+#endif
+#ifdef WRITER_ZSTD
+    ZSTD_CCtx *zc;
+#endif
+
+    /* buffer being compressed by the codec thread, and the free one */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *data;
+    size_t len;
+    char *spare;
+    int busy;
+    int stop;
+};
+
+/* a number can't be longer than that ("%f" of a large double included) */
+#define WRITER_MAX_TOKEN 400
+
+/* exact powers of ten in a double */
+static const double writer_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+/*
+ * digits after the decimal point of writer_double() : -1 for the shortest
+ * string read back as the same double, n >= 0 as printf("%.nf") (6 is the
+ * historical "%lf")
+ */
+static int writer_precision = -1;
+
+void writer_set_precision(int precision)
+{
+    writer_precision = precision;
+}
+
+int writer_get_precision(void)
+{
+    return (writer_precision);
+}
+
+static void writer_write_fd(int fd, char *filename, const char *data,
+                            size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = write(fd, data, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            perror(filename);
+            exit(1);
+        }
+        data += r;
+        n -= r;
+    }
+}
+
+/* compress n bytes of data and write them, end the stream if finish */
+static void writer_codec_compress(struct writer_codec_t *c, char *data,
+                                  size_t n, int finish)
+{
+#ifdef WRITER_GZIP
+    int ret;
+
+    if (c->type == WRITER_CODEC_GZIP) {
+        c->z.next_in = (unsigned char *) data;
+        c->z.avail_in = n;
+        do {
+            c->z.next_out = c->out;
+            c->z.avail_out = WRITER_CODEC_OUTPUT;
+            ret = deflate(&c->z, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                fprintf(stderr, "%s: gzip error\n", c->filename);
+                exit(1);
+            }
+            writer_write_fd(c->fd, c->filename, (char *) c->out,
+                            WRITER_CODEC_OUTPUT - c->z.avail_out);
+        } while (c->z.avail_out == 0);
+    }
+#endif
+#ifdef WRITER_ZSTD
+    if (c->type == WRITER_CODEC_ZSTD) {
+        ZSTD_inBuffer i = { data, n, 0 };
+
+        ZSTD_outBuffer o;
+
+        size_t left;
+
+        do {
+            o.dst = c->out;
+            o.size = WRITER_CODEC_OUTPUT;
+            o.pos = 0;
+            left = ZSTD_compressStream2(c->zc, &o, &i,
+                                        finish ? ZSTD_e_end :
+                                        ZSTD_e_continue);
+            if (ZSTD_isError(left)) {
+                fprintf(stderr, "%s: zstd error (%s)\n", c->filename,
+                        ZSTD_getErrorName(left));
+                exit(1);
+            }
+            writer_write_fd(c->fd, c->filename, (char *) c->out, o.pos);
+        } while (finish ? left != 0 : i.pos < i.size);
+    }
+#endif
+}
+
+/* codec thread : compress the buffers handed by writer_flush() */
+static void *writer_codec_run(void *arg)
+{
+    struct writer_codec_t *c = (struct writer_codec_t *) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        while (!c->busy && !c->stop) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        if (!c->busy) {
+            pthread_mutex_unlock(&c->lock);
+            break;
+        }
+        pthread_mutex_unlock(&c->lock);
+
+        writer_codec_compress(c, c->data, c->len, 0);
+
+        pthread_mutex_lock(&c->lock);
+        c->busy = 0;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+    }
+    return (NULL);
+}
+
+/* compression of the file from its name */
+static int writer_codec_type(char *filename)
+{
+    size_t n = strlen(filename);
+
+    if (n > 3 && !strcmp(filename + n - 3, ".gz")) {
+        return (WRITER_CODEC_GZIP);
+    }
+    if (n > 4 && !strcmp(filename + n - 4, ".zst")) {
+        return (WRITER_CODEC_ZSTD);
+    }
+    return (WRITER_CODEC_NONE);
+}
+
+static struct writer_codec_t *writer_codec_open(int type, int fd,
+                                                char *filename, size_t size)
+{
+    struct writer_codec_t *c;
+
+#ifndef WRITER_GZIP
+    if (type == WRITER_CODEC_GZIP) {
+        fprintf(stderr, "%s: gzip compression not supported by this build\n",
+                filename);
+        exit(1);
+    }
+#endif
+#ifndef WRITER_ZSTD
+    if (type == WRITER_CODEC_ZSTD) {
+        fprintf(stderr, "%s: zstd compression not supported by this build\n",
+                filename);
+        exit(1);
+    }
+#endif
+
+    c = (struct writer_codec_t *) calloc(1, sizeof(struct writer_codec_t));
+    assert(c);
+    c->type = type;
+    c->fd = fd;
+    c->filename = filename;
+    c->out = (unsigned char *) malloc(WRITER_CODEC_OUTPUT);
+    c->spare = (char *) malloc(size);
+    assert(c->out && c->spare);
+#ifdef WRITER_GZIP
+    if (type == WRITER_CODEC_GZIP) {
+        /* gzip header */
+        if (deflateInit2(&c->z, WRITER_GZIP_LEVEL, Z_DEFLATED,
+                         16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "%s: deflateInit2 failed\n", filename);
+            exit(1);
+        }
+    }
+#endif
+#ifdef WRITER_ZSTD
+    if (type == WRITER_CODEC_ZSTD) {
+        c->zc = ZSTD_createCCtx();
+        assert(c->zc);
+        ZSTD_CCtx_setParameter(c->zc, ZSTD_c_compressionLevel,
+                               WRITER_ZSTD_LEVEL);
+        /* fails quietly if libzstd has no thread support */
+        if (sparse_get_nb_thread() > 1) {
+            ZSTD_CCtx_setParameter(c->zc, ZSTD_c_nbWorkers,
+                                   sparse_get_nb_thread());
+        }
+    }
+#endif
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    if (pthread_create(&c->thread, NULL, writer_codec_run, c)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    return (c);
+}
+
+/* hand the buffer of w to the codec thread, w gets the free one */
+static void writer_codec_put(struct writer_t *w)
+{
+    struct writer_codec_t *c = w->codec;
+
+    pthread_mutex_lock(&c->lock);
+    while (c->busy) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    c->data = w->buf;
+    c->len = w->pos;
+    c->busy = 1;
+    w->buf = c->spare;
+    c->spare = c->data;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    w->pos = 0;
+}
+
+/* wait for the codec thread, end the compressed stream */
+static void writer_codec_close(struct writer_codec_t *c)
+{
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+    writer_codec_compress(c, NULL, 0, 1);
+#ifdef WRITER_GZIP
+    if (c->type == WRITER_CODEC_GZIP) {
+        deflateEnd(&c->z);
+    }
+#endif
+#ifdef WRITER_ZSTD
+    if (c->type == WRITER_CODEC_ZSTD) {
+        ZSTD_freeCCtx(c->zc);
+    }
+#endif
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c->out);
+    free(c->spare);
+    free(c);
+}
+
+/** \brief open filename for writing, exit on failure as the other writers
+ do. A name ending with .gz (.zst) gives a gzip (zstd) file. **/
+struct writer_t *writer_open(char *filename)
+{
+    struct writer_t *w;
+
+    int type;
+
+    w = (struct writer_t *) malloc(sizeof(struct writer_t));
+    assert(w);
+    if ((w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    w->filename = filename;
+    w->size = WRITER_BUFFER_SIZE;
+    w->buf = (char *) malloc(w->size);
+    assert(w->buf);
+    w->pos = 0;
+    w->codec = NULL;
+    type = writer_codec_type(filename);
+    if (type != WRITER_CODEC_NONE) {
+        w->codec = writer_codec_open(type, w->fd, filename, w->size);
+    }
+    return (w);
+}
+
+/** \brief writer into memory only **/
+struct writer_t *writer_new_buffer(void)
+{
+    struct writer_t *w;
+
+    w = (struct writer_t *) malloc(sizeof(struct writer_t));
+    assert(w);
+    w->fd = -1;
+    w->filename = NULL;
+    w->size = 1024 * 1024;
+    w->buf = (char *) malloc(w->size);
+    assert(w->buf);
+    w->pos = 0;
+    w->codec = NULL;
+    return (w);
+}
+
+void writer_flush(struct writer_t *w)
+{
+    if (w->codec) {
+        writer_codec_put(w);
+    } else if (w->fd >= 0) {
+        writer_write_fd(w->fd, w->filename, w->buf, w->pos);
+        w->pos = 0;
+    }
+}
+
+void writer_reset(struct writer_t *w)
+{
+    w->pos = 0;
+}
+
+void writer_close(struct writer_t *w)
+{
+    writer_flush(w);
+    if (w->codec) {
+        writer_codec_close(w->codec);
+    }
+    if (w->fd >= 0 && close(w->fd)) {
+        perror(w->filename);
+        exit(1);
+    }
+    free(w->buf);
+    free(w);
+}
+
+/* make room for n bytes */
+static void writer_reserve(struct writer_t *w, size_t n)
+{
+    if (w->pos + n <= w->size) {
+        return;
+    }
+    if (w->fd >= 0) {
+        writer_flush(w);
+        if (n <= w->size) {
+            return;
+        }
+    }
+    while (w->pos + n > w->size) {
+        w->size *= 2;
+    }
+    w->buf = (char *) realloc(w->buf, w->size);
+    assert(w->buf);
+}
+
+/** \brief write n bytes as they are **/
+void writer_append(struct writer_t *w, const char *data, size_t n)
+{
+    size_t k;
+
+    if (w->fd >= 0 && !w->codec && n > w->size / 2) {
+        writer_flush(w);
+        writer_write_fd(w->fd, w->filename, data, n);
+        return;
+    }
+    if (w->codec) {
+        /* the codec buffers keep their size */
+        while (n > w->size - w->pos) {
+            k = w->size - w->pos;
+            memcpy(w->buf + w->pos, data, k);
+            w->pos += k;
+            data += k;
+            n -= k;
+            writer_flush(w);
+        }
+    }
+    writer_reserve(w, n);
+    memcpy(w->buf + w->pos, data, n);
+    w->pos += n;
+}
+
+void writer_char(struct writer_t *w, char c)
+{
+    writer_reserve(w, 1);
+    w->buf[w->pos++] = c;
+}
+
+/* decimal digits of v at p, return their number */
+static int writer_digits(char *p, unsigned long int v)
+{
+    char tmp[24];
+
+    int n = 0, k;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    for (k = 0; k < n; k++) {
+        p[k] = tmp[n - 1 - k];
+    }
+    return (n);
+}
+
+void writer_long(struct writer_t *w, long int v)
+{
+    char *p;
+
+    writer_reserve(w, WRITER_MAX_TOKEN);
+    p = w->buf + w->pos;
+    if (v < 0) {
+        *p++ = '-';
+        p += writer_digits(p, -(unsigned long int) v);
+    } else {
+        p += writer_digits(p, (unsigned long int) v);
+    }
+    w->pos = p - w->buf;
+}
+
+/* write m / 10^e (m < 2^63) with e digits after the point, none if e = 0 */
+static int writer_fixed(char *p, int neg, unsigned long int m, int e)
+{
+    char digit[24];
+
+    int n, k, len = 0;
+
+    n = writer_digits(digit, m);
+    if (neg) {
+        p[len++] = '-';
+    }
+    if (n <= e) {
+        p[len++] = '0';
+        if (e) {
+            p[len++] = '.';
+        }
+        for (k = n; k < e; k++) {
+            p[len++] = '0';
+        }
+        memcpy(p + len, digit, n);
+        return (len + n);
+    }
+    memcpy(p + len, digit, n - e);
+    len += n - e;
+    if (e) {
+        p[len++] = '.';
+        memcpy(p + len, digit + n - e, e);
+        len += e;
+    }
+    return (len);
+}
+
+/*
+ * shortest round trip : the first e such as m = round(v * 10^e) is exact
+ * (m < 2^53) and m / 10^e == v : the division is correctly rounded, as
+ * strtod() reads "m e-e" back. printf("%.17g") otherwise.
+ */
+static int writer_shortest(char *p, double v)
+{
+    double a = fabs(v), m;
+
+    int e, k;
+
+    for (e = 0; e <= 17 && a * writer_pow10[e] < 9007199254740992.0; e++) {
+        m = nearbyint(a * writer_pow10[e]);
+        if (m / writer_pow10[e] == a) {
+            return (writer_fixed(p, signbit(v), (unsigned long int) m, e));
+        }
+    }
+    for (k = 15; k < 17; k++) {
+        e = snprintf(p, WRITER_MAX_TOKEN, "%.*g", k, v);
+        if (strtod(p, NULL) == v) {
+            return (e);
+        }
+    }
+    return (snprintf(p, WRITER_MAX_TOKEN, "%.17g", v));
+}
+
+/*
+ * printf("%.nf") : m = round(v * 10^n), the exact product being known
+ * thanks to fma(), printf() itself for ties and large values
+ */
+static int writer_precise(char *p, double v, int n)
+{
+    double a = fabs(v), x, f, r;
+
+    /* below 2^52, the error of the product is under 1/4 */
+    if (n > 22 || !(a * writer_pow10[n] < 4503599627370496.0)) {
+        return (snprintf(p, WRITER_MAX_TOKEN, "%.*f", n, v));
+    }
+    x = a * writer_pow10[n];
+    f = floor(x);
+    r = (x - f) + fma(a, writer_pow10[n], -x);
+    if (fabs(r - 0.5) < 1e-6) {
+        return (snprintf(p, WRITER_MAX_TOKEN, "%.*f", n, v));
+    }
+    if (r > 0.5) {
+        f += 1.;
+    }
+    return (writer_fixed(p, signbit(v), (unsigned long int) f, n));
+}
+
+void writer_double(struct writer_t *w, double v)
+{
+    char *p;
+
+    writer_reserve(w, WRITER_MAX_TOKEN);
+    p = w->buf + w->pos;
+    if (!isfinite(v)) {
+        w->pos += snprintf(p, WRITER_MAX_TOKEN, "%f", v);
+        return;
+    }
+    if (writer_precision < 0) {
+        w->pos += writer_shortest(p, v);
+    } else {
+        w->pos += writer_precise(p, v, writer_precision);
+    }
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+/*
+ * buffered text writer : numbers are formatted in place into a large
+ * buffer, instead of going through fprintf. A writer either writes to a
+ * file (fd >= 0) or keeps everything in its growing buffer (fd = -1),
+ * to be copied later to a file writer.
+ *
+ * Files named *.gz or *.zst are compressed on the fly : full buffers are
+ * handed to a second thread (codec) while the next one is filled.
+ */
+struct writer_codec_t;
+
+struct writer_t {
+    int fd;
+    char *filename;
+    char *buf;
+    size_t size;
+    size_t pos;
+    struct writer_codec_t *codec;
+};
+
+struct writer_t *writer_open(char *filename);
+struct writer_t *writer_new_buffer(void);
+void writer_close(struct writer_t *w);
+void writer_flush(struct writer_t *w);
+void writer_reset(struct writer_t *w);
+void writer_append(struct writer_t *w, const char *data, size_t n);
+
+void writer_char(struct writer_t *w, char c);
+void writer_long(struct writer_t *w, long int v);
+void writer_double(struct writer_t *w, double v);
+
+void writer_set_precision(int precision);
+int writer_get_precision(void);
+
+#endif
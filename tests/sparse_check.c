@@ -0,0 +1,1438 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sparse.h"
+
+/*
+ * make check : the storages and kernels of the library against the items
+ * they come from. Values are multiples of 1/8 below 4 and vectors
+ * multiples of 1/4, exact in every value width, so all the products are
+ * exact whatever the order of the sums : results must be equal, not
+ * close.
+ *
+ * usage : sparse_check nb_thread
+ */
+
+#define CHECK_NB_LINE 20000
+#define CHECK_NB_COL 30000
+#define CHECK_ITEM_PER_LINE 8
+#define CHECK_FILE "sparse_check.tmp"
+#define CHECK_LOAD_COPY 6
+
+/* compressed files, with the codecs found by configure */
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define CHECK_GZIP 1
+#else
+#define CHECK_GZIP 0
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define CHECK_ZSTD 1
+#else
+#define CHECK_ZSTD 0
+#endif
+
+/* frozen storages */
+static const int check_storage[] = {
+    SPARSE_STORAGE_64, SPARSE_INDEX_32, SPARSE_VALUE_32,
+    SPARSE_INDEX_32 | SPARSE_VALUE_32,
+    SPARSE_VALUE_BF16, SPARSE_INDEX_32 | SPARSE_VALUE_BF16,
+    SPARSE_VALUE_FP16, SPARSE_INDEX_32 | SPARSE_VALUE_FP16
+};
+
+#define CHECK_NB_STORAGE ((int) (sizeof(check_storage) / sizeof(int)))
+
+/* the items of line i : check_val[i][k] in column check_col[i][k], and R
+   the linked matrix built from them on one thread */
+/* the items of line i : check_val[i][k] in column check_col[i][k], R the
+   linked matrix built from them on one thread, and the products of the
+   items with x and y */
+static long int check_col[CHECK_NB_LINE][CHECK_ITEM_PER_LINE];
+
+static double check_val[CHECK_NB_LINE][CHECK_ITEM_PER_LINE];
+
+static struct sparse_matrix_t *check_R;
+
+static struct vector_t *check_x, *check_y, *check_Ax, *check_Aty;
+
+static int nb_failed = 0;
+
+/* ray like lines : increasing columns with short gaps (a wide one now and
+   then) from a random start */
+static void check_items(void)
+{
+    long int i, k;
+
+    srand(17);
+    for (i = 0; i < CHECK_NB_LINE; i++) {
+        check_col[i][0] = rand() % (CHECK_NB_COL - 1000);
+        for (k = 1; k < CHECK_ITEM_PER_LINE; k++) {
+            check_col[i][k] = check_col[i][k - 1] + 1 +
+                rand() % ((i % 5) ? 20 : 120);
+        }
+        for (k = 0; k < CHECK_ITEM_PER_LINE; k++) {
+            check_val[i][k] =
+                (1 + rand() % 31) * ((rand() % 2) ? 1 : -1) / 8.;
+        }
+    }
+}
+
+/* the items set line by line, in order */
+static struct sparse_matrix_t *check_set_items(struct sparse_matrix_t *A)
+{
+    struct sparse_item_t *last_item;
+
+    long int i, k;
+
+    for (i = 0; i < CHECK_NB_LINE; i++) {
+        last_item = NULL;
+        for (k = 0; k < CHECK_ITEM_PER_LINE; k++) {
+            last_item = sparse_set_value(A, i, check_col[i][k],
+                                         check_val[i][k], last_item);
+        }
+    }
+    return (A);
+}
+
+static struct sparse_matrix_t *check_new_matrix(int col_link_status)
+{
+    return (check_set_items(new_sparse_matrix(CHECK_NB_LINE, CHECK_NB_COL,
+                                              col_link_status)));
+}
+
+/* to be frozen with the given storage */
+static struct sparse_matrix_t *check_stored_matrix(int storage)
+{
+    return (check_set_items(new_sparse_matrix_with_storage(CHECK_NB_LINE,
+                                                           CHECK_NB_COL, 0,
+                                                           storage)));
+}
+
+/* count a failure if nb of the n results are wrong */
+static void check_count(char *what, long int nb, long int n)
+{
+    if (nb) {
+        nb_failed++;
+    }
+    fprintf(stderr, "check %-44s %s", what, nb ? "FAILED" : "ok");
+    if (nb) {
+        fprintf(stderr, " (%ld/%ld wrong)", nb, n);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* the frozen arrays of A against the linked lines and columns of R */
+static void check_freeze(struct sparse_matrix_t *A)
+{
+    struct sparse_matrix_t *R = check_R;
+
+    struct sparse_item_t *cur_item;
+
+    const long int *ptr, *index;
+
+    const double *val;
+
+    long int i, k, nb = 0;
+
+    ptr = sparse_line_ptr(A);
+    index = sparse_line_col_index(A);
+    val = sparse_line_val(A);
+    for (i = 0; i < R->nb_line; i++) {
+        k = ptr[i];
+        for (cur_item = R->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            if (k >= ptr[i + 1] || index[k] != cur_item->col_index
+                || val[k] != cur_item->val) {
+                nb++;
+            }
+            k++;
+        }
+        nb += (k != ptr[i + 1]);
+    }
+    check_count("sparse_freeze lines", nb, R->nb_item);
+
+    nb = 0;
+    ptr = sparse_col_ptr(A);
+    index = sparse_col_line_index(A);
+    val = sparse_col_val(A);
+    for (i = 0; i < R->nb_col; i++) {
+        k = ptr[i];
+        for (cur_item = R->col[i]; cur_item;
+             cur_item = cur_item->next_in_col) {
+            if (k >= ptr[i + 1] || index[k] != cur_item->line_index
+                || val[k] != cur_item->val) {
+                nb++;
+            }
+            k++;
+        }
+        nb += (k != ptr[i + 1]);
+    }
+    check_count("sparse_freeze columns", nb, R->nb_item);
+}
+
+static struct vector_t *check_vector(long int n, int period)
+{
+    struct vector_t *v = new_vector(n);
+
+    long int k;
+
+    for (k = 0; k < n; k++) {
+        v->mat[k] = ((k % period) - period / 2) / 4.;
+    }
+    return (v);
+}
+
+/* A*x and A^T*y straight from the items */
+static void check_reference(void)
+{
+    long int i, j, k;
+
+    memset(check_Aty->mat, 0, check_Aty->length * sizeof(double));
+    for (i = 0; i < CHECK_NB_LINE; i++) {
+        check_Ax->mat[i] = 0.;
+        for (k = 0; k < CHECK_ITEM_PER_LINE; k++) {
+            j = check_col[i][k];
+            check_Ax->mat[i] += check_val[i][k] * check_x->mat[j];
+            check_Aty->mat[j] += check_val[i][k] * check_y->mat[i];
+        }
+    }
+}
+
+/* count a failure if a and b differ by more than tol * max |b| */
+static void check_close(char *what, const double *a, const double *b,
+                        long int n, double tol)
+{
+    long int k, nb = 0;
+
+    double err, max = 0., scale = 0.;
+
+    for (k = 0; k < n; k++) {
+        if (fabs(b[k]) > scale) {
+            scale = fabs(b[k]);
+        }
+    }
+    for (k = 0; k < n; k++) {
+        err = fabs(a[k] - b[k]);
+        if (err > tol * scale || a[k] != a[k]) {
+            nb++;
+            if (err > max) {
+                max = err;
+            }
+        }
+    }
+    if (nb) {
+        nb_failed++;
+    }
+    fprintf(stderr, "check %-44s %s", what, nb ? "FAILED" : "ok");
+    if (nb) {
+        fprintf(stderr, " (%ld/%ld differ, max error %g)", nb, n, max);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void check_equal(char *what, const double *a, const double *b,
+                        long int n)
+{
+    check_close(what, a, b, n, 0.);
+}
+
+/* y = A*x and x = A^T*y, from zero */
+static void check_products(struct sparse_matrix_t *A, struct vector_t *x,
+                           struct vector_t *y, struct vector_t *Ax,
+                           struct vector_t *Aty)
+{
+    memset(Ax->mat, 0, Ax->length * sizeof(double));
+    memset(Aty->mat, 0, Aty->length * sizeof(double));
+    sparse_mult_vector(A, x, Ax);
+    sparse_trans_mult_vector(A, y, Aty);
+}
+
+/* compare the products of A with the ones of the items */
+static void check_matrix(char *what, struct sparse_matrix_t *A)
+{
+    struct vector_t *Ax = new_vector(CHECK_NB_LINE);
+
+    struct vector_t *Aty = new_vector(CHECK_NB_COL);
+
+    char name[256];
+
+    check_products(A, check_x, check_y, Ax, Aty);
+    snprintf(name, sizeof(name), "%s A*x", what);
+    check_equal(name, Ax->mat, check_Ax->mat, CHECK_NB_LINE);
+    snprintf(name, sizeof(name), "%s A^T*y", what);
+    check_equal(name, Aty->mat, check_Aty->mat, CHECK_NB_COL);
+    free_vector(Ax);
+    free_vector(Aty);
+}
+
+/* the items set in scattered order (lines out of order, items backwards),
+   each one from the arena of the matrix */
+static void check_arena(void)
+{
+    struct sparse_matrix_t *A;
+
+    long int i, l, k;
+
+    A = new_sparse_matrix(CHECK_NB_LINE, CHECK_NB_COL, 0);
+    for (l = 0; l < CHECK_NB_LINE; l++) {
+        i = (l * 7919) % CHECK_NB_LINE;
+        for (k = CHECK_ITEM_PER_LINE - 1; k >= 0; k--) {
+            sparse_set_value(A, i, check_col[i][k], check_val[i][k], NULL);
+        }
+    }
+    check_count("arena items", A->arena.nb_alloc != A->nb_item, 1);
+    check_matrix("scattered items", A);
+    free_sparse_matrix(A);
+}
+
+/* random queries, half of them on items */
+static void check_get_values(char *what, struct sparse_matrix_t *A)
+{
+    struct sparse_matrix_t *R = check_R;
+
+    long int n = 4 * CHECK_NB_LINE, k;
+
+    long int *i = (long int *) malloc(n * sizeof(long int));
+
+    long int *j = (long int *) malloc(n * sizeof(long int));
+
+    double *val = (double *) malloc(n * sizeof(double));
+
+    double *ref = (double *) malloc(n * sizeof(double));
+
+    char name[256];
+
+    assert(i && j && val && ref);
+    srand(23);
+    for (k = 0; k < n; k++) {
+        i[k] = rand() % R->nb_line;
+        j[k] = rand() % R->nb_col;
+        if (k % 2 && R->line[i[k]]) {
+            j[k] = R->line[i[k]]->col_index;
+        }
+        ref[k] = sparse_get_value(R, i[k], j[k]);
+    }
+    sparse_get_values(A, n, i, j, val);
+    snprintf(name, sizeof(name), "sparse_get_values %s", what);
+    check_equal(name, val, ref, n);
+    free(i);
+    free(j);
+    free(val);
+    free(ref);
+}
+
+/* A frozen with the given storage, tiled or not */
+static void check_frozen(int storage)
+{
+    struct sparse_matrix_t *A;
+
+    char what[128];
+
+    A = check_stored_matrix(storage);
+    sparse_freeze(A);
+    snprintf(what, sizeof(what), "%s storage %d", sparse_get_simd(),
+             A->storage);
+    check_matrix(what, A);
+    check_get_values(what, A);
+    sparse_tile(A, 2048);
+    snprintf(what, sizeof(what), "%s storage %d tiled", sparse_get_simd(),
+             A->storage);
+    check_matrix(what, A);
+    free_sparse_matrix(A);
+}
+
+/* every frozen storage, delta coded or not, with the current SIMD
+   kernels */
+static void check_storages(void)
+{
+    int s, delta;
+
+    for (s = 0; s < CHECK_NB_STORAGE; s++) {
+        for (delta = 0; delta < 2; delta++) {
+            check_frozen(check_storage[s] |
+                         (delta ? SPARSE_INDEX_DELTA : 0));
+        }
+    }
+}
+
+/* numbers the fast path of the parser leaves to strtod (long mantissas,
+   large exponents, inf, nan), and a few it takes */
+static const char *check_number[] = {
+    "0.1", "-2.75", "+7.", ".5", "1e22", "1e23", "-2.5E+23", "1e-30",
+    "3.14159265358979323846264338327950288",
+    "123456789012345678901234567890",
+    "0.000000000000000000000000000000000123456789", "9007199254740993",
+    "1.7976931348623157e308", "2.2250738585072014e-308", "4.9e-324",
+    "inf", "-inf", "nan"
+};
+
+#define CHECK_NB_NUMBER ((int) (sizeof(check_number) / sizeof(char *)))
+
+/* the numbers in a line file and an ijk file, read as strtod reads
+   them */
+static void check_parse(void)
+{
+    struct sparse_matrix_t *A;
+
+    FILE *fd;
+
+    double v, ref;
+
+    long int nb;
+
+    int ijk, k;
+
+    for (ijk = 0; ijk < 2; ijk++) {
+        fd = fopen(CHECK_FILE, "w");
+        assert(fd);
+        fprintf(fd, "1 %d\n", CHECK_NB_NUMBER);
+        if (!ijk) {
+            fprintf(fd, "0 %d\n", CHECK_NB_NUMBER);
+        }
+        for (k = 0; k < CHECK_NB_NUMBER; k++) {
+            if (ijk) {
+                fprintf(fd, "0 %d %s\n", k, check_number[k]);
+            } else {
+                fprintf(fd, "%d %s ", k, check_number[k]);
+            }
+        }
+        if (!ijk) {
+            fprintf(fd, "\n");
+        }
+        fclose(fd);
+
+        A = ijk ? read_ijk_sparse_matrix(CHECK_FILE, 0) :
+            read_sparse_matrix(CHECK_FILE, 0);
+        nb = 0;
+        for (k = 0; k < CHECK_NB_NUMBER; k++) {
+            ref = strtod(check_number[k], NULL);
+            v = sparse_get_value(A, 0, k);
+            if (memcmp(&v, &ref, sizeof(double))
+                && !(isnan(v) && isnan(ref))) {
+                nb++;
+            }
+        }
+        check_count(ijk ? "parser, ijk file" : "parser, line file", nb,
+                    CHECK_NB_NUMBER);
+        free_sparse_matrix(A);
+        unlink(CHECK_FILE);
+    }
+}
+
+/* R written as text and read back */
+static void check_text(void)
+{
+    struct sparse_matrix_t *A;
+
+    write_sparse_matrix(check_R, CHECK_FILE);
+    A = read_sparse_matrix(CHECK_FILE, SPARSE_COL_LINK);
+    check_matrix("text file", A);
+    free_sparse_matrix(A);
+    unlink(CHECK_FILE);
+}
+
+/* CHECK_LOAD_COPY copies of the lines one after the other, large enough to
+   be read by several threads, in order then backwards */
+static void check_load(void)
+{
+    struct sparse_matrix_t *A;
+
+    struct vector_t *y, *Ax, *Aty, *ref_Ax, *ref_Aty;
+
+    FILE *fd;
+
+    long int m = CHECK_LOAD_COPY * CHECK_NB_LINE, i, l, k;
+
+    int backward;
+
+    y = new_vector(m);
+    ref_Ax = new_vector(m);
+    Ax = new_vector(m);
+    ref_Aty = new_vector(CHECK_NB_COL);
+    Aty = new_vector(CHECK_NB_COL);
+    for (i = 0; i < m; i++) {
+        y->mat[i] = check_y->mat[i % CHECK_NB_LINE];
+        ref_Ax->mat[i] = check_Ax->mat[i % CHECK_NB_LINE];
+    }
+    for (i = 0; i < CHECK_NB_COL; i++) {
+        ref_Aty->mat[i] = CHECK_LOAD_COPY * check_Aty->mat[i];
+    }
+
+    for (backward = 0; backward < 2; backward++) {
+        fd = fopen(CHECK_FILE, "w");
+        assert(fd);
+        fprintf(fd, "%ld %d\n", m, CHECK_NB_COL);
+        for (l = 0; l < m; l++) {
+            i = backward ? m - 1 - l : l;
+            fprintf(fd, "%ld %d\n", i, CHECK_ITEM_PER_LINE);
+            for (k = 0; k < CHECK_ITEM_PER_LINE; k++) {
+                fprintf(fd, "%ld %lf ", check_col[i % CHECK_NB_LINE][k],
+                        check_val[i % CHECK_NB_LINE][k]);
+            }
+            fprintf(fd, "\n");
+        }
+        fclose(fd);
+
+        A = read_sparse_matrix(CHECK_FILE, 0);
+        check_products(A, check_x, y, Ax, Aty);
+        check_equal(backward ? "loaded backward lines A*x" :
+                    "loaded lines A*x", Ax->mat, ref_Ax->mat, m);
+        check_equal(backward ? "loaded backward lines A^T*y" :
+                    "loaded lines A^T*y", Aty->mat, ref_Aty->mat,
+                    CHECK_NB_COL);
+        free_sparse_matrix(A);
+        unlink(CHECK_FILE);
+    }
+
+    free_vector(y);
+    free_vector(Ax);
+    free_vector(Aty);
+    free_vector(ref_Ax);
+    free_vector(ref_Aty);
+}
+
+/* binary files, with or without the column arrays, mapped and checked */
+static void check_binary(void)
+{
+    struct sparse_matrix_t *A;
+
+    char what[128];
+
+    int with_col;
+
+    for (with_col = 0; with_col < 2; with_col++) {
+        A = check_stored_matrix(with_col ?
+                                SPARSE_INDEX_32 | SPARSE_VALUE_32 :
+                                SPARSE_STORAGE_64);
+        write_binary_sparse_matrix(A, CHECK_FILE, with_col);
+        free_sparse_matrix(A);
+
+        A = read_binary_sparse_matrix(CHECK_FILE, 1);
+        snprintf(what, sizeof(what), "binary file, columns %d", with_col);
+        check_matrix(what, A);
+        free_sparse_matrix(A);
+        unlink(CHECK_FILE);
+    }
+}
+
+/* streamed products by large and small blocks : binary files without and
+   with the column arrays, then a text file converted without loading it.
+   Duplicates of a converted line are summed. */
+static void check_streams(void)
+{
+    static const size_t block_bytes[] = { 0, 256 << 10 };
+
+    struct sparse_matrix_t *A;
+
+    struct sparse_stream_t *s;
+
+    struct vector_t *Ax = new_vector(CHECK_NB_LINE);
+
+    struct vector_t *Aty = new_vector(CHECK_NB_COL);
+
+    char what[128], *text = CHECK_FILE ".txt";
+
+    FILE *fd;
+
+    int file, b;
+
+    for (file = 0; file < 3; file++) {
+        if (file < 2) {
+            A = check_stored_matrix(file ?
+                                    SPARSE_INDEX_32 | SPARSE_VALUE_32 :
+                                    SPARSE_STORAGE_64);
+            write_binary_sparse_matrix(A, CHECK_FILE, file);
+            free_sparse_matrix(A);
+        } else {
+            write_sparse_matrix(check_R, text);
+            sparse_text_to_binary_stream(text, CHECK_FILE, 0);
+            unlink(text);
+        }
+
+        for (b = 0; b < (int) (sizeof(block_bytes) / sizeof(size_t)); b++) {
+            s = sparse_stream_open(CHECK_FILE, block_bytes[b]);
+            memset(Ax->mat, 0, Ax->length * sizeof(double));
+            memset(Aty->mat, 0, Aty->length * sizeof(double));
+            sparse_stream_mult_vector(s, check_x, Ax);
+            sparse_stream_trans_mult_vector(s, check_y, Aty);
+            sparse_stream_close(s);
+            snprintf(what, sizeof(what), "stream %s, block %ld A*x",
+                     file == 2 ? "converted" : file ? "columns" :
+                     "lines", (long int) block_bytes[b]);
+            check_equal(what, Ax->mat, check_Ax->mat, CHECK_NB_LINE);
+            snprintf(what, sizeof(what), "stream %s, block %ld A^T*y",
+                     file == 2 ? "converted" : file ? "columns" :
+                     "lines", (long int) block_bytes[b]);
+            check_equal(what, Aty->mat, check_Aty->mat, CHECK_NB_COL);
+        }
+        unlink(CHECK_FILE);
+    }
+
+    fd = fopen(text, "w");
+    assert(fd);
+    fprintf(fd, "2 5\n1 2\n3 1 0 2\n0 3\n4 1 1 2 4 0.5\n");
+    fclose(fd);
+    sparse_text_to_binary_stream(text, CHECK_FILE, 0);
+    A = read_binary_sparse_matrix(CHECK_FILE, 1);
+    check_count("stream conversion, duplicates summed",
+                A->nb_item != 4 || sparse_get_value(A, 0, 4) != 1.5
+                || sparse_get_value(A, 0, 1) != 2.
+                || sparse_get_value(A, 1, 3) != 1.
+                || sparse_get_value(A, 1, 0) != 2., 1);
+    free_sparse_matrix(A);
+    unlink(text);
+    unlink(CHECK_FILE);
+
+    free_vector(Ax);
+    free_vector(Aty);
+}
+
+/* AtA*x and AtA^T*x (A^T*A is symmetric) against A^T*(A*x) */
+static void check_ata_product(char *what, struct sparse_matrix_t *AtA,
+                              struct vector_t *ref)
+{
+    struct vector_t *v = new_vector(CHECK_NB_COL);
+
+    char name[256];
+
+    memset(v->mat, 0, CHECK_NB_COL * sizeof(double));
+    sparse_mult_vector(AtA, check_x, v);
+    snprintf(name, sizeof(name), "%s A*x", what);
+    check_equal(name, v->mat, ref->mat, CHECK_NB_COL);
+    memset(v->mat, 0, CHECK_NB_COL * sizeof(double));
+    sparse_trans_mult_vector(AtA, check_x, v);
+    snprintf(name, sizeof(name), "%s A^T*x", what);
+    check_equal(name, v->mat, ref->mat, CHECK_NB_COL);
+    free_vector(v);
+}
+
+/* AtransA() of A frozen with the given storage */
+static void check_ata_storage(int storage, struct vector_t *ref)
+{
+    struct sparse_matrix_t *A, *AtA;
+
+    char what[128];
+
+    A = check_stored_matrix(storage);
+    sparse_freeze(A);
+    AtA = AtransA(A);
+    snprintf(what, sizeof(what), "AtransA storage %d", A->storage);
+    check_ata_product(what, AtA, ref);
+    free_sparse_matrix(AtA);
+    free_sparse_matrix(A);
+}
+
+/* AtransA() of the linked matrix and of every storage, applied to x */
+static void check_ata(void)
+{
+    struct sparse_matrix_t *AtA;
+
+    struct vector_t *ref = new_vector(CHECK_NB_COL);
+
+    long int i, k;
+
+    int s, delta;
+
+    /* A^T*(A*x) from the items */
+    memset(ref->mat, 0, CHECK_NB_COL * sizeof(double));
+    for (i = 0; i < CHECK_NB_LINE; i++) {
+        for (k = 0; k < CHECK_ITEM_PER_LINE; k++) {
+            ref->mat[check_col[i][k]] += check_val[i][k] * check_Ax->mat[i];
+        }
+    }
+
+    AtA = AtransA(check_R);
+    check_ata_product("AtransA linked", AtA, ref);
+    free_sparse_matrix(AtA);
+    for (s = 0; s < CHECK_NB_STORAGE; s++) {
+        for (delta = 0; delta < 2; delta++) {
+            check_ata_storage(check_storage[s] |
+                              (delta ? SPARSE_INDEX_DELTA : 0), ref);
+        }
+    }
+    free_vector(ref);
+}
+
+/* line / column statistics against the linked lines of R */
+static void check_reduce(struct sparse_matrix_t *A)
+{
+    struct sparse_matrix_t *R = check_R;
+
+    struct sparse_reduce_t r;
+
+    struct sparse_item_t *cur_item;
+
+    struct vector_t *line_sum = new_vector(R->nb_line);
+
+    struct vector_t *col_sum = new_vector(R->nb_col);
+
+    struct vector_t *col_count = new_vector(R->nb_col);
+
+    long int i;
+
+    memset(col_sum->mat, 0, R->nb_col * sizeof(double));
+    memset(col_count->mat, 0, R->nb_col * sizeof(double));
+    for (i = 0; i < R->nb_line; i++) {
+        line_sum->mat[i] = 0.;
+        for (cur_item = R->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            line_sum->mat[i] += cur_item->val;
+            col_sum->mat[cur_item->col_index] += cur_item->val;
+            col_count->mat[cur_item->col_index] += 1.;
+        }
+    }
+    sparse_reduce(A, SPARSE_REDUCE_LINE_SUM | SPARSE_REDUCE_COL_SUM |
+                  SPARSE_REDUCE_COL_COUNT, &r);
+    check_equal("sparse_reduce line sum", r.line_sum->mat, line_sum->mat,
+                R->nb_line);
+    check_equal("sparse_reduce column sum", r.col_sum->mat, col_sum->mat,
+                R->nb_col);
+    check_equal("sparse_reduce column count", r.col_count->mat,
+                col_count->mat, R->nb_col);
+    sparse_free_reduce(&r);
+    free_vector(line_sum);
+    free_vector(col_sum);
+    free_vector(col_count);
+}
+
+/* the column links of A against the ones of R */
+static void check_columns(char *what, struct sparse_matrix_t *A)
+{
+    struct sparse_item_t *a, *r;
+
+    long int j, nb = 0;
+
+    for (j = 0; j < check_R->nb_col; j++) {
+        for (a = A->col[j], r = check_R->col[j]; a || r;
+             a = a->next_in_col, r = r->next_in_col) {
+            if (!a || !r || a->line_index != r->line_index
+                || a->val != r->val) {
+                nb++;
+                break;
+            }
+        }
+    }
+    check_count(what, nb, check_R->nb_col);
+}
+
+/* the items added as triplets, lines and items out of order, sorted and
+   linked by the threads */
+static void check_triplets(void)
+{
+    struct sparse_triplet_t *t;
+
+    struct sparse_matrix_t *A;
+
+    long int i, l, k;
+
+    t = new_sparse_triplet(CHECK_NB_LINE, CHECK_NB_COL, 0);
+    for (l = 0; l < CHECK_NB_LINE; l++) {
+        i = (l * 7919) % CHECK_NB_LINE;
+        for (k = CHECK_ITEM_PER_LINE - 1; k >= 0; k--) {
+            sparse_triplet_add(t, i, check_col[i][k], check_val[i][k]);
+        }
+    }
+    A = sparse_triplet_to_matrix(t, SPARSE_COL_LINK, SPARSE_DUPLICATE_SUM);
+    check_count("triplets without duplicate", t->nb_duplicate, 1);
+    check_matrix("triplets", A);
+    check_columns("triplets columns", A);
+    free_sparse_matrix(A);
+    free_sparse_triplet(t);
+}
+
+/* three items on (1,2) among five */
+static struct sparse_matrix_t *check_duplicate_matrix(int duplicate,
+                                                      long int
+                                                      *nb_duplicate)
+{
+    struct sparse_triplet_t *t;
+
+    struct sparse_matrix_t *A;
+
+    t = new_sparse_triplet(2, 3, 0);
+    sparse_triplet_add(t, 1, 2, 1.);
+    sparse_triplet_add(t, 0, 1, 0.5);
+    sparse_triplet_add(t, 1, 2, 2.);
+    sparse_triplet_add(t, 1, 0, 4.);
+    sparse_triplet_add(t, 1, 2, 8.);
+    A = sparse_triplet_to_matrix(t, 0, duplicate);
+    *nb_duplicate = t->nb_duplicate;
+    free_sparse_triplet(t);
+    return (A);
+}
+
+/* duplicates summed, the last one kept, or the program stopped */
+static void check_duplicates(void)
+{
+    struct sparse_matrix_t *A;
+
+    long int nb;
+
+    pid_t pid;
+
+    int status;
+
+    A = check_duplicate_matrix(SPARSE_DUPLICATE_SUM, &nb);
+    check_count("duplicates summed", nb != 2 || A->nb_item != 3
+                || sparse_get_value(A, 1, 2) != 11.
+                || sparse_get_value(A, 0, 1) != 0.5, 1);
+    free_sparse_matrix(A);
+
+    A = check_duplicate_matrix(SPARSE_DUPLICATE_REPLACE, &nb);
+    check_count("duplicates replaced", nb != 2 || A->nb_item != 3
+                || sparse_get_value(A, 1, 2) != 8.
+                || sparse_get_value(A, 1, 0) != 4., 1);
+    free_sparse_matrix(A);
+
+    /* the error policy exits : in a child */
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    assert(pid >= 0);
+    if (!pid) {
+        sparse_set_nb_thread(1);
+        check_duplicate_matrix(SPARSE_DUPLICATE_ERROR, &nb);
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    check_count("duplicates as errors",
+                !WIFEXITED(status) || WEXITSTATUS(status) != 1, 1);
+}
+
+/* columns linked once all the items are set */
+static void check_col_link(void)
+{
+    struct sparse_matrix_t *A;
+
+    A = check_new_matrix(0);
+    sparse_build_col_link(A);
+    check_columns("sparse_build_col_link", A);
+    check_matrix("columns linked afterwards", A);
+    free_sparse_matrix(A);
+}
+
+/* values of every magnitude, 6 digit ties included */
+static double check_odd_value(long int n)
+{
+    static const double special[] = {
+        5e-7, -5e-7, 2.5e-7, 1.5e-6, 0.1234565, 1e300, -1e22,
+        4503599627370496.5, 0.1, 1. / 3.
+    };
+
+    if (n < (long int) (sizeof(special) / sizeof(double))) {
+        return (special[n]);
+    }
+    return (((double) rand() / RAND_MAX - 0.5) * pow(10., n % 19 - 9.));
+}
+
+/* a 100x50 matrix of odd values, 10 items per line */
+static struct sparse_matrix_t *check_odd_matrix(void)
+{
+    struct sparse_matrix_t *A;
+
+    long int i, k;
+
+    srand(29);
+    A = new_sparse_matrix(100, 50, 0);
+    for (i = 0; i < 100; i++) {
+        for (k = 0; k < 10; k++) {
+            sparse_set_value(A, i, 5 * k + i % 5, check_odd_value(10 * i + k),
+                             NULL);
+        }
+    }
+    return (A);
+}
+
+/* count a failure if the two files differ */
+static void check_same_file(char *what, char *filename1, char *filename2)
+{
+    FILE *fd1, *fd2;
+
+    int c1, c2;
+
+    fd1 = fopen(filename1, "r");
+    fd2 = fopen(filename2, "r");
+    assert(fd1 && fd2);
+    do {
+        c1 = getc(fd1);
+        c2 = getc(fd2);
+    } while (c1 == c2 && c1 != EOF);
+    fclose(fd1);
+    fclose(fd2);
+    check_count(what, c1 != c2, 1);
+}
+
+/* A written as the former write_sparse_matrix() did, with "%lf" */
+static void check_write_lf(struct sparse_matrix_t *A, char *filename)
+{
+    struct sparse_item_t *cur_item;
+
+    FILE *fd;
+
+    long int i, nb_item;
+
+    fd = fopen(filename, "w");
+    assert(fd);
+    fprintf(fd, "%ld %ld\n", A->nb_line, A->nb_col);
+    for (i = 0; i < A->nb_line; i++) {
+        nb_item = 0;
+        for (cur_item = A->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            nb_item++;
+        }
+        if (!nb_item) {
+            continue;
+        }
+        fprintf(fd, "%ld %ld\n", i, nb_item);
+        for (cur_item = A->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            fprintf(fd, "%ld %lf ", cur_item->col_index, cur_item->val);
+        }
+        fprintf(fd, "\n");
+    }
+    fclose(fd);
+}
+
+/* with 6 digits, the files are the ones of the former fprintf("%lf") ;
+   with the default precision, values are read back exactly */
+static void check_write(void)
+{
+    struct sparse_matrix_t *W, *A;
+
+    struct sparse_item_t *cur_item;
+
+    struct vector_t *v, *u;
+
+    char *ref = CHECK_FILE ".ref";
+
+    FILE *fd;
+
+    long int i, nb;
+
+    W = check_odd_matrix();
+    v = new_vector(1000);
+    for (i = 0; i < v->length; i++) {
+        v->mat[i] = check_odd_value(i);
+    }
+
+    sparse_set_write_precision(6);
+    write_sparse_matrix(W, CHECK_FILE);
+    check_write_lf(W, ref);
+    check_same_file("matrix written with 6 digits", CHECK_FILE, ref);
+    write_sparse_matrix(check_R, CHECK_FILE);
+    check_write_lf(check_R, ref);
+    check_same_file("large matrix written with 6 digits", CHECK_FILE, ref);
+    write_vector(v, CHECK_FILE);
+    fd = fopen(ref, "w");
+    assert(fd);
+    fprintf(fd, "%ld\n", v->length);
+    for (i = 0; i < v->length; i++) {
+        fprintf(fd, "%ld %f\n", i, v->mat[i]);
+    }
+    fclose(fd);
+    check_same_file("vector written with 6 digits", CHECK_FILE, ref);
+    unlink(ref);
+
+    sparse_set_write_precision(-1);
+    write_sparse_matrix(W, CHECK_FILE);
+    A = read_sparse_matrix(CHECK_FILE, 0);
+    nb = A->nb_item != W->nb_item;
+    for (i = 0; i < W->nb_line; i++) {
+        for (cur_item = W->line[i]; cur_item;
+             cur_item = cur_item->next_in_line) {
+            nb += sparse_get_value(A, i, cur_item->col_index) !=
+                cur_item->val;
+        }
+    }
+    check_count("matrix read back exactly", nb, W->nb_item);
+    free_sparse_matrix(A);
+    write_vector(v, CHECK_FILE);
+    u = read_vector(CHECK_FILE);
+    check_equal("vector read back exactly", u->mat, v->mat, v->length);
+    free_vector(u);
+    unlink(CHECK_FILE);
+
+    free_vector(v);
+    free_sparse_matrix(W);
+}
+
+/* R and x written compressed (checking the magic number of the file) and
+   read back */
+static void check_compressed(void)
+{
+    static const char *suffix[] = { ".gz", ".zst" };
+
+    static const unsigned char magic[][4] = {
+        { 0x1f, 0x8b, 0, 0 }, { 0x28, 0xb5, 0x2f, 0xfd }
+    };
+
+    static const int magic_size[] = { 2, 4 };
+
+    static const int available[] = { CHECK_GZIP, CHECK_ZSTD };
+
+    struct sparse_matrix_t *A;
+
+    struct vector_t *v;
+
+    unsigned char head[4];
+
+    char filename[64], what[128];
+
+    FILE *fd;
+
+    int c;
+
+    for (c = 0; c < 2; c++) {
+        if (!available[c]) {
+            continue;
+        }
+        snprintf(filename, sizeof(filename), "%s%s", CHECK_FILE, suffix[c]);
+        write_sparse_matrix(check_R, filename);
+        fd = fopen(filename, "r");
+        assert(fd);
+        memset(head, 0, sizeof(head));
+        snprintf(what, sizeof(what), "compressed file %s magic", suffix[c]);
+        check_count(what, fread(head, 1, magic_size[c], fd) !=
+                    (size_t) magic_size[c]
+                    || memcmp(head, magic[c], magic_size[c]), 1);
+        fclose(fd);
+        A = read_sparse_matrix(filename, 0);
+        snprintf(what, sizeof(what), "compressed file %s", suffix[c]);
+        check_matrix(what, A);
+        free_sparse_matrix(A);
+
+        write_vector(check_x, filename);
+        v = read_vector(filename);
+        snprintf(what, sizeof(what), "compressed vector %s", suffix[c]);
+        check_equal(what, v->mat, check_x->mat, CHECK_NB_COL);
+        free_vector(v);
+        unlink(filename);
+    }
+}
+
+/* Matrix Market files the writer doesn't produce, and their 3x3 dense
+   values once expanded by the reader */
+static const char *check_mm_file[] = {
+    "%%MatrixMarket matrix coordinate real symmetric\n"
+    "% lower triangle\n3 3 4\n1 1 2.5\n2 1 -1\n3 2 4\n3 3 1\n",
+    "%%MatrixMarket matrix coordinate real skew-symmetric\n"
+    "3 3 2\n2 1 3\n3 1 -2\n",
+    "%%MatrixMarket matrix coordinate pattern general\n"
+    "3 3 3\n1 3\n2 1\n2 2\n",
+    "%%MatrixMarket matrix coordinate pattern symmetric\n"
+    "3 3 2\n2 1\n3 3\n",
+    "%%MatrixMarket matrix coordinate integer general\n"
+    "3 3 2\n1 2 -7\n3 1 12\n"
+};
+
+static const char *check_mm_name[] = {
+    "symmetric", "skew-symmetric", "pattern", "pattern symmetric",
+    "integer"
+};
+
+static const double check_mm_dense[][9] = {
+    { 2.5, -1., 0., -1., 0., 4., 0., 4., 1. },
+    { 0., -3., 2., 3., 0., 0., -2., 0., 0. },
+    { 0., 0., 1., 1., 1., 0., 0., 0., 0. },
+    { 0., 1., 0., 1., 0., 0., 0., 0., 1. },
+    { 0., -7., 0., 0., 0., 0., 12., 0., 0. }
+};
+
+/* R written as a (general) Matrix Market file and read back, then the
+   symmetric, skew-symmetric and pattern files */
+static void check_mm(void)
+{
+    struct sparse_matrix_t *A;
+
+    FILE *fd;
+
+    char what[128];
+
+    long int nb, nb_item;
+
+    int f, k;
+
+    write_mm_sparse_matrix(check_R, CHECK_FILE);
+    A = read_mm_sparse_matrix(CHECK_FILE, 0);
+    check_matrix("Matrix Market file", A);
+    free_sparse_matrix(A);
+
+    for (f = 0; f < (int) (sizeof(check_mm_file) / sizeof(char *)); f++) {
+        fd = fopen(CHECK_FILE, "w");
+        assert(fd);
+        fputs(check_mm_file[f], fd);
+        fclose(fd);
+        A = read_mm_sparse_matrix(CHECK_FILE, 0);
+        nb = (A->nb_line != 3 || A->nb_col != 3);
+        nb_item = 0;
+        for (k = 0; k < 9 && !nb; k++) {
+            nb += sparse_get_value(A, k / 3, k % 3) != check_mm_dense[f][k];
+            nb_item += check_mm_dense[f][k] != 0.;
+        }
+        nb += A->nb_item != nb_item;
+        snprintf(what, sizeof(what), "Matrix Market %s",
+                 check_mm_name[f]);
+        check_count(what, nb, 9);
+        free_sparse_matrix(A);
+    }
+    unlink(CHECK_FILE);
+}
+
+/* the lines of R written in two row block files, read back in parallel */
+static void check_blocks(void)
+{
+    struct sparse_matrix_t *R = check_R, *B, *A;
+
+    struct sparse_item_t *cur_item, *last_item;
+
+    char name[2][64], *filename[2];
+
+    long int offset[2], i;
+
+    int k;
+
+    offset[0] = 0;
+    offset[1] = R->nb_line / 2;
+    for (k = 0; k < 2; k++) {
+        snprintf(name[k], sizeof(name[k]), "%s.block%d", CHECK_FILE, k);
+        filename[k] = name[k];
+        B = new_sparse_matrix(k ? R->nb_line - offset[1] : offset[1],
+                              R->nb_col, 0);
+        for (i = 0; i < B->nb_line; i++) {
+            last_item = NULL;
+            for (cur_item = R->line[offset[k] + i]; cur_item;
+                 cur_item = cur_item->next_in_line) {
+                last_item = sparse_set_value(B, i, cur_item->col_index,
+                                             cur_item->val, last_item);
+            }
+        }
+        write_sparse_matrix(B, filename[k]);
+        free_sparse_matrix(B);
+    }
+    A = read_sparse_matrix_blocks(2, filename, offset, 0);
+    check_matrix("row blocks", A);
+    free_sparse_matrix(A);
+    for (k = 0; k < 2; k++) {
+        unlink(filename[k]);
+    }
+}
+
+/* three shards, their products gathered and summed here */
+static void check_shards(void)
+{
+    struct sparse_matrix_t *A;
+
+    struct sparse_shard_t *shard;
+
+    struct vector_t *Ax = new_vector(CHECK_NB_LINE);
+
+    struct vector_t *Aty = new_vector(CHECK_NB_COL);
+
+    char filename[64];
+
+    int k;
+
+    A = check_new_matrix(0);
+    sparse_shard_write(A, 3, CHECK_FILE);
+    free_sparse_matrix(A);
+    memset(Ax->mat, 0, Ax->length * sizeof(double));
+    memset(Aty->mat, 0, Aty->length * sizeof(double));
+    for (k = 0; k < 3; k++) {
+        shard = sparse_shard_open_part(CHECK_FILE, k, 1);
+        sparse_shard_mult_vector(shard, check_x, Ax, NULL);
+        sparse_shard_trans_mult_vector(shard, check_y, Aty, NULL);
+        sparse_shard_close(shard);
+        snprintf(filename, sizeof(filename), "%s.%d", CHECK_FILE, k);
+        unlink(filename);
+    }
+    check_equal("shards A*x", Ax->mat, check_Ax->mat, CHECK_NB_LINE);
+    check_equal("shards A^T*y", Aty->mat, check_Aty->mat, CHECK_NB_COL);
+
+    free_vector(Ax);
+    free_vector(Aty);
+}
+
+/* a few LSQR and LSMR iterations on nt threads, against one thread (only
+   the order of the sums differs) */
+static void check_lsqr(int nt)
+{
+    struct sparse_matrix_t *A;
+
+    struct sparse_lsqr_t p;
+
+    struct vector_t *x[2];
+
+    char what[128];
+
+    int delta, method, k;
+
+    for (delta = 0; delta < 2; delta++) {
+        A = check_stored_matrix(delta ? SPARSE_INDEX_DELTA : 0);
+        sparse_freeze(A);
+        for (method = 0; method < 2; method++) {
+            for (k = 0; k < 2; k++) {
+                sparse_set_nb_thread(k ? nt : 1);
+                x[k] = new_vector(A->nb_col);
+                memset(x[k]->mat, 0, A->nb_col * sizeof(double));
+                sparse_lsqr_init(&p);
+                p.atol = 0.;
+                p.btol = 0.;
+                p.max_iter = 30;
+                if (method) {
+                    sparse_lsmr(A, check_y, x[k], &p);
+                } else {
+                    sparse_lsqr(A, check_y, x[k], &p);
+                }
+            }
+            snprintf(what, sizeof(what), "%s, storage %d",
+                     method ? "lsmr" : "lsqr", A->storage);
+            check_close(what, x[1]->mat, x[0]->mat, A->nb_col, 1e-9);
+            free_vector(x[0]);
+            free_vector(x[1]);
+        }
+        free_sparse_matrix(A);
+    }
+}
+
+/* count the entries of perm[0..n) that are not a permutation of 0..n-1 */
+static long int check_not_perm(const long int *perm, long int n)
+{
+    char *seen = (char *) calloc(n + 1, 1);
+
+    long int k, nb = 0;
+
+    assert(seen);
+    for (k = 0; k < n; k++) {
+        if (perm[k] < 0 || perm[k] >= n || seen[perm[k]]) {
+            nb++;
+        } else {
+            seen[perm[k]] = 1;
+        }
+    }
+    free(seen);
+    return (nb);
+}
+
+/* each reordering of R : permuted copies of the linked and frozen matrix
+   give the products of the items once back in the original numbering,
+   and the permutation is read back as written */
+static void check_perm(void)
+{
+    static const char *name[] = { "line", "rcm" };
+
+    struct sparse_perm_t *p, *q;
+
+    struct sparse_matrix_t *A, *P;
+
+    struct vector_t *x, *y, *Px, *Pty, *Ax, *Aty;
+
+    char what[128];
+
+    long int nb, k;
+
+    int method, frozen;
+
+    for (method = SPARSE_REORDER_LINES; method <= SPARSE_REORDER_RCM;
+         method++) {
+        p = sparse_reorder(check_R, method);
+        snprintf(what, sizeof(what), "sparse_reorder %s", name[method]);
+        check_count(what, check_not_perm(p->line, p->nb_line) +
+                    check_not_perm(p->col, p->nb_col),
+                    p->nb_line + p->nb_col);
+
+        x = sparse_perm_to_new(p, SPARSE_PERM_COL, check_x);
+        y = sparse_perm_to_new(p, SPARSE_PERM_LINE, check_y);
+        Ax = sparse_perm_to_orig(p, SPARSE_PERM_COL, x);
+        snprintf(what, sizeof(what), "sparse_perm_to_orig %s", name[method]);
+        check_equal(what, Ax->mat, check_x->mat, CHECK_NB_COL);
+        free_vector(Ax);
+
+        Px = new_vector(CHECK_NB_LINE);
+        Pty = new_vector(CHECK_NB_COL);
+        for (frozen = 0; frozen < 2; frozen++) {
+            A = check_new_matrix(0);
+            if (frozen) {
+                sparse_freeze(A);
+            }
+            P = sparse_permute(A, p, 0);
+            check_products(P, x, y, Px, Pty);
+            Ax = sparse_perm_to_orig(p, SPARSE_PERM_LINE, Px);
+            Aty = sparse_perm_to_orig(p, SPARSE_PERM_COL, Pty);
+            snprintf(what, sizeof(what), "sparse_permute %s %s A*x",
+                     name[method], frozen ? "frozen" : "linked");
+            check_equal(what, Ax->mat, check_Ax->mat, CHECK_NB_LINE);
+            snprintf(what, sizeof(what), "sparse_permute %s %s A^T*y",
+                     name[method], frozen ? "frozen" : "linked");
+            check_equal(what, Aty->mat, check_Aty->mat, CHECK_NB_COL);
+            free_vector(Ax);
+            free_vector(Aty);
+            free_sparse_matrix(P);
+            free_sparse_matrix(A);
+        }
+        free_vector(Px);
+        free_vector(Pty);
+        free_vector(x);
+        free_vector(y);
+
+        write_sparse_perm(p, CHECK_FILE);
+        q = read_sparse_perm(CHECK_FILE);
+        nb = (q->nb_line != p->nb_line || q->nb_col != p->nb_col);
+        for (k = 0; k < p->nb_line && !nb; k++) {
+            nb += q->line[k] != p->line[k];
+        }
+        for (k = 0; k < p->nb_col && !nb; k++) {
+            nb += q->col[k] != p->col[k];
+        }
+        snprintf(what, sizeof(what), "sparse_perm file %s", name[method]);
+        check_count(what, nb, p->nb_line + p->nb_col);
+        sparse_free_perm(q);
+        sparse_free_perm(p);
+        unlink(CHECK_FILE);
+    }
+}
+
+/* values of every width, three thirds of powers of two */
+static struct sparse_matrix_t *check_rounded_matrix(void)
+{
+    struct sparse_matrix_t *A;
+
+    long int i, k;
+
+    srand(31);
+    A = new_sparse_matrix(100, 50, 0);
+    for (i = 0; i < 100; i++) {
+        for (k = 0; k < 10; k++) {
+            sparse_set_value(A, i, 5 * k + i % 5,
+                             (1 + rand() % 1000) / 3. *
+                             ldexp(1., rand() % 20 - 10), NULL);
+        }
+    }
+    return (A);
+}
+
+/* the error reported by sparse_value_error() for each value width is the
+   largest relative error of the frozen copy, none for the items */
+static void check_value_error(void)
+{
+    static const int width[] = {
+        SPARSE_VALUE_32, SPARSE_VALUE_BF16, SPARSE_VALUE_FP16
+    };
+
+    struct sparse_matrix_t *W, *A;
+
+    struct sparse_item_t *cur_item;
+
+    char what[128];
+
+    double err, max, r;
+
+    long int i;
+
+    int w;
+
+    W = check_rounded_matrix();
+    for (w = 0; w < 3; w++) {
+        err = sparse_value_error(W, width[w]);
+        A = check_rounded_matrix();
+        sparse_set_storage(A, width[w]);
+        sparse_freeze(A);
+        max = 0.;
+        for (i = 0; i < W->nb_line; i++) {
+            for (cur_item = W->line[i]; cur_item;
+                 cur_item = cur_item->next_in_line) {
+                r = fabs(sparse_get_value(A, i, cur_item->col_index) -
+                         cur_item->val) / fabs(cur_item->val);
+                max = (r > max) ? r : max;
+            }
+        }
+        free_sparse_matrix(A);
+        snprintf(what, sizeof(what), "sparse_value_error storage %d",
+                 width[w]);
+        check_count(what, err != max || err == 0.
+                    || sparse_value_error(check_R, width[w]) != 0., 1);
+    }
+    free_sparse_matrix(W);
+}
+
+int main(int argc, char **argv)
+{
+    struct sparse_matrix_t *A;
+
+    const char *simd[] = { "avx512", "avx2", "sse2", "generic" };
+
+    const char *best;
+
+    int nt, k;
+
+    if (argc != 2 || (nt = atoi(argv[1])) < 1) {
+        fprintf(stderr, "usage: %s nb_thread\n", argv[0]);
+        exit(1);
+    }
+
+    /* the reference : linked lines and columns built on one thread */
+    sparse_set_nb_thread(1);
+    check_items();
+    check_R = check_new_matrix(SPARSE_COL_LINK);
+    check_x = check_vector(CHECK_NB_COL, 13);
+    check_y = check_vector(CHECK_NB_LINE, 11);
+    check_Ax = new_vector(CHECK_NB_LINE);
+    check_Aty = new_vector(CHECK_NB_COL);
+    check_reference();
+
+    sparse_set_nb_thread(nt);
+    fprintf(stderr, "check %d threads\n", nt);
+
+    check_matrix("linked", check_R);
+    A = check_new_matrix(0);
+    check_get_values("linked", A);
+    check_reduce(A);
+    sparse_freeze(A);
+    check_freeze(A);
+    check_matrix("frozen", A);
+    check_get_values("frozen", A);
+    check_reduce(A);
+    free_sparse_matrix(A);
+
+    check_arena();
+    check_triplets();
+    check_duplicates();
+    check_col_link();
+
+    best = sparse_get_simd();
+    for (k = 0; k < (int) (sizeof(simd) / sizeof(char *)); k++) {
+        if (sparse_set_simd(simd[k])) {
+            check_storages();
+        }
+    }
+    sparse_set_simd(best);
+
+    check_ata();
+    check_value_error();
+    check_parse();
+    check_text();
+    check_load();
+    check_write();
+    check_compressed();
+    check_mm();
+    check_binary();
+    check_streams();
+    check_shards();
+    check_blocks();
+    check_lsqr(nt);
+    check_perm();
+
+    free_vector(check_x);
+    free_vector(check_y);
+    free_vector(check_Ax);
+    free_vector(check_Aty);
+    free_sparse_matrix(check_R);
+
+    fprintf(stderr, "check %d threads : %d failed\n", nt, nb_failed);
+    return (nb_failed ? 1 : 0);
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+# every kernel on one thread, on 4 threads, and on 4 threads asked for
+# while OpenMP gives a team of 2
+./sparse_check 1 || exit 1
+./sparse_check 4 || exit 1
+OMP_THREAD_LIMIT=2 ./sparse_check 4 || exit 1